@@ -0,0 +1,61 @@
+/*******************************************************************************
+# MJPEG checks of input_uvc for hotpath_bench                                  #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdlib.h>
+
+#include "../plugins/input_uvc/v4l2uvc.h"
+#include "hotpath_uvc.h"
+
+/******************************************************************************
+Description.: a camera that sends pictures like this one, it only knows its
+              resolution and learns the header profile from the picture like
+              input_uvc does from the first frame
+Input Value.: * jpeg...: the picture
+              * size...: its size
+              * width, height: of the picture
+Return Value: the device or NULL if the picture is broken or memory is short
+******************************************************************************/
+struct vdIn *uvc_bench_device(unsigned char *jpeg, int size, int width, int height)
+{
+    struct vdIn *vd = calloc(1, sizeof(struct vdIn));
+
+    if(vd == NULL)
+        return NULL;
+
+    vd->width = width;
+    vd->height = height;
+    vd->formatIn = V4L2_PIX_FMT_MJPEG;
+
+    if(uvc_dht_offset(vd, jpeg, size) < 0 || uvc_jpeg_valid(vd, jpeg, size) == 0) {
+        free(vd);
+        return NULL;
+    }
+
+    return vd;
+}
+
+int uvc_bench_dht_offset(struct vdIn *vd, unsigned char *jpeg, int size)
+{
+    return uvc_dht_offset(vd, jpeg, size);
+}
+
+int uvc_bench_jpeg_valid(struct vdIn *vd, unsigned char *jpeg, int size)
+{
+    return uvc_jpeg_valid(vd, jpeg, size);
+}
@@ -0,0 +1,33 @@
+/*******************************************************************************
+# MJPEG checks of input_uvc for hotpath_bench                                  #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef HOTPATH_UVC_H
+#define HOTPATH_UVC_H
+
+/*
+ * The headers of input_uvc and output_http both define a context, so the
+ * benchmarks of input_uvc get their device from hotpath_uvc.c.
+ */
+struct vdIn;
+
+struct vdIn *uvc_bench_device(unsigned char *jpeg, int size, int width, int height);
+int uvc_bench_dht_offset(struct vdIn *vd, unsigned char *jpeg, int size);
+int uvc_bench_jpeg_valid(struct vdIn *vd, unsigned char *jpeg, int size);
+
+#endif
@@ -0,0 +1,199 @@
+/*******************************************************************************
+# Benchmark of the JPEG encoder of the raw input plugins                       #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Compresses synthetic pictures once with a new encoder per frame, like the
+ * plugins used to do, and once with one encoder kept for all frames. The
+ * difference is the per-frame setup cost, it is printed as time per frame
+ * and as share of a core at 30 and 60 fps. With -s the encoders split every
+ * picture into stripes compressed in parallel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../plugins/jpeg_utils.h"
+
+#define BATCH 10
+
+static const struct {
+    const char *name;
+    int width, height;
+} resolutions[] = {
+    { "QVGA", 320, 240 },
+    { "VGA", 640, 480 },
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 }
+};
+
+static const struct {
+    const char *name;
+    int format, bytes_per_pixel;
+} formats[] = {
+    { "YUYV", V4L2_PIX_FMT_YUYV, 2 },
+    { "RGB565", V4L2_PIX_FMT_RGB565, 2 },
+    { "RGB24", V4L2_PIX_FMT_RGB24, 3 }
+};
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************
+Description.: fills the picture with a gradient and some noise, so it
+              compresses about as well as a camera picture
+Input Value.: picture and its size
+Return Value: -
+******************************************************************************/
+static void fill_picture(unsigned char *raw, int size)
+{
+    int i;
+
+    srand(1);
+    for(i = 0; i < size; i++)
+        raw[i] = (i / 7 + (i >> 9) + (rand() & 15)) & 0xff;
+}
+
+/******************************************************************************
+Description.: Compresses the picture several times. The frames are timed in
+              batches of ten and the fastest batch counts, that keeps other
+              processes and frequency scaling out of the result.
+Input Value.: * persistent: keep one encoder, otherwise one per frame
+              * stripes: stripes per picture
+              * raw, width, height, format of the picture
+              * buffer and size for the JPEG
+              * quality: JPEG quality
+              * frames.: number of pictures to compress
+Return Value: milliseconds per picture, negative on errors
+******************************************************************************/
+static double run(int persistent, int stripes, unsigned char *raw, int width, int height, int format,
+                  unsigned char *buffer, int size, int quality, int frames)
+{
+    jpeg_encoder *enc = NULL;
+    double start, batch, best = -1;
+    int i;
+
+    if(persistent && (enc = jpeg_encoder_new(stripes)) == NULL)
+        return -1;
+
+    start = now();
+    for(i = 0; i < frames; i++) {
+        if(!persistent && (enc = jpeg_encoder_new(stripes)) == NULL)
+            return -1;
+
+        if(jpeg_encoder_compress(enc, raw, width, height, format, JPEG_CHROMA_420, buffer, size, quality) <= 0)
+            return -1;
+
+        if(!persistent) {
+            jpeg_encoder_free(enc);
+            enc = NULL;
+        }
+
+        if(i % BATCH == BATCH - 1 || i == frames - 1) {
+            batch = (now() - start) * 1000 / (i % BATCH + 1);
+            if(best < 0 || batch < best)
+                best = batch;
+            start = now();
+        }
+    }
+
+    jpeg_encoder_free(enc);
+
+    return best;
+}
+
+static void help(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-n frames] [-q quality] [-s stripes]\n", progname);
+    fprintf(stderr, " -n frames...: pictures per measurement, default 200\n");
+    fprintf(stderr, " -q quality..: JPEG quality, default 80\n");
+    fprintf(stderr, " -s stripes..: stripes compressed in parallel, default 1\n");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char *raw, *buffer;
+    double once, kept;
+    int frames = 200, quality = 80, stripes = 1;
+    int r, f, c, size;
+
+    while((c = getopt(argc, argv, "n:q:s:h")) != -1) {
+        switch(c) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'q':
+            quality = atoi(optarg);
+            break;
+        case 's':
+            stripes = atoi(optarg);
+            break;
+        default:
+            help(argv[0]);
+            return 1;
+        }
+    }
+
+    if(frames <= 0 || stripes < 1 || stripes > JPEG_MAX_STRIPES) {
+        help(argv[0]);
+        return 1;
+    }
+
+    printf("%-6s %-7s %12s %12s %10s %10s %10s\n", "size", "format", "new [ms]", "kept [ms]",
+           "setup [ms]", "@30fps", "@60fps");
+
+    for(r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+        for(f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+            size = resolutions[r].width * resolutions[r].height * formats[f].bytes_per_pixel;
+            raw = malloc(size);
+            buffer = malloc(size);
+            if(raw == NULL || buffer == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                return 1;
+            }
+            fill_picture(raw, size);
+
+            /* warm up caches and the CPU clock */
+            run(1, stripes, raw, resolutions[r].width, resolutions[r].height, formats[f].format, buffer, size, quality, 5);
+
+            once = run(0, stripes, raw, resolutions[r].width, resolutions[r].height, formats[f].format, buffer, size, quality, frames);
+            kept = run(1, stripes, raw, resolutions[r].width, resolutions[r].height, formats[f].format, buffer, size, quality, frames);
+            if(once < 0 || kept < 0) {
+                fprintf(stderr, "compressing %s %s failed\n", resolutions[r].name, formats[f].name);
+                return 1;
+            }
+
+            /* share of one core the setup costs at the frame rate */
+            printf("%-6s %-7s %12.3f %12.3f %10.3f %9.2f%% %9.2f%%\n", resolutions[r].name, formats[f].name,
+                   once, kept, once - kept, (once - kept) * 30 / 10, (once - kept) * 60 / 10);
+
+            free(raw);
+            free(buffer);
+        }
+    }
+
+    return 0;
+}
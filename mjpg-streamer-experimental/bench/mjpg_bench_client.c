@@ -0,0 +1,890 @@
+/*******************************************************************************
+# Load generator and latency benchmark for the HTTP output plugin              #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Opens many concurrent stream and snapshot connections to output_http from
+ * a single epoll loop, optionally closing and reopening streams to simulate
+ * churn. Every received frame is matched with its X-Timestamp and
+ * X-Sequence headers, the per client and total frame rates, throughput,
+ * dropped frames and capture to receipt latencies get printed as JSON.
+ *
+ * The latency compares X-Timestamp with the wall clock, or with
+ * CLOCK_MONOTONIC if the timestamp is obviously no wall clock time, as the
+ * V4L2 timestamps of input_uvc are. Both only make sense if the server runs
+ * on the same machine or the clocks are synchronized.
+ *
+ * With -L the client asks for the X-Stages header and decodes the frame
+ * stamp drawn into every picture (input_testpicture -stamp, input_uvc
+ * -replay_stamp), the latency from the stamp to the receipt of the picture
+ * gets broken down into the stages of the server.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <setjmp.h>
+
+#ifndef NO_LIBJPEG
+#include <jpeglib.h>
+#include "../plugins/frame_stamp.h"
+#endif
+
+#define HEADER_MAX 4096
+#define EVENTS 256
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+
+typedef enum {
+    CLIENT_STREAM,
+    CLIENT_SNAPSHOT
+} client_type;
+
+typedef enum {
+    STATE_IDLE,             /* waits to connect */
+    STATE_CONNECTING,
+    STATE_HTTP_HEADER,      /* reads the response header */
+    STATE_PART_HEADER,      /* reads the boundary and the header of a part */
+    STATE_BODY              /* skips Content-Length bytes of a picture */
+} client_state;
+
+/* stages of a frame between its stamp and the client */
+typedef enum {
+    STAGE_CAPTURE,          /* stamp to captured */
+    STAGE_ENCODE,           /* captured to encoded */
+    STAGE_PUBLISH,          /* encoded to published */
+    STAGE_QUEUE,            /* published to sent */
+    STAGE_SEND,             /* sent to received */
+    STAGE_TOTAL,            /* stamp to received */
+    STAGE_COUNT
+} stage;
+
+static const char *stage_names[STAGE_COUNT] = { "capture", "encode", "publish", "queue", "send", "total" };
+
+/* times of the X-Stages header */
+typedef enum {
+    AT_CAPTURED,
+    AT_ENCODED,
+    AT_PUBLISHED,
+    AT_SENT,
+    AT_COUNT
+} stage_time;
+
+/* milliseconds, one per frame */
+typedef struct {
+    float *v;
+    unsigned long count, size;
+} samples;
+
+typedef struct {
+    int id;
+    client_type type;
+    client_state state;
+    int fd;
+    double retry;               /* when an idle client connects again */
+
+    char header[HEADER_MAX];
+    int header_len;
+    char boundary[80];          /* "--" and the boundary of the stream */
+    long long remaining;        /* bytes of the picture still to come */
+
+    /* headers of the part being received */
+    struct timeval timestamp;
+    int timestamp_set;
+    unsigned int seq;
+    int seq_set;
+    double at[AT_COUNT];        /* X-Stages, 0 for the unknown ones */
+    int at_set;
+
+    unsigned int last_seq;
+    int last_seq_set;
+
+    /* the picture being received, only kept with -L */
+    unsigned char *body;
+    long long body_len, body_size;
+
+    /* statistics */
+    unsigned long long frames, bytes, dropped, connects, errors, unstamped;
+    samples latency;
+    samples stages[STAGE_COUNT];
+} client;
+
+static const char *host = "127.0.0.1";
+static const char *port = "8080";
+static const char *query = NULL;
+static int input = -1;
+static struct addrinfo *server;
+static int epfd;
+static int counting;            /* the warm up is over */
+static int stages;              /* -L: break the latency down into stages */
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double wallclock(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void samples_add(samples *s, double ms)
+{
+    float *v;
+
+    if(s->count == s->size) {
+        s->size = s->size ? 2 * s->size : 1024;
+        if((v = realloc(s->v, s->size * sizeof(float))) == NULL) {
+            fprintf(stderr, "could not allocate memory\n");
+            exit(EXIT_FAILURE);
+        }
+        s->v = v;
+    }
+    s->v[s->count++] = ms;
+}
+
+#ifndef NO_LIBJPEG
+/* libjpeg must not exit on a broken picture */
+struct stamp_error {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+static void stamp_error_exit(j_common_ptr cinfo)
+{
+    longjmp(((struct stamp_error *)cinfo->err)->jump, 1);
+}
+
+/* only the top rows get decoded, warnings about the rest do not matter */
+static void stamp_emit_message(j_common_ptr cinfo, int level)
+{
+}
+
+/******************************************************************************
+Description.: decodes the top rows of a picture and reads its frame stamp
+Input Value.: * jpeg....: the picture
+              * size....: its size
+              * tv......: the time of the stamp gets stored here
+Return Value: 0 if the picture carries a valid stamp, -1 otherwise
+******************************************************************************/
+static int read_stamp(unsigned char *jpeg, long size, struct timeval *tv)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct stamp_error jerr;
+    unsigned char *volatile gray = NULL;
+    unsigned int seq;
+    int rows, result = -1;
+    JSAMPROW row;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = stamp_error_exit;
+    jerr.pub.emit_message = stamp_emit_message;
+    jpeg_create_decompress(&cinfo);
+    if(setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(gray);
+        return -1;
+    }
+
+    jpeg_mem_src(&cinfo, jpeg, size);
+    if(jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK) {
+        cinfo.out_color_space = JCS_GRAYSCALE;
+        jpeg_start_decompress(&cinfo);
+
+        rows = frame_stamp_rows(cinfo.output_width, cinfo.output_height);
+        if(rows > 0 && (gray = malloc(cinfo.output_width * rows)) != NULL) {
+            while(cinfo.output_scanline < (unsigned int)rows) {
+                row = gray + cinfo.output_scanline * cinfo.output_width;
+                jpeg_read_scanlines(&cinfo, &row, 1);
+            }
+            result = frame_stamp_read(gray, cinfo.output_width, rows, &seq, tv);
+        }
+    }
+
+    jpeg_destroy_decompress(&cinfo);
+    free(gray);
+    return result;
+}
+#endif
+
+/******************************************************************************
+Description.: closes the connection of a client, it connects again later
+Input Value.: * c.......: the client
+              * delay...: seconds until it connects again
+              * error...: count the close as error
+Return Value: -
+******************************************************************************/
+static void client_close(client *c, double delay, int error)
+{
+    if(c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    if(error && counting)
+        c->errors++;
+    c->state = STATE_IDLE;
+    c->retry = now() + delay;
+    c->last_seq_set = 0;
+}
+
+/******************************************************************************
+Description.: starts connecting a client to the server
+Input Value.: the client
+Return Value: -
+******************************************************************************/
+static void client_connect(client *c)
+{
+    struct epoll_event ev;
+
+    c->fd = socket(server->ai_family, server->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, server->ai_protocol);
+    if(c->fd < 0) {
+        client_close(c, 0.1, 1);
+        return;
+    }
+
+    if(connect(c->fd, server->ai_addr, server->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        client_close(c, 0.1, 1);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.ptr = c;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        client_close(c, 0.1, 1);
+        return;
+    }
+
+    c->state = STATE_CONNECTING;
+    c->header_len = 0;
+    if(counting)
+        c->connects++;
+}
+
+/******************************************************************************
+Description.: sends the request once the connection is established
+Input Value.: the client
+Return Value: -
+******************************************************************************/
+static void client_request(client *c)
+{
+    char request[512], action[64];
+    struct epoll_event ev;
+    int err = 0, len;
+    socklen_t errlen = sizeof(err);
+
+    if(getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err != 0) {
+        client_close(c, 0.1, 1);
+        return;
+    }
+
+    if(input >= 0)
+        snprintf(action, sizeof(action), "%s_%d", (c->type == CLIENT_STREAM) ? "stream" : "snapshot", input);
+    else
+        snprintf(action, sizeof(action), "%s", (c->type == CLIENT_STREAM) ? "stream" : "snapshot");
+
+    len = snprintf(request, sizeof(request), "GET /?action=%s%s%s%s HTTP/1.0\r\nHost: %s\r\n\r\n",
+                   action, stages ? "&stages=1" : "", query ? "&" : "", query ? query : "", host);
+    if(send(c->fd, request, len, MSG_NOSIGNAL) != len) {
+        client_close(c, 0.1, 1);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->state = STATE_HTTP_HEADER;
+}
+
+/******************************************************************************
+Description.: breaks the latency of a received picture down into the stages
+              between its frame stamp and now, stages the server did not
+              report are left out
+Input Value.: * c.......: the client, the picture is in its body
+              * received: wall clock time the picture was complete
+Return Value: -
+******************************************************************************/
+static void client_stages(client *c, double received)
+{
+#ifndef NO_LIBJPEG
+    /* the stamp and the receipt are -1 */
+    static const int from[STAGE_COUNT] = { -1, AT_CAPTURED, AT_ENCODED, AT_PUBLISHED, AT_SENT, -1 };
+    static const int to[STAGE_COUNT] = { AT_CAPTURED, AT_ENCODED, AT_PUBLISHED, AT_SENT, -1, -1 };
+    struct timeval tv;
+    double stamp, a, b;
+    int k;
+
+    if(c->body_len == 0 || read_stamp(c->body, c->body_len, &tv) < 0) {
+        c->unstamped++;
+        return;
+    }
+    stamp = tv.tv_sec + tv.tv_usec / 1e6;
+
+    for(k = 0; k < STAGE_COUNT; k++) {
+        a = (from[k] < 0) ? stamp : (c->at_set ? c->at[from[k]] : 0);
+        b = (to[k] < 0) ? received : (c->at_set ? c->at[to[k]] : 0);
+        if(a > 0 && b > 0)
+            samples_add(&c->stages[k], (b - a) * 1000);
+    }
+#else
+    c->unstamped++;
+#endif
+}
+
+/******************************************************************************
+Description.: counts a completely received picture
+Input Value.: the client
+Return Value: -
+******************************************************************************/
+static void client_frame(client *c)
+{
+    double ts, real, latency;
+
+    if(!counting)
+        return;
+
+    c->frames++;
+
+    if(c->seq_set) {
+        if(c->last_seq_set && (int)(c->seq - c->last_seq) > 1)
+            c->dropped += c->seq - c->last_seq - 1;
+        c->last_seq = c->seq;
+        c->last_seq_set = 1;
+    }
+
+    real = wallclock();
+    if(stages)
+        client_stages(c, real);
+
+    if(!c->timestamp_set)
+        return;
+
+    /* wall clock timestamps are close to now, V4L2 ones are CLOCK_MONOTONIC */
+    ts = c->timestamp.tv_sec + c->timestamp.tv_usec / 1e6;
+    if(real - ts < 86400 && ts - real < 86400)
+        latency = real - ts;
+    else
+        latency = now() - ts;
+
+    samples_add(&c->latency, latency * 1000);
+}
+
+/******************************************************************************
+Description.: parses the header of a response or a part
+Input Value.: the client, its header buffer holds the complete header
+Return Value: 0 if everything is OK, -1 if the response is unusable
+******************************************************************************/
+static int client_header(client *c)
+{
+    char *line, *next, *value;
+    long long length = -1;
+    int first = 1, status = 0;
+
+    c->timestamp_set = 0;
+    c->seq_set = 0;
+    c->at_set = 0;
+
+    for(line = c->header; line != NULL && *line != '\0'; line = next) {
+        if((next = strstr(line, "\r\n")) != NULL) {
+            *next = '\0';
+            next += 2;
+        }
+
+        if(*line == '\0')
+            continue;
+
+        /* every part starts with the boundary */
+        if(c->state == STATE_PART_HEADER && first) {
+            first = 0;
+            if(strcmp(line, c->boundary) != 0)
+                return -1;
+            continue;
+        }
+
+        if(c->state == STATE_HTTP_HEADER && first) {
+            first = 0;
+            if(sscanf(line, "HTTP/%*s %d", &status) != 1 || status != 200)
+                return -1;
+            continue;
+        }
+
+        if((value = strchr(line, ':')) == NULL)
+            continue;
+        *value++ = '\0';
+        while(*value == ' ')
+            value++;
+
+        if(strcasecmp(line, "Content-Length") == 0) {
+            length = atoll(value);
+        } else if(strcasecmp(line, "X-Timestamp") == 0) {
+            long sec = 0, usec = 0;
+            if(sscanf(value, "%ld.%ld", &sec, &usec) >= 1) {
+                c->timestamp.tv_sec = sec;
+                c->timestamp.tv_usec = usec;
+                c->timestamp_set = 1;
+            }
+        } else if(strcasecmp(line, "X-Sequence") == 0) {
+            c->seq = strtoul(value, NULL, 10);
+            c->seq_set = 1;
+        } else if(strcasecmp(line, "X-Stages") == 0) {
+            c->at_set = (sscanf(value, "captured=%lf encoded=%lf published=%lf sent=%lf",
+                                &c->at[AT_CAPTURED], &c->at[AT_ENCODED], &c->at[AT_PUBLISHED], &c->at[AT_SENT]) == AT_COUNT);
+        } else if(strcasecmp(line, "Content-Type") == 0 && (value = strstr(value, "boundary=")) != NULL) {
+            snprintf(c->boundary, sizeof(c->boundary), "--%s", value + strlen("boundary="));
+        }
+    }
+
+    if(c->state == STATE_HTTP_HEADER && c->type == CLIENT_STREAM) {
+        if(c->boundary[0] == '\0')
+            return -1;
+        c->state = STATE_PART_HEADER;
+    } else if(length >= 0) {
+        c->remaining = length;
+        c->state = STATE_BODY;
+
+        /* keep the picture to read its stamp */
+        c->body_len = 0;
+        if(stages && length > c->body_size) {
+            free(c->body);
+            if((c->body = malloc(length)) == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                exit(EXIT_FAILURE);
+            }
+            c->body_size = length;
+        }
+    } else if(c->type == CLIENT_STREAM) {
+        /* output_http sends the length of every part */
+        return -1;
+    } else {
+        /* a snapshot without length lasts until the connection closes */
+        c->remaining = -1;
+        c->state = STATE_BODY;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: consumes received bytes
+Input Value.: * c.......: the client
+              * data....: the bytes
+              * len.....: their number
+Return Value: 0 if everything is OK, 1 if a snapshot is complete, -1 to
+              close the connection
+******************************************************************************/
+static int client_data(client *c, char *data, int len)
+{
+    char *end;
+    int n, keep;
+
+    if(counting)
+        c->bytes += len;
+
+    while(len > 0) {
+        switch(c->state) {
+        case STATE_HTTP_HEADER:
+        case STATE_PART_HEADER:
+            /* collect bytes until the empty line ending the header */
+            n = MIN(len, HEADER_MAX - 1 - c->header_len);
+            if(n <= 0)
+                return -1;
+            memcpy(c->header + c->header_len, data, n);
+            c->header_len += n;
+            c->header[c->header_len] = '\0';
+
+            if((end = strstr(c->header, "\r\n\r\n")) == NULL) {
+                data += n;
+                len -= n;
+                break;
+            }
+
+            /* the bytes after the header belong to the body */
+            keep = c->header_len - (end + 4 - c->header);
+            data += n - keep;
+            len -= n - keep;
+            end[2] = '\0';
+            c->header_len = 0;
+            if(client_header(c) < 0)
+                return -1;
+            break;
+
+        case STATE_BODY:
+            if(c->remaining < 0) {
+                /* until the connection closes */
+                return 0;
+            }
+            n = (len < c->remaining) ? len : c->remaining;
+            if(stages) {
+                memcpy(c->body + c->body_len, data, n);
+                c->body_len += n;
+            }
+            c->remaining -= n;
+            data += n;
+            len -= n;
+            if(c->remaining == 0) {
+                client_frame(c);
+                if(c->type == CLIENT_SNAPSHOT)
+                    return 1;
+                c->state = STATE_PART_HEADER;
+            }
+            break;
+
+        default:
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads what arrived for a client
+Input Value.: the client
+Return Value: -
+******************************************************************************/
+static void client_read(client *c)
+{
+    char buf[65536];
+    ssize_t n;
+
+    int ret;
+
+    while((n = recv(c->fd, buf, sizeof(buf), 0)) > 0) {
+        if((ret = client_data(c, buf, n)) != 0) {
+            /* the next snapshot gets requested right away */
+            if(ret > 0)
+                client_close(c, 0, 0);
+            else
+                client_close(c, 0.1, 1);
+            return;
+        }
+    }
+
+    if(n == 0) {
+        /* a snapshot without length ends with the connection */
+        if(c->type == CLIENT_SNAPSHOT && c->state == STATE_BODY && c->remaining < 0) {
+            client_frame(c);
+            client_close(c, 0, 0);
+        } else {
+            client_close(c, 0.1, 1);
+        }
+    } else if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        client_close(c, 0.1, 1);
+    }
+}
+
+static int compare_float(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+
+    return (x > y) - (x < y);
+}
+
+/******************************************************************************
+Description.: appends the samples of a client to the ones of all clients
+Input Value.: * all.....: the samples of all clients
+              * s.......: the samples of a client, they get freed
+Return Value: -
+******************************************************************************/
+static void samples_merge(samples *all, samples *s)
+{
+    unsigned long i;
+
+    for(i = 0; i < s->count; i++)
+        samples_add(all, s->v[i]);
+    free(s->v);
+    memset(s, 0, sizeof(samples));
+}
+
+/******************************************************************************
+Description.: prints the latency percentiles of samples as JSON
+Input Value.: * f.......: where to print to
+              * s.......: the latencies in milliseconds, they get sorted
+Return Value: -
+******************************************************************************/
+static void print_latency(FILE *f, samples *s)
+{
+    static const double p[] = { 0.5, 0.99, 0.999 };
+    static const char *name[] = { "p50", "p99", "p999" };
+    unsigned long i, k, n = s->count;
+    float *l = s->v;
+
+    qsort(l, n, sizeof(float), compare_float);
+
+    fprintf(f, "{");
+    for(k = 0; k < sizeof(p) / sizeof(p[0]); k++) {
+        if(n == 0) {
+            fprintf(f, "\"%s\": null, ", name[k]);
+            continue;
+        }
+        i = (unsigned long)(p[k] * n + 0.999999);
+        fprintf(f, "\"%s\": %.3f, ", name[k], l[(i > 0 ? i : 1) - 1]);
+    }
+    if(n == 0)
+        fprintf(f, "\"max\": null}");
+    else
+        fprintf(f, "\"max\": %.3f}", l[n - 1]);
+}
+
+static void help(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-c streams] [-s snapshots] [-t seconds]\n"
+                    "       [-w seconds] [-r churn] [-i input] [-q query] [-o file] [-S] [-L]\n", progname);
+    fprintf(stderr, " -H host.....: server, default 127.0.0.1\n");
+    fprintf(stderr, " -p port.....: port of output_http, default 8080\n");
+    fprintf(stderr, " -c streams..: concurrent ?action=stream connections, default 10\n");
+    fprintf(stderr, " -s snapshots: concurrent clients fetching ?action=snapshot in a loop, default 0\n");
+    fprintf(stderr, " -t seconds..: duration of the measurement, default 10\n");
+    fprintf(stderr, " -w seconds..: warm up before measuring, default 1\n");
+    fprintf(stderr, " -r churn....: streams closed and opened again per second, default 0\n");
+    fprintf(stderr, " -i input....: number of the input to request, default the first\n");
+    fprintf(stderr, " -q query....: appended to the request, for example fps=10, frames the\n"
+                    "               server skips for that rate count as dropped\n");
+    fprintf(stderr, " -o file.....: write the JSON report there instead of stdout\n");
+    fprintf(stderr, " -S..........: only the totals, no per client entries\n");
+#ifndef NO_LIBJPEG
+    fprintf(stderr, " -L..........: decode the frame stamps of the pictures and break the\n"
+                    "               latency down into the stages of the server\n");
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    struct addrinfo hints, *res;
+    struct epoll_event events[EVENTS];
+    struct rlimit rl;
+    client *clients, *c;
+    double duration = 10, warmup = 1, churn = 0, start, end, t, next_churn, elapsed;
+    int streams = 10, snapshots = 0, summary = 0, count, i, n, err, timeout;
+    unsigned long long frames = 0, bytes = 0, dropped = 0, connects = 0, errors = 0, unstamped = 0;
+    samples latency, stage_samples[STAGE_COUNT];
+    const char *output = NULL;
+    FILE *f = stdout;
+
+    while((i = getopt(argc, argv, "H:p:c:s:t:w:r:i:q:o:SLh")) != -1) {
+        switch(i) {
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        case 'c':
+            streams = atoi(optarg);
+            break;
+        case 's':
+            snapshots = atoi(optarg);
+            break;
+        case 't':
+            duration = atof(optarg);
+            break;
+        case 'w':
+            warmup = atof(optarg);
+            break;
+        case 'r':
+            churn = atof(optarg);
+            break;
+        case 'i':
+            input = atoi(optarg);
+            break;
+        case 'q':
+            query = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'S':
+            summary = 1;
+            break;
+#ifndef NO_LIBJPEG
+        case 'L':
+            stages = 1;
+            break;
+#endif
+        default:
+            help(argv[0]);
+            return 1;
+        }
+    }
+
+    count = streams + snapshots;
+    if(streams < 0 || snapshots < 0 || count == 0 || duration <= 0 || warmup < 0 || churn < 0) {
+        help(argv[0]);
+        return 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if((err = getaddrinfo(host, port, &hints, &res)) != 0) {
+        fprintf(stderr, "%s:%s: %s\n", host, port, gai_strerror(err));
+        return 1;
+    }
+    server = res;
+
+    /* thousands of connections need as many descriptors */
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)count + 16)
+        fprintf(stderr, "warning: only %lu descriptors for %d connections\n", (unsigned long)rl.rlim_cur, count);
+
+    if((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    if((clients = calloc(count, sizeof(client))) == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        return 1;
+    }
+    for(i = 0; i < count; i++) {
+        clients[i].id = i;
+        clients[i].type = (i < streams) ? CLIENT_STREAM : CLIENT_SNAPSHOT;
+        clients[i].fd = -1;
+        clients[i].state = STATE_IDLE;
+    }
+
+    srand(1);
+    start = now();
+    end = start + warmup + duration;
+    next_churn = start + warmup + (churn > 0 ? 1 / churn : duration);
+
+    while((t = now()) < end) {
+        if(!counting && t >= start + warmup) {
+            counting = 1;
+            start = t;
+        }
+
+        /* connect the idle clients */
+        for(i = 0; i < count; i++) {
+            c = &clients[i];
+            if(c->state == STATE_IDLE && c->retry <= t)
+                client_connect(c);
+        }
+
+        /* close a random stream, it connects again right away */
+        if(churn > 0 && streams > 0 && t >= next_churn) {
+            c = &clients[rand() % streams];
+            if(c->fd >= 0)
+                client_close(c, 0, 0);
+            next_churn += 1 / churn;
+            continue;
+        }
+
+        timeout = (int)((MIN(end, churn > 0 ? next_churn : end) - t) * 1000) + 1;
+        n = epoll_wait(epfd, events, EVENTS, MIN(timeout, 100));
+        for(i = 0; i < n; i++) {
+            c = events[i].data.ptr;
+            if(c->fd < 0)
+                continue;
+            if(c->state == STATE_CONNECTING)
+                client_request(c);
+            else
+                client_read(c);
+        }
+    }
+    elapsed = now() - start;
+
+    for(i = 0; i < count; i++) {
+        c = &clients[i];
+        if(c->fd >= 0)
+            close(c->fd);
+        frames += c->frames;
+        bytes += c->bytes;
+        dropped += c->dropped;
+        connects += c->connects;
+        errors += c->errors;
+        unstamped += c->unstamped;
+    }
+
+    if(output != NULL && (f = fopen(output, "w")) == NULL) {
+        perror(output);
+        return 1;
+    }
+
+    fprintf(f, "{\n  \"config\": {\"host\": \"%s\", \"port\": \"%s\", \"streams\": %d, \"snapshots\": %d, "
+               "\"duration\": %.3f, \"warmup\": %.3f, \"churn\": %.3f, \"input\": %d, \"query\": \"%s\"},\n",
+            host, port, streams, snapshots, elapsed, warmup, churn, input, query ? query : "");
+
+    if(!summary) {
+        fprintf(f, "  \"clients\": [\n");
+        for(i = 0; i < count; i++) {
+            c = &clients[i];
+            fprintf(f, "    {\"id\": %d, \"type\": \"%s\", \"frames\": %llu, \"fps\": %.2f, \"bytes_per_s\": %.0f, "
+                       "\"dropped\": %llu, \"connects\": %llu, \"errors\": %llu, \"latency_ms\": ",
+                    c->id, (c->type == CLIENT_STREAM) ? "stream" : "snapshot", c->frames, c->frames / elapsed,
+                    c->bytes / elapsed, c->dropped, c->connects, c->errors);
+            print_latency(f, &c->latency);
+            fprintf(f, "}%s\n", (i < count - 1) ? "," : "");
+        }
+        fprintf(f, "  ],\n");
+    }
+
+    /* percentiles over the frames of all clients */
+    memset(&latency, 0, sizeof(samples));
+    memset(stage_samples, 0, sizeof(stage_samples));
+    for(i = 0; i < count; i++) {
+        samples_merge(&latency, &clients[i].latency);
+        for(n = 0; n < STAGE_COUNT; n++)
+            samples_merge(&stage_samples[n], &clients[i].stages[n]);
+        free(clients[i].body);
+    }
+
+    fprintf(f, "  \"totals\": {\"frames\": %llu, \"fps\": %.2f, \"fps_per_client\": %.2f, \"bytes_per_s\": %.0f, "
+               "\"dropped\": %llu, \"connects\": %llu, \"errors\": %llu, \"latency_ms\": ",
+            frames, frames / elapsed, frames / elapsed / count, bytes / elapsed, dropped, connects, errors);
+    print_latency(f, &latency);
+    if(stages) {
+        fprintf(f, ",\n             \"unstamped\": %llu, \"stages_ms\": {", unstamped);
+        for(n = 0; n < STAGE_COUNT; n++) {
+            fprintf(f, "%s\"%s\": ", n ? ", " : "", stage_names[n]);
+            print_latency(f, &stage_samples[n]);
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "}\n}\n");
+
+    if(f != stdout)
+        fclose(f);
+    free(latency.v);
+    for(n = 0; n < STAGE_COUNT; n++)
+        free(stage_samples[n].v);
+    free(clients);
+    freeaddrinfo(server);
+    close(epfd);
+
+    return 0;
+}
@@ -58,7 +58,11 @@ static void help(char *progname)
             "  -o | --output \"<output-plugin.so> [parameters]\"\n" \
             " [-h | --help ]........: display this help\n" \
             " [-v | --version ].....: display version information\n" \
-            " [-b | --background]...: fork to the background, daemon mode\n", progname);
+            " [-b | --background]...: fork to the background, daemon mode\n" \
+            " [--idle <seconds>]....: inputs stop compressing frames after this long\n" \
+            "                         without clients or other consumers, 0 never (default)\n" \
+            " [--standby <seconds>].: inputs stop capturing altogether after this long\n" \
+            "                         without consumers, 0 never (default)\n", progname);
     fprintf(stderr, "-----------------------------------------------------------------------\n");
     fprintf(stderr, "Example #1:\n" \
             " To open an UVC webcam \"/dev/video1\" and stream it via HTTP:\n" \
@@ -102,7 +106,11 @@ static void signal_handler(int sig)
     /* clean up threads */
     LOG("force cancellation of threads and cleanup resources\n");
     for(i = 0; i < global.incnt; i++) {
-        global.in[i].stop(i);
+        if(global.in[i].stop != NULL)
+            global.in[i].stop(i);
+    }
+    for(i = 0; i < global.incnt; i++) {
+        input_frame_ring_free(&global.in[i]);
         /*for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
             if (global.in[i].param.argv[j] != NULL) {
                 free(global.in[i].param.argv[j]);
@@ -123,7 +131,8 @@ static void signal_handler(int sig)
 
     /* close handles of input plugins */
     for(i = 0; i < global.incnt; i++) {
-        dlclose(global.in[i].handle);
+        if(global.in[i].handle != NULL)
+            dlclose(global.in[i].handle);
     }
 
     for(i = 0; i < global.outcnt; i++) {
@@ -194,7 +203,7 @@ int main(int argc, char *argv[])
     //char *input  = "input_uvc.so --resolution 640x480 --fps 5 --device /dev/video0";
     char *input[MAX_INPUT_PLUGINS];
     char *output[MAX_OUTPUT_PLUGINS];
-    int daemon = 0, i, j;
+    int daemon = 0, i, j, n, incnt = 0;
     size_t tmp = 0;
 
     output[0] = "output_http.so --port 8080";
@@ -210,6 +219,8 @@ int main(int argc, char *argv[])
             {"output", required_argument, NULL, 'o'},
             {"version", no_argument, NULL, 'v'},
             {"background", no_argument, NULL, 'b'},
+            {"idle", required_argument, NULL, 'I'},
+            {"standby", required_argument, NULL, 'S'},
             {NULL, 0, NULL, 0}
         };
 
@@ -220,7 +231,11 @@ int main(int argc, char *argv[])
 
         switch(c) {
         case 'i':
-            input[global.incnt++] = strdup(optarg);
+            if(incnt >= MAX_INPUT_PLUGINS) {
+                fprintf(stderr, "too many input plugins, at most %d are supported\n", MAX_INPUT_PLUGINS);
+                exit(EXIT_FAILURE);
+            }
+            input[incnt++] = strdup(optarg);
             break;
 
         case 'o':
@@ -244,6 +259,14 @@ int main(int argc, char *argv[])
             daemon = 1;
             break;
 
+        case 'I':
+            global.idle = atoi(optarg);
+            break;
+
+        case 'S':
+            global.standby = atoi(optarg);
+            break;
+
         case 'h': /* fall through */
         default:
             help(argv[0]);
@@ -287,26 +310,38 @@ int main(int argc, char *argv[])
         global.outcnt = 1;
     }
 
-    /* open input plugin */
-    for(i = 0; i < global.incnt; i++) {
+    /*
+     * open input plugin, a plugin may claim further slots for its sources
+     * while it initializes, the next plugin takes the next free slot
+     */
+    for(n = 0; n < incnt; n++) {
+        if(global.incnt >= MAX_INPUT_PLUGINS) {
+            LOG("no input slot left for %s\n", input[n]);
+            closelog();
+            exit(EXIT_FAILURE);
+        }
+        i = global.incnt++;
+
         /* this mutex and the conditional variable are used to synchronize access to the global picture buffer */
         if(pthread_mutex_init(&global.in[i].db, NULL) != 0) {
             LOG("could not initialize mutex variable\n");
             closelog();
             exit(EXIT_FAILURE);
         }
-        if(pthread_cond_init(&global.in[i].db_update, NULL) != 0) {
+        if(pthread_cond_init(&global.in[i].db_update, NULL) != 0 ||
+           pthread_cond_init(&global.in[i].demand_update, NULL) != 0) {
             LOG("could not initialize condition variable\n");
             closelog();
             exit(EXIT_FAILURE);
         }
 
-        tmp = (size_t)(strchr(input[i], ' ') - input[i]);
+        tmp = (size_t)(strchr(input[n], ' ') - input[n]);
         global.in[i].stop      = 0;
         global.in[i].context   = NULL;
-        global.in[i].buf       = NULL;
-        global.in[i].size      = 0;
-        global.in[i].plugin = (tmp > 0) ? strndup(input[i], tmp) : strdup(input[i]);
+        global.in[i].latest    = NULL;
+        global.in[i].ring_size = INPUT_FRAME_RING;
+        global.in[i].plugin = (tmp > 0) ? strndup(input[n], tmp) : strdup(input[n]);
+        input_metrics_init(&global.in[i], i);
         global.in[i].handle = dlopen(global.in[i].plugin, RTLD_LAZY);
         if(!global.in[i].handle) {
             LOG("ERROR: could not find input plugin\n");
@@ -334,7 +369,7 @@ int main(int argc, char *argv[])
         /* try to find optional command */
         global.in[i].cmd = dlsym(global.in[i].handle, "input_cmd");
 
-        global.in[i].param.parameters = strchr(input[i], ' ');
+        global.in[i].param.parameters = strchr(input[n], ' ');
 
         for (j = 0; j<MAX_PLUGIN_ARGUMENTS; j++) {
             global.in[i].param.argv[j] = NULL;
@@ -402,6 +437,9 @@ int main(int argc, char *argv[])
     /* start to read the input, push pictures into global buffer */
     DBG("starting %d input plugin\n", global.incnt);
     for(i = 0; i < global.incnt; i++) {
+        /* slots claimed by a plugin get started by their owner */
+        if(global.in[i].run == NULL)
+            continue;
         syslog(LOG_INFO, "starting input plugin %s", global.in[i].plugin);
         if(global.in[i].run(i)) {
             LOG("can not run input plugin %d: %s\n", i, global.in[i].plugin);
@@ -24,8 +24,8 @@
 #define MJPG_STREAMER_H
 #define SOURCE_VERSION "2.0"
 
-/* FIXME take a look to the output_http clients thread marked with fixme if you want to set more then 10 plugins */
-#define MAX_INPUT_PLUGINS 10
+/* input plugins may serve several cameras, each of them takes an input slot */
+#define MAX_INPUT_PLUGINS 64
 #define MAX_OUTPUT_PLUGINS 10
 #define MAX_PLUGIN_ARGUMENTS 32
 
@@ -79,6 +79,10 @@ struct _control {
 struct _globals {
     int stop;
 
+    /* seconds without consumers until the inputs idle or stand by, 0 never */
+    int idle;
+    int standby;
+
     /* input plugin */
     input in[MAX_INPUT_PLUGINS];
     int incnt;
@@ -91,4 +95,10 @@ struct _globals {
     //int (*control)(int command, char *details);
 };
 
+/* extra input slots for plugins serving several sources, implemented in the core */
+int input_slot_add(globals *global, int owner);
+
+/* registers the metrics of an input, implemented in the core */
+void input_metrics_init(input *in, int id);
+
 #endif
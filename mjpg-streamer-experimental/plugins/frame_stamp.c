@@ -0,0 +1,190 @@
+/*******************************************************************************
+# Machine readable frame stamps for latency measurements with MJPG-streamer    #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "frame_stamp.h"
+
+#define STAMP_BYTES (FRAME_STAMP_BITS / 8)
+
+/* first bytes of every stamp */
+#define STAMP_MAGIC0 'M'
+#define STAMP_MAGIC1 'S'
+
+static uint16_t fletcher16(const unsigned char *data, int len)
+{
+    unsigned int a = 0, b = 0;
+    int i;
+
+    for(i = 0; i < len; i++) {
+        a = (a + data[i]) % 255;
+        b = (b + a) % 255;
+    }
+    return (b << 8) | a;
+}
+
+/******************************************************************************
+Description.: tells how many rows of pixels a stamp covers
+Input Value.: * width, height: size of the picture
+Return Value: the rows, -1 if the picture is too small for a stamp
+******************************************************************************/
+int frame_stamp_rows(int width, int height)
+{
+    int cells = width / FRAME_STAMP_CELL, rows;
+
+    if(cells < 8)
+        return -1;
+
+    rows = (FRAME_STAMP_BITS + cells - 1) / cells * FRAME_STAMP_CELL;
+    return (rows <= height) ? rows : -1;
+}
+
+/******************************************************************************
+Description.: draws a stamp into a raw picture
+Input Value.: * raw....: the picture
+              * width, height: its size
+              * format.: V4L2_PIX_FMT_RGB24, _YUYV, _UYVY, _RGB565 or _GREY
+              * seq....: sequence number of the picture
+              * tv.....: its wall clock time
+Return Value: 0 if the stamp was drawn, -1 if the picture is too small or
+              its format is not supported
+******************************************************************************/
+int frame_stamp_draw(unsigned char *raw, int width, int height, int format, unsigned int seq, struct timeval *tv)
+{
+    unsigned char stamp[STAMP_BYTES], *p;
+    int cells = width / FRAME_STAMP_CELL, bpp, bit, x, y, x0, y0, on;
+    uint32_t sec = tv->tv_sec, usec = tv->tv_usec;
+    uint16_t sum;
+
+    switch(format) {
+    case V4L2_PIX_FMT_RGB24:
+        bpp = 3;
+        break;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    case V4L2_PIX_FMT_RGB565:
+        bpp = 2;
+        break;
+    case V4L2_PIX_FMT_GREY:
+        bpp = 1;
+        break;
+    default:
+        return -1;
+    }
+
+    if(frame_stamp_rows(width, height) < 0)
+        return -1;
+
+    stamp[0] = STAMP_MAGIC0;
+    stamp[1] = STAMP_MAGIC1;
+    stamp[2] = seq >> 24;
+    stamp[3] = seq >> 16;
+    stamp[4] = seq >> 8;
+    stamp[5] = seq;
+    stamp[6] = sec >> 24;
+    stamp[7] = sec >> 16;
+    stamp[8] = sec >> 8;
+    stamp[9] = sec;
+    stamp[10] = usec >> 24;
+    stamp[11] = usec >> 16;
+    stamp[12] = usec >> 8;
+    stamp[13] = usec;
+    sum = fletcher16(stamp, STAMP_BYTES - 2);
+    stamp[14] = sum >> 8;
+    stamp[15] = sum;
+
+    for(bit = 0; bit < FRAME_STAMP_BITS; bit++) {
+        on = (stamp[bit / 8] >> (7 - bit % 8)) & 1;
+        x0 = bit % cells * FRAME_STAMP_CELL;
+        y0 = bit / cells * FRAME_STAMP_CELL;
+
+        for(y = y0; y < y0 + FRAME_STAMP_CELL; y++) {
+            p = raw + (y * width + x0) * bpp;
+            for(x = 0; x < FRAME_STAMP_CELL; x += 2, p += 2 * bpp) {
+                switch(format) {
+                case V4L2_PIX_FMT_RGB24:
+                    memset(p, on ? 255 : 0, 6);
+                    break;
+                case V4L2_PIX_FMT_YUYV:
+                    p[0] = p[2] = on ? 235 : 16;
+                    p[1] = p[3] = 128;
+                    break;
+                case V4L2_PIX_FMT_UYVY:
+                    p[1] = p[3] = on ? 235 : 16;
+                    p[0] = p[2] = 128;
+                    break;
+                default:
+                    memset(p, on ? 255 : 0, 2 * bpp);
+                    break;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: reads the stamp of a decompressed picture, the center of every
+              cell decides whether its bit is set
+Input Value.: * gray...: luminance of the picture, at least frame_stamp_rows()
+                         rows of width bytes each
+              * width, height: size of the picture
+              * seq....: the sequence number gets stored here
+              * tv.....: the wall clock time gets stored here
+Return Value: 0 if a valid stamp was found, -1 otherwise
+******************************************************************************/
+int frame_stamp_read(const unsigned char *gray, int width, int height, unsigned int *seq, struct timeval *tv)
+{
+    unsigned char stamp[STAMP_BYTES];
+    const unsigned char *p;
+    int cells = width / FRAME_STAMP_CELL, bit, x, y, x0, y0, sum;
+
+    if(frame_stamp_rows(width, height) < 0)
+        return -1;
+
+    memset(stamp, 0, sizeof(stamp));
+    for(bit = 0; bit < FRAME_STAMP_BITS; bit++) {
+        x0 = bit % cells * FRAME_STAMP_CELL + FRAME_STAMP_CELL / 4;
+        y0 = bit / cells * FRAME_STAMP_CELL + FRAME_STAMP_CELL / 4;
+
+        sum = 0;
+        for(y = y0; y < y0 + FRAME_STAMP_CELL / 2; y++) {
+            p = gray + y * width + x0;
+            for(x = 0; x < FRAME_STAMP_CELL / 2; x++)
+                sum += p[x];
+        }
+
+        if(sum > 128 * FRAME_STAMP_CELL * FRAME_STAMP_CELL / 4)
+            stamp[bit / 8] |= 0x80 >> (bit % 8);
+    }
+
+    if(stamp[0] != STAMP_MAGIC0 || stamp[1] != STAMP_MAGIC1 ||
+       fletcher16(stamp, STAMP_BYTES - 2) != ((stamp[14] << 8) | stamp[15]))
+        return -1;
+
+    *seq = ((uint32_t)stamp[2] << 24) | (stamp[3] << 16) | (stamp[4] << 8) | stamp[5];
+    tv->tv_sec = ((uint32_t)stamp[6] << 24) | (stamp[7] << 16) | (stamp[8] << 8) | stamp[9];
+    tv->tv_usec = ((uint32_t)stamp[10] << 24) | (stamp[11] << 16) | (stamp[12] << 8) | stamp[13];
+
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*******************************************************************************
+# Machine readable frame stamps for latency measurements with MJPG-streamer    #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef FRAME_STAMP_H
+#define FRAME_STAMP_H
+
+#include <sys/time.h>
+
+/*
+ * A frame stamp is drawn into the pixels of a raw picture before it gets
+ * compressed: the sequence number and the wall clock time of the picture as
+ * 128 black and white cells of 8x8 pixels, row by row from the top left
+ * corner. The cells match the blocks of JPEG, so the stamp survives any
+ * quality, and a viewer can tell how long the picture took from glass to
+ * glass.
+ */
+#define FRAME_STAMP_CELL 8
+#define FRAME_STAMP_BITS 128
+
+int frame_stamp_rows(int width, int height);
+int frame_stamp_draw(unsigned char *raw, int width, int height, int format, unsigned int seq, struct timeval *tv);
+int frame_stamp_read(const unsigned char *gray, int width, int height, unsigned int *seq, struct timeval *tv);
+
+#endif
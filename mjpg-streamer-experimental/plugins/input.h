@@ -22,6 +22,7 @@
 
 #include <syslog.h>
 #include "../mjpg_streamer.h"
+#include "metrics.h"
 #define INPUT_PLUGIN_PREFIX " i: "
 #define IPRINT(...) { char _bf[1024] = {0}; snprintf(_bf, sizeof(_bf)-1, __VA_ARGS__); fprintf(stderr, "%s", INPUT_PLUGIN_PREFIX); fprintf(stderr, "%s", _bf); syslog(LOG_INFO, "%s", _bf); }
 
@@ -49,6 +50,87 @@ struct _input_format {
     char currentResolution;
 };
 
+/*
+ * number of frames kept per input plugin. A frame that is still held by a
+ * slow reader is dropped from the ring and freed by its last reader, so the
+ * producer never has to wait for consumers.
+ */
+#define INPUT_FRAME_RING 4
+
+/* plugins holding several frames at once can enlarge the ring up to this */
+#define INPUT_FRAME_RING_MAX 64
+
+/*
+ * a single JPG frame, frames are reference counted and must not be modified
+ * after they were handed over to input_frame_publish()
+ */
+typedef struct _input_frame input_frame;
+struct _input_frame {
+    unsigned char *buf;
+    int size;      // bytes used
+    int capacity;  // bytes allocated
+
+    /* v4l2_buffer timestamp */
+    struct timeval timestamp;
+
+    /*
+     * wall clock times the frame passed the stages of the server, zero if
+     * the input plugin does not know them
+     */
+    struct timeval captured;    // dequeued from the device or generated
+    struct timeval encoded;     // compressed, JPEG sources leave it at zero
+    struct timeval published;   // set by input_frame_publish()
+
+    /* sequence number of the frame within its input, set by input_frame_publish() */
+    unsigned int seq;
+
+    int refcount;
+
+    /*
+     * frames which are not part of the ring, like buffers owned by a driver,
+     * set this to get them back instead of free() once the last reader let go
+     */
+    void (*release)(input_frame *frame);
+};
+
+/* capture statistics of an input plugin */
+typedef struct {
+    unsigned int rejected;  // frames dropped because they were broken
+    unsigned int drained;   // stale frames skipped to serve a newer one
+    int queued;             // frames that were ready at the last grab
+    int age;                // microseconds from capture to dequeue of the last frame
+} input_stats;
+
+/*
+ * metrics of an input, labelled with its id and plugin. The core registers
+ * them for every input and counts the published frames and the waits for
+ * db, the input plugin counts what it knows of the rest.
+ */
+typedef struct {
+    metric *captured;       // frames the input got from its source
+    metric *dropped;        // captured frames that were not published
+    metric *encoded;        // frames the input compressed
+    metric *encode_time;    // seconds per compressed frame
+    metric *published;      // frames handed to the output plugins
+    metric *lock_wait;      // seconds spent waiting for db, see input_lock()
+} input_metrics;
+
+/* highest frame rate a consumer can ask for, faster ones get every frame */
+#define INPUT_RATE_MAX 120
+
+/* paces frames to a rate, see frame_pace_due() */
+typedef struct {
+    int fps;                    // rate the pace was computed for
+    unsigned long long next;    // microseconds, timestamp the next frame is due
+} frame_pace;
+
+/* what the consumers of an input need, see input_demand() */
+typedef enum {
+    INPUT_ACTIVE,   // frames are wanted
+    INPUT_IDLE,     // nobody watched for the idle time, frames need not be compressed or published
+    INPUT_STANDBY   // nobody watched for the standby time, the device may be turned off
+} demand_state;
+
 /* structure to store variables/functions for input plugin */
 typedef struct _input input;
 struct _input {
@@ -69,13 +151,38 @@ struct _input {
     pthread_mutex_t db;
     pthread_cond_t  db_update;
 
-    /* global JPG frame, this is more or less the "database" */
-    unsigned char *buf;
-    int size;
+    /* ring of JPG frames, this is more or less the "database" */
+    input_frame *ring[INPUT_FRAME_RING_MAX];
+    int ring_size;       // slots in use, INPUT_FRAME_RING unless the plugin asked for more
+    input_frame *latest; // last published frame, protected by db
 
-    /* v4l2_buffer timestamp */
+    /* v4l2_buffer timestamp of the latest frame */
     struct timeval timestamp;
 
+    /* sequence number of the latest frame, counts up with every published one */
+    unsigned int seq;
+
+    /* capture statistics, only written by the input plugin */
+    input_stats stats;
+    input_metrics metrics;
+
+    /* consumers of the frames, protected by db */
+    int consumers;
+    struct timespec idle_since;     // CLOCK_MONOTONIC time the last consumer left
+    demand_state demand;            // result of the last input_demand()
+    pthread_cond_t demand_update;   // signals the first consumer attaching
+
+    /* optional, called when the first consumer attaches */
+    void (*resume)(input *in);
+
+    /*
+     * frame rates the consumers asked for, rates[0] counts those wanting
+     * every frame. rate is the highest one, 0 for every frame.
+     */
+    int rates[INPUT_RATE_MAX + 1];
+    int rate;
+    frame_pace pace;            // decimation of the input, only used by input_frame_due()
+
     input_format *in_formats;
     int formatCount;
     int currentFormat; // holds the current format number
@@ -87,3 +194,27 @@ struct _input {
     int (*run)(int);
     int (*cmd)(int plugin, unsigned int control_id, unsigned int group, int value, char *value_str);
 };
+
+/*
+ * locks db, a wait for another thread holding it gets measured. Plugins
+ * use it on their hot paths instead of locking db directly.
+ */
+void input_lock(input *in);
+
+/* frame ring functions for input plugins, implemented in the core */
+input_frame *input_frame_get(input *in, int size);
+void input_frame_publish(input *in, input_frame *frame);
+void input_frame_release(input_frame *frame);
+void input_frame_ring_free(input *in);
+void input_frame_ring_size(input *in, int size);
+
+/* demand of the consumers, inputs check it before they capture a frame */
+demand_state input_demand(input *in);
+void input_demand_wait(input *in);
+
+/*
+ * frame rate decimation, inputs drop frames the consumers do not need
+ * before they compress them
+ */
+int frame_pace_due(frame_pace *pace, int fps, struct timeval *timestamp);
+int input_frame_due(input *in, struct timeval *timestamp);
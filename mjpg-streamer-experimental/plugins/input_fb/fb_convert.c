@@ -0,0 +1,134 @@
+/*******************************************************************************
+# Framebuffer streaming input-plugin for MJPG-streamer                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdint.h>
+
+#include "fb_convert.h"
+
+static uint64_t fill_bits(uint8_t n)
+{
+	int i;
+	uint64_t u;
+
+	for (i=0, u=0; i<n; i++) {
+		u<<=1;
+		u|=(uint64_t)1;
+	}
+	return u;
+}
+
+/******************************************************************************
+Description.: calculates the masks and shifts of the channels, every channel
+              is reduced to its 8 most significant bits
+Input Value.: * bp.....: masks and shifts to fill in
+              * sc.....: screen info of the framebuffer
+Return Value: -
+******************************************************************************/
+void fb_bitop_init(struct fb_bitop *bp, struct fb_var_screeninfo *sc)
+{
+    for(bp->red.depth=sc->red.length; bp->red.depth>8; bp->red.depth--)
+        ;
+    for(bp->green.depth=sc->green.length; bp->green.depth>8; bp->green.depth--)
+        ;
+    for(bp->blue.depth=sc->blue.length; bp->blue.depth>8; bp->blue.depth--)
+        ;
+    if (sc->transp.length!=0)
+        for(bp->alpha.depth=sc->transp.length; bp->alpha.depth>8; bp->alpha.depth--)
+            ;
+
+    bp->red.mask=fill_bits(sc->red.length)<<sc->red.offset;
+    bp->red.shift=sc->red.offset+(sc->red.length-bp->red.depth)-(8-bp->red.depth);
+    bp->green.mask=fill_bits(sc->green.length)<<sc->green.offset;
+    bp->green.shift=sc->green.offset+(sc->green.length-bp->green.depth)-(8-bp->green.depth);
+    bp->blue.mask=fill_bits(sc->blue.length)<<sc->blue.offset;
+    bp->blue.shift=sc->blue.offset+(sc->blue.length-bp->blue.depth)-(8-bp->blue.depth);
+    if (sc->transp.length!=0) {
+        bp->alpha.mask=fill_bits(sc->transp.length)<<sc->transp.offset;
+        bp->alpha.shift=sc->transp.offset+(sc->transp.length-bp->alpha.depth)-(8-bp->alpha.depth);
+    }
+}
+
+/******************************************************************************
+Description.: converts a 16 or 32 bit framebuffer to RGB24 and scales it to
+              the size of the picture by picking the nearest pixel
+Input Value.: * bp...............: masks and shifts of the framebuffer
+              * fb...............: content of the framebuffer
+              * bytes_per_pixel..: 2 or 4, other depths are left alone
+              * xres, yres.......: size of the framebuffer
+              * rgb..............: picture to fill in
+              * width, height....: size of the picture
+Return Value: -
+******************************************************************************/
+void fb_convert(struct fb_bitop *bp, unsigned char *fb, int bytes_per_pixel, int xres, int yres,
+                unsigned char *rgb, int width, int height)
+{
+    uint16_t *fb16, *base16;
+    uint32_t *fb32, *base32;
+    double stridex, stridey;
+    int x, y, bwidth, basey, index;
+    unsigned char *array = rgb;
+
+    bwidth = xres;
+    stridex = (double)xres/width;
+    stridey = (double)yres/height;
+    if (bytes_per_pixel == 2) {
+        fb16 = (uint16_t *)fb;
+        for (y = 0; y < height; y++) {
+            basey = bwidth*(int)(y*stridey);
+            for (x = 0; x < width; x++) {
+                base16 = fb16 + basey + (int)(x*stridex);
+                index = y * width + x;
+                if (bp->red.shift >= 0)
+                    array[index*3]=(*base16&bp->red.mask)>>bp->red.shift;
+                else
+                    array[index*3]=(*base16&bp->red.mask)<<-bp->red.shift;
+                if (bp->green.shift >= 0)
+                    array[index*3+1]=(*base16&bp->green.mask)>>bp->green.shift;
+                else
+                    array[index*3+1]=(*base16&bp->green.mask)<<-bp->green.shift;
+                if (bp->blue.shift >= 0)
+                    array[index*3+2]=(*base16&bp->blue.mask)>>bp->blue.shift;
+                else
+                    array[index*3+2]=(*base16&bp->blue.mask)<<-bp->blue.shift;
+            }
+        }
+    }
+    else if (bytes_per_pixel == 4) {
+        fb32 = (uint32_t *)fb;
+        for (y = 0; y < height; y++) {
+            basey = bwidth*(int)(y*stridey);
+            for (x = 0; x < width; x++) {
+                base32 = fb32 + basey + (int)(x*stridex);
+                index = y * width + x;
+                if (bp->red.shift >= 0)
+                    array[index*3]=(*base32&bp->red.mask)>>bp->red.shift;
+                else
+                    array[index*3]=(*base32&bp->red.mask)<<-bp->red.shift;
+                if (bp->green.shift >= 0)
+                    array[index*3+1]=(*base32&bp->green.mask)>>bp->green.shift;
+                else
+                    array[index*3+1]=(*base32&bp->green.mask)<<-bp->green.shift;
+                if (bp->blue.shift >= 0)
+                    array[index*3+2]=(*base32&bp->blue.mask)>>bp->blue.shift;
+                else
+                    array[index*3+2]=(*base32&bp->blue.mask)<<-bp->blue.shift;
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+/*******************************************************************************
+# Framebuffer streaming input-plugin for MJPG-streamer                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef FB_CONVERT_H
+#define FB_CONVERT_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+/*
+ * Masks and shifts that turn the red, green and blue channel of a
+ * framebuffer pixel into 8 bit values, they depend on its screen info only.
+ */
+struct fb_bitop_element {
+	uint64_t mask;
+	int8_t shift;
+	uint8_t depth;
+};
+
+struct fb_bitop {
+	struct fb_bitop_element red, green, blue, alpha;
+};
+
+void fb_bitop_init(struct fb_bitop *bp, struct fb_var_screeninfo *sc);
+void fb_convert(struct fb_bitop *bp, unsigned char *fb, int bytes_per_pixel, int xres, int yres,
+                unsigned char *rgb, int width, int height);
+
+#endif
@@ -37,6 +37,7 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <syslog.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <linux/fb.h>
 #include <sys/mman.h>
@@ -53,8 +54,8 @@
 
 #include "../../utils.h"
 #include "input_fb.h"
+#include "fb_convert.h"
 #include "huffman.h"
-#include "jpeg_utils.h"
 
 #define INPUT_PLUGIN_NAME "Framebuffer grabber"
 
@@ -97,56 +98,12 @@ void fb_cleanup(void *);
 void help(void);
 int input_cmd(int plugin, unsigned int control, unsigned int group, int value);
 
-struct fb_bitop_element {
-	uint64_t mask;
-	int8_t shift;
-	uint8_t depth;
-};
-
-struct fb_bitop {
-	struct fb_bitop_element red, green, blue, alpha;
-};
-
 static struct fb_bitop bp;
 
-uint64_t fill_bits(uint8_t n)
-{
-	int i;
-	uint64_t u;
-
-	for (i=0, u=0; i<n; i++) {
-		u<<=1;
-		u|=(uint64_t)1;
-	}
-	return u;
-}
-
 int init_jpeg(struct vdIn *vd)
 {
-    struct fb_var_screeninfo *sc = &vd->screen_info;
-    
-    for(bp.red.depth=sc->red.length; bp.red.depth>8; bp.red.depth--)
-        ;
-    for(bp.green.depth=sc->green.length; bp.green.depth>8; bp.green.depth--)
-        ;
-    for(bp.blue.depth=sc->blue.length; bp.blue.depth>8; bp.blue.depth--)
-        ;
-    if (sc->transp.length!=0)
-        for(bp.alpha.depth=sc->transp.length; bp.alpha.depth>8; bp.alpha.depth--)
-            ;
-
-    bp.red.mask=fill_bits(sc->red.length)<<sc->red.offset;
-    bp.red.shift=sc->red.offset+(sc->red.length-bp.red.depth)-(8-bp.red.depth);
-    bp.green.mask=fill_bits(sc->green.length)<<sc->green.offset;
-    bp.green.shift=sc->green.offset+(sc->green.length-bp.green.depth)-(8-bp.green.depth);
-    bp.blue.mask=fill_bits(sc->blue.length)<<sc->blue.offset;
-    bp.blue.shift=sc->blue.offset+(sc->blue.length-bp.blue.depth)-(8-bp.blue.depth);
-    if (sc->transp.length!=0) {
-        bp.alpha.mask=fill_bits(sc->transp.length)<<sc->transp.offset;
-        bp.alpha.shift=sc->transp.offset+(sc->transp.length-bp.alpha.depth)-(8-bp.alpha.depth);
-    }
-    //printf("redmask=%x, redshift=%d, greenmask=%x, greenshift=%d, bluemask=%x, blueshift=%d\n", bp.red.mask, bp.red.shift, bp.green.mask, bp.green.shift, bp.blue.mask, bp.blue.shift);
-
+    fb_bitop_init(&bp, &vd->screen_info);
+    return 0;
 }
 
 /*** plugin interface functions ***/
@@ -454,12 +411,6 @@ Return Value: always 0
 ******************************************************************************/
 int input_run(int id)
 {
-    fbs[id].pglobal->in[id].buf = malloc(fbs[id].videoIn->framesizeIn);
-    if(fbs[id].pglobal->in[id].buf == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        exit(EXIT_FAILURE);
-    }
-
     DBG("launching fb thread #%02d\n", id);
     /* create thread and pass context to thread function */
     pthread_create(&(fbs[id].threadID), NULL, fb_thread, &(fbs[id]));
@@ -545,64 +496,12 @@ void grab_frame(struct vdIn *vd)
 #endif
 #endif
     {
-        int width = vd->width;
-        int height = vd->height;
-        uint16_t *fb16, *base16;
-        uint32_t *fb32, *base32;
-        double stridex, stridey;
-        int x, y, bwidth, basey, index;
-        unsigned char *array = vd->framebuffer;
         int count;
 
         lseek(vd->fbfd, 0, SEEK_SET);
         count = read(vd->fbfd, vd->buffer, vd->fbsize);
-        bwidth = vd->screen_info.xres;
-        stridex = (double)vd->screen_info.xres/width;
-        stridey = (double)vd->screen_info.yres/height;
-        if (vd->bytes_per_pixel == 2) {
-            fb16 = (uint16_t *)vd->buffer;
-            for (y = 0; y < height; y++) {
-                basey = bwidth*(int)(y*stridey);
-                for (x = 0; x < width; x++) {
-                    base16 = fb16 + basey + (int)(x*stridex);
-                    index = y * width + x;
-                    if (bp.red.shift >= 0)
-                        array[index*3]=(*base16&bp.red.mask)>>bp.red.shift;
-                    else
-                        array[index*3]=(*base16&bp.red.mask)<<-bp.red.shift;
-       	            if (bp.green.shift >= 0)
-                        array[index*3+1]=(*base16&bp.green.mask)>>bp.green.shift;
-                    else
-                        array[index*3+1]=(*base16&bp.green.mask)<<-bp.green.shift;
-                    if (bp.blue.shift >= 0)
-                        array[index*3+2]=(*base16&bp.blue.mask)>>bp.blue.shift;
-                    else
-                        array[index*3+2]=(*base16&bp.blue.mask)<<-bp.blue.shift;
-                }
-            }
-        }
-        else if (vd->bytes_per_pixel == 4) {
-            fb32 = (uint32_t *)vd->buffer;
-            for (y = 0; y < height; y++) {
-                basey = bwidth*(int)(y*stridey);
-                for (x = 0; x < width; x++) {
-                    base32 = fb32 + basey + (int)(x*stridex);
-                    index = y * width + x;
-                    if (bp.red.shift >= 0)
-                        array[index*3]=(*base32&bp.red.mask)>>bp.red.shift;
-                    else
-                        array[index*3]=(*base32&bp.red.mask)<<-bp.red.shift;
-    	            if (bp.green.shift >= 0)
-                        array[index*3+1]=(*base32&bp.green.mask)>>bp.green.shift;
-                    else
-                        array[index*3+1]=(*base32&bp.green.mask)<<-bp.green.shift;
-                    if (bp.blue.shift >= 0)
-                        array[index*3+2]=(*base32&bp.blue.mask)>>bp.blue.shift;
-                    else
-                        array[index*3+2]=(*base32&bp.blue.mask)<<-bp.blue.shift;
-                }
-            }
-        }
+        fb_convert(&bp, vd->buffer, vd->bytes_per_pixel, vd->screen_info.xres, vd->screen_info.yres,
+                   vd->framebuffer, vd->width, vd->height);
     }
 }
 
@@ -614,24 +513,45 @@ Return Value: unused, always NULL
 void *fb_thread(void *arg)
 {
     struct vdIn *vd;
+    input_frame *frame = NULL;
     context *pcontext = arg;
+    int format = V4L2_PIX_FMT_RGB24, rate;
     pglobal = pcontext->pglobal;
 
     /* set cleanup handler to cleanup allocated ressources */
     pthread_cleanup_push(fb_cleanup, pcontext);
 
     vd = pcontext->videoIn;
+#ifdef RASPI
+    if(vd->formatIn == VC_IMAGE_YUV420)
+        format = V4L2_PIX_FMT_YUV420;
+#endif
+
+    /* the encoder keeps its state from one frame to the next */
+    pcontext->jpeg = jpeg_encoder_new(1);
+    if(pcontext->jpeg == NULL) {
+        fprintf(stderr, "could not allocate memory\n");
+        pthread_exit(NULL);
+    }
+
     while(!pglobal->stop) {
-        while(vd->streamingState == STREAMING_PAUSED) {
-            usleep(1); // maybe not the best way so FIXME
+        /* grabbing does not block, so sleep right away while nobody watches */
+        if(input_demand(&pglobal->in[pcontext->id]) != INPUT_ACTIVE) {
+            DBG("nobody wants frames of input %d, waiting\n", pcontext->id);
+            input_demand_wait(&pglobal->in[pcontext->id]);
+            continue;
         }
 
         /* grab a frame */
         grab_frame(vd);
         DBG("received frame of size: %d from plugin: %d\n", pcontext->videoIn->buf.bytesused, pcontext->id);
 
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&pglobal->in[pcontext->id].db);
+        /* get a free frame of the ring, readers keep using the older ones */
+        frame = input_frame_get(&pglobal->in[pcontext->id], vd->framesizeIn);
+        if(frame == NULL) {
+            fprintf(stderr, "could not allocate memory\n");
+            break;
+        }
 
         /*
          * If capturing in YUV mode convert to JPEG now.
@@ -639,17 +559,10 @@ void *fb_thread(void *arg)
          * RGB format. Getting JPEGs straight from the fb, is one of the
          * major advantages of Linux compatible devices.
          */
-#ifdef RASPI
-        if(vd->formatIn == VC_IMAGE_YUV420) {
-            DBG("compressing yuv420 frame from input: %d\n", (int)pcontext->id);
-            pglobal->in[pcontext->id].size = compress_yuv420_to_jpeg(vd, pglobal->in[pcontext->id].buf, vd->framesizeIn, gquality);
-        }
-        else
-#endif
-        {
-            DBG("compressing rgb frame from input: %d\n", (int)pcontext->id);
-            pglobal->in[pcontext->id].size = compress_rgb888_to_jpeg(vd, pglobal->in[pcontext->id].buf, vd->framesizeIn, gquality);
-        }
+        DBG("compressing frame from input: %d\n", (int)pcontext->id);
+        frame->size = jpeg_encoder_compress(pcontext->jpeg, vd->framebuffer, vd->width, vd->height, format,
+                                            JPEG_CHROMA_420, frame->buf, vd->framesizeIn, gquality);
+        gettimeofday(&frame->timestamp, NULL);
 
 #if 0
         /* motion detection can be done just by comparing the picture size, but it is not very accurate!! */
@@ -659,14 +572,20 @@ void *fb_thread(void *arg)
         prev_size = global->size;
 #endif
 
-        /* signal fresh_frame */
-        pthread_cond_broadcast(&pglobal->in[pcontext->id].db_update);
-        pthread_mutex_unlock(&pglobal->in[pcontext->id].db);
+        /* signal fresh_frame, unless the compressed picture did not fit */
+        if(frame->size > 0)
+            input_frame_publish(&pglobal->in[pcontext->id], frame);
+        else
+            input_frame_release(frame);
 
         /* only use usleep if the fps is below 5, otherwise the overhead is too long */
+        rate = pglobal->in[pcontext->id].rate;
         if(vd->fps < 5) {
             DBG("waiting for next frame for %d us\n", 1000 * 1000 / vd->fps);
             usleep(1000 * 1000 / vd->fps);
+        } else if(rate > 0 && rate < vd->fps) {
+            DBG("consumers only need %d fps\n", rate);
+            usleep(1000 * 1000 / rate);
         } else {
             DBG("waiting for next frame\n");
         }
@@ -696,6 +615,9 @@ void fb_cleanup(void *arg)
     first_run = 0;
     IPRINT("cleaning up ressources allocated by input thread\n");
 
+    jpeg_encoder_free(pcontext->jpeg);
+    pcontext->jpeg = NULL;
+
     if(pcontext->videoIn->framebuffer != NULL)
         free(pcontext->videoIn->framebuffer);
 #ifdef RASPI
@@ -716,8 +638,6 @@ void fb_cleanup(void *arg)
         close(pcontext->videoIn->fbfd);
     }
     if(pcontext->videoIn != NULL) free(pcontext->videoIn);
-    if(pglobal->in[pcontext->id].buf != NULL)
-        free(pglobal->in[pcontext->id].buf);
 }
 
 /******************************************************************************
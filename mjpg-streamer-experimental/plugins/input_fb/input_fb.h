@@ -45,6 +45,7 @@
 #endif
 #include <linux/fb.h>
 #include "../../mjpg_streamer.h"
+#include "../jpeg_utils.h"
 #define NB_BUFFER 4
 
 #define IOCTL_RETRY 4
@@ -102,6 +103,7 @@ typedef struct {
     pthread_t threadID;
     pthread_mutex_t controls_mutex;
     struct vdIn *videoIn;
+    jpeg_encoder *jpeg;
 } context;
 
 extern context fbs[MAX_INPUT_PLUGINS];
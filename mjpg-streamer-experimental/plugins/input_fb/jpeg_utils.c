@@ -1,228 +0,0 @@
-/*******************************************************************************
-# Linux-UVC streaming input-plugin for MJPG-streamer                           #
-#                                                                              #
-# This package work with the Logitech UVC based webcams with the mjpeg feature #
-#                                                                              #
-#   Orginally Copyright (C) 2005 2006 Laurent Pinchart &&  Michel Xhaard       #
-#   Modifications Copyright (C) 2006  Gabriel A. Devenyi                       #
-#   Modifications Copyright (C) 2007  Tom Stöveken                             #
-#                                                                              #
-# This program is free software; you can redistribute it and/or modify         #
-# it under the terms of the GNU General Public License as published by         #
-# the Free Software Foundation; either version 2 of the License, or            #
-# (at your option) any later version.                                          #
-#                                                                              #
-# This program is distributed in the hope that it will be useful,              #
-# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
-# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
-# GNU General Public License for more details.                                 #
-#                                                                              #
-# You should have received a copy of the GNU General Public License            #
-# along with this program; if not, write to the Free Software                  #
-# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
-#                                                                              #
-*******************************************************************************/
-
-#include <stdio.h>
-#include <jpeglib.h>
-#include <stdlib.h>
-#include <stdint.h>
-
-#include "input_fb.h"
-
-#define OUTPUT_BUF_SIZE  4096
-
-typedef struct {
-    struct jpeg_destination_mgr pub; /* public fields */
-
-    JOCTET * buffer;    /* start of buffer */
-
-    unsigned char *outbuffer;
-    int outbuffer_size;
-    unsigned char *outbuffer_cursor;
-    int *written;
-
-} mjpg_destination_mgr;
-
-typedef mjpg_destination_mgr * mjpg_dest_ptr;
-
-/******************************************************************************
-Description.:
-Input Value.:
-Return Value:
-******************************************************************************/
-METHODDEF(void) init_destination(j_compress_ptr cinfo)
-{
-    mjpg_dest_ptr dest = (mjpg_dest_ptr) cinfo->dest;
-
-    /* Allocate the output buffer --- it will be released when done with image */
-    dest->buffer = (JOCTET *)(*cinfo->mem->alloc_small)((j_common_ptr) cinfo, JPOOL_IMAGE, OUTPUT_BUF_SIZE * sizeof(JOCTET));
-
-    *(dest->written) = 0;
-
-    dest->pub.next_output_byte = dest->buffer;
-    dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
-}
-
-/******************************************************************************
-Description.: called whenever local jpeg buffer fills up
-Input Value.:
-Return Value:
-******************************************************************************/
-METHODDEF(boolean) empty_output_buffer(j_compress_ptr cinfo)
-{
-    mjpg_dest_ptr dest = (mjpg_dest_ptr) cinfo->dest;
-
-    memcpy(dest->outbuffer_cursor, dest->buffer, OUTPUT_BUF_SIZE);
-    dest->outbuffer_cursor += OUTPUT_BUF_SIZE;
-    *(dest->written) += OUTPUT_BUF_SIZE;
-
-    dest->pub.next_output_byte = dest->buffer;
-    dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
-
-    return TRUE;
-}
-
-/******************************************************************************
-Description.: called by jpeg_finish_compress after all data has been written.
-              Usually needs to flush buffer.
-Input Value.:
-Return Value:
-******************************************************************************/
-METHODDEF(void) term_destination(j_compress_ptr cinfo)
-{
-    mjpg_dest_ptr dest = (mjpg_dest_ptr) cinfo->dest;
-    size_t datacount = OUTPUT_BUF_SIZE - dest->pub.free_in_buffer;
-
-    /* Write any data remaining in the buffer */
-    memcpy(dest->outbuffer_cursor, dest->buffer, datacount);
-    dest->outbuffer_cursor += datacount;
-    *(dest->written) += datacount;
-}
-
-/******************************************************************************
-Description.: Prepare for output to a stdio stream.
-Input Value.: buffer is the already allocated buffer memory that will hold
-              the compressed picture. "size" is the size in bytes.
-Return Value: -
-******************************************************************************/
-GLOBAL(void) dest_buffer(j_compress_ptr cinfo, unsigned char *buffer, int size, int *written)
-{
-    mjpg_dest_ptr dest;
-
-    if(cinfo->dest == NULL) {
-        cinfo->dest = (struct jpeg_destination_mgr *)(*cinfo->mem->alloc_small)((j_common_ptr) cinfo, JPOOL_PERMANENT, sizeof(mjpg_destination_mgr));
-    }
-
-    dest = (mjpg_dest_ptr) cinfo->dest;
-    dest->pub.init_destination = init_destination;
-    dest->pub.empty_output_buffer = empty_output_buffer;
-    dest->pub.term_destination = term_destination;
-    dest->outbuffer = buffer;
-    dest->outbuffer_size = size;
-    dest->outbuffer_cursor = buffer;
-    dest->written = written;
-}
-
-int compress_yuv420_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int quality)
-{
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    JSAMPROW y[16], cb[16], cr[16];
-    JSAMPARRAY data[3];
-    unsigned char *Y, *Cb, *Cr;
-    int line, i, width, height;
-    static int written;
-
-    data[0] = y;
-    data[1] = cb;
-    data[2] = cr;
-
-    width = vd->width;
-    height = vd->height;
-    Y = vd->framebuffer;
-    Cb = Y + width*height;
-    Cr = Cb + width*height/4;
-
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    /* jpeg_stdio_dest (&cinfo, file); */
-    dest_buffer(&cinfo, buffer, size, &written);
-
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_YCbCr;
-
-    jpeg_set_defaults(&cinfo);
-    //jpeg_set_colorspace(&cinfo, JCS_YCbCr);
-    jpeg_set_quality(&cinfo, quality, TRUE);
-    cinfo.raw_data_in = TRUE;
-
-    jpeg_start_compress(&cinfo, TRUE);
-
-    for (line=0; line < height; line+=16) {
-        for (i=0; i<16; i++) {
-            y[i] = Y + width * (i+line);
-            if (i%2 == 0) {
-                cb[i/2] = Cb + width/2*((i+line)/2);
-                cr[i/2] = Cr + width/2*((i+line)/2);
-            }
-        }
-        jpeg_write_raw_data(&cinfo, data, 16);
-    }
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-
-    return (written);
-}
-
-int compress_rgb888_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int quality)
-{
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    JSAMPROW row_pointer[1];
-    unsigned char *rgb;
-    int width, height, z;
-    static int written;
-
-    width = vd->width;
-    height = vd->height;
-    rgb = vd->framebuffer;
-    //printf("bbb\n");
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    /* jpeg_stdio_dest (&cinfo, file); */
-    dest_buffer(&cinfo, buffer, size, &written);
-
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
-
-    jpeg_start_compress(&cinfo, TRUE);
-
-    z = 0;
-    while(cinfo.next_scanline < height) {
-        /*int x;
-        unsigned char *ptr = line_buffer;
-
-        for(x = 0; x < vd->width; x++) {
-            *(ptr++) = *(rgb++); // r
-            *(ptr++) = *(rgb++); // g
-            *(ptr++) = *(rgb++); // b
-        }
-        row_pointer[0] = line_buffer;
-        */
-        row_pointer[0] = rgb + width * z * 3;
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
-        z++;
-    }
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-
-    return (written);
-}
@@ -186,8 +186,6 @@ int input_stop(int id)
 
 int input_run(int id)
 {
-    pglobal->in[id].buf = NULL;
-
     if (mode == NewFilesOnly) {
         rc = fd = inotify_init();
         if(rc == -1) {
@@ -210,7 +208,6 @@ int input_run(int id)
     }
 
     if(pthread_create(&worker, 0, worker_thread, NULL) != 0) {
-        free(pglobal->in[id].buf);
         fprintf(stderr, "could not start worker thread\n");
         exit(EXIT_FAILURE);
     }
@@ -246,7 +243,7 @@ void *worker_thread(void *arg)
     int fileCount = 0;
     int currentFileNumber = 0;
     char hasJpgFile = 0;
-    struct timeval timestamp;
+    input_frame *frame = NULL;
 
     if (mode == ExistingFiles) {
         fileCount = scandir(folder, &fileList, 0, alphasort);
@@ -324,34 +321,25 @@ void *worker_thread(void *arg)
 
         filesize = stats.st_size;
 
-        /* copy frame from file to global buffer */
-        pthread_mutex_lock(&pglobal->in[plugin_number].db);
-
-        /* allocate memory for frame */
-        if(pglobal->in[plugin_number].buf != NULL)
-            free(pglobal->in[plugin_number].buf);
-
-        pglobal->in[plugin_number].buf = malloc(filesize + (1 << 16));
-
-        if(pglobal->in[plugin_number].buf == NULL) {
+        /* get a free frame of the ring */
+        frame = input_frame_get(&pglobal->in[plugin_number], filesize);
+        if(frame == NULL) {
             fprintf(stderr, "could not allocate memory\n");
+            close(file);
             break;
         }
 
-        if((pglobal->in[plugin_number].size = read(file, pglobal->in[plugin_number].buf, filesize)) == -1) {
+        /* copy frame from file, the frame is not visible to readers yet */
+        if((frame->size = read(file, frame->buf, filesize)) == -1) {
             perror("could not read from file");
-            free(pglobal->in[plugin_number].buf); pglobal->in[plugin_number].buf = NULL; pglobal->in[plugin_number].size = 0;
-            pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+            input_frame_release(frame);
             close(file);
             break;
         }
 
-        gettimeofday(&timestamp, NULL);
-        pglobal->in[plugin_number].timestamp = timestamp;
-        DBG("new frame copied (size: %d)\n", pglobal->in[plugin_number].size);
-        /* signal fresh_frame */
-        pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-        pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+        gettimeofday(&frame->timestamp, NULL);
+        DBG("new frame copied (size: %d)\n", frame->size);
+        input_frame_publish(&pglobal->in[plugin_number], frame);
 
         close(file);
 
@@ -392,8 +380,6 @@ void worker_cleanup(void *arg)
     first_run = 0;
     DBG("cleaning up resources allocated by input thread\n");
 
-    if(pglobal->in[plugin_number].buf != NULL) free(pglobal->in[plugin_number].buf);
-
     free(ev);
 
     if (mode == NewFilesOnly) {
@@ -57,6 +57,10 @@ struct extractor_state {
 
 void init_mjpg_proxy(struct extractor_state  * state);
 
+void init_extractor_state(struct extractor_state * state);
+
+void extract_data(struct extractor_state * state, char * buffer, int length);
+
 int parse_cmd_line(struct extractor_state * out_state, int argc, char * argv []);
 
 void connect_and_stream(struct extractor_state * state);
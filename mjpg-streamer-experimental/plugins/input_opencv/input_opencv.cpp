@@ -20,6 +20,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <sys/time.h>
 #include <getopt.h>
 #include <dlfcn.h>
 #include <pthread.h>
@@ -352,7 +354,7 @@ int input_stop(int id)
 }
 
 /******************************************************************************
-Description.: starts the worker thread and allocates memory
+Description.: starts the worker thread
 Input Value.: -
 Return Value: 0
 ******************************************************************************/
@@ -361,9 +363,6 @@ int input_run(int id)
     input * in = &pglobal->in[id];
     context *pctx = (context*)in->context;
     
-    in->buf = NULL;
-    in->size = 0;
-    
     if(pthread_create(&pctx->worker, 0, worker_thread, in) != 0) {
         worker_cleanup(in);
         fprintf(stderr, "could not start worker thread\n");
@@ -425,27 +424,47 @@ void *worker_thread(void *arg)
         src = pctx->filter_init_frame(pctx->filter_ctx);
     
     while (!pglobal->stop) {
+        demand_state demand = input_demand(in);
+        
+        // nobody watches for long, stop reading until somebody does
+        if (demand == INPUT_STANDBY) {
+            input_demand_wait(in);
+            continue;
+        }
+        
         if (!pctx->capture.read(src))
             break; // TODO
+        
+        // keep the capture running, but do not filter and compress
+        if (demand == INPUT_IDLE)
+            continue;
+        
+        // the consumers need fewer frames than the camera delivers
+        struct timeval timestamp;
+        gettimeofday(&timestamp, NULL);
+        if (!input_frame_due(in, &timestamp))
+            continue;
             
         // call the filter function
         pctx->filter_process(pctx->filter_ctx, src, dst);
             
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&in->db);
-        
         // take whatever Mat it returns, and write it to jpeg buffer
         imencode(".jpg", dst, jpeg_buffer, compression_params);
         
         // TODO: what to do if imencode returns an error?
         
+        /* copy JPG picture to a free frame of the ring */
+        input_frame *frame = input_frame_get(in, jpeg_buffer.size());
+        if (frame == NULL)
+            break;
+        
         // std::vector is guaranteed to be contiguous
-        in->buf = &jpeg_buffer[0];
-        in->size = jpeg_buffer.size();
+        frame->size = jpeg_buffer.size();
+        memcpy(frame->buf, &jpeg_buffer[0], frame->size);
+        frame->timestamp = timestamp;
         
         /* signal fresh_frame */
-        pthread_cond_broadcast(&in->db_update);
-        pthread_mutex_unlock(&in->db);
+        input_frame_publish(in, frame);
     }
     
     IPRINT("leaving input thread, calling cleanup function now\n");
@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
+#include <sys/time.h>
 #include <gphoto2/gphoto2-camera.h>
 #include "input_ptp2.h"
 
@@ -131,12 +132,6 @@ int input_run(int id)
 {
 	int res, i;
 
-	global->in[id].buf = malloc(256 * 1024);
-	if(global->in[id].buf == NULL)
-	{
-		IPRINT(INPUT_PLUGIN_NAME " - could not allocate memory\n");
-		exit(EXIT_FAILURE);
-	}
 	plugin_id = id;
 
 	// auto-detect algorithm
@@ -214,7 +209,6 @@ int input_run(int id)
 	// starting thread
 	if(pthread_create(&thread, 0, capture, NULL) != 0)
 	{
-		free(global->in[id].buf);
 		IPRINT("could not start worker thread\n");
 		exit(EXIT_FAILURE);
 	}
@@ -234,12 +228,12 @@ void* capture(void* arg)
 					{
 						unsigned long int xsize;
 						const char* xdata;
+						input_frame* frame;
 						pthread_mutex_lock(&control_mutex);
 						res = gp_file_new(&file);
 						CAMERA_CHECK_GP(res, "gp_file_new");
 						res = gp_camera_capture_preview(camera, file, context);
 						CAMERA_CHECK_GP(res, "gp_camera_capture_preview");
-						pthread_mutex_lock(&global->in[plugin_id].db);
 						res = gp_file_get_data_and_size(file, &xdata, &xsize);
 						if(xsize == 0)
 						{
@@ -258,14 +252,21 @@ void* capture(void* arg)
 						else
 							i = 0;
 						CAMERA_CHECK_GP(res, "gp_file_get_data_and_size");
-						memcpy(global->in[plugin_id].buf, xdata, xsize);
+						frame = input_frame_get(&global->in[plugin_id], xsize);
+						if(frame != NULL)
+						{
+							memcpy(frame->buf, xdata, xsize);
+							frame->size = xsize;
+							gettimeofday(&frame->timestamp, NULL);
+						}
 						res = gp_file_unref(file);
 						pthread_mutex_unlock(&control_mutex);
+						if(frame != NULL)
+						{
+							DBG("Read %d bytes from camera.\n", frame->size);
+							input_frame_publish(&global->in[plugin_id], frame);
+						}
 						CAMERA_CHECK_GP(res, "gp_file_unref");
-						global->in[plugin_id].size = xsize;
-						DBG("Read %d bytes from camera.\n", global->in[plugin_id].size);
-						pthread_cond_broadcast(&global->in[plugin_id].db_update);
-						pthread_mutex_unlock(&global->in[plugin_id].db);
 						usleep(delay);
 					}
 					pthread_cleanup_pop(1);
@@ -302,7 +303,6 @@ void cleanup(void *arg)
 	gp_camera_exit(camera, context);
 	gp_camera_unref(camera);
 	gp_context_unref(context);
-	free(global->in[plugin_id].buf);
 }
 
 int input_cmd(int plugin, unsigned int control_id, unsigned int group, int value)
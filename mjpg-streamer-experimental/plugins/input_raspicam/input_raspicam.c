@@ -33,6 +33,7 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <syslog.h>
+#include <sys/time.h>
 #include <time.h>
 
 #include <linux/types.h>          /* for videodev2.h */
@@ -334,6 +335,7 @@ void print_mmal_status(MMAL_STATUS_T status)
  ******************************************************************************/
 static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
 {
+  static input_frame *frame = NULL;
   int complete = 0;
 
   // We pass our file handle and other stuff in via the userdata field.
@@ -348,12 +350,15 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
       //fprintf(stderr, "The flags are %x of length %i offset %i\n", buffer->flags, buffer->length, pData->offset);
 
       //Write bytes
-      /* copy JPG picture to global buffer */
+      /* copy JPG picture to a free frame of the ring */
       if(pData->offset == 0)
-        pthread_mutex_lock(&pglobal->in[plugin_number].db);
+        frame = input_frame_get(&pglobal->in[plugin_number], width * height * 3);
 
-      memcpy(pData->offset + pglobal->in[plugin_number].buf, buffer->data, buffer->length);
-      pData->offset += buffer->length;
+      if(frame != NULL && pData->offset + buffer->length <= frame->capacity)
+      {
+        memcpy(pData->offset + frame->buf, buffer->data, buffer->length);
+        pData->offset += buffer->length;
+      }
       //fwrite(buffer->data, 1, buffer->length, pData->file_handle);
       mmal_buffer_header_mem_unlock(buffer);
     }
@@ -362,11 +367,15 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
     if (buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED))
     {
       complete = 1;
-      pglobal->in[plugin_number].size = pData->offset;
+      if(frame != NULL)
+      {
+        frame->size = pData->offset;
+        gettimeofday(&frame->timestamp, NULL);
+        /* signal fresh_frame */
+        input_frame_publish(&pglobal->in[plugin_number], frame);
+        frame = NULL;
+      }
       pData->offset = 0;
-      /* signal fresh_frame */
-      pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-      pthread_mutex_unlock(&pglobal->in[plugin_number].db); 
     }
   }
   else
@@ -430,22 +439,14 @@ static void camera_control_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
 }
 
 /******************************************************************************
-  Description.: starts the worker thread and allocates memory
+  Description.: starts the worker thread
   Input Value.: -
   Return Value: 0
  ******************************************************************************/
 int input_run(int id)
 {
-  pglobal->in[id].buf = malloc(width * height * 3);
-  if (pglobal->in[id].buf == NULL)
-  {
-    fprintf(stderr, "could not allocate memory\n");
-    exit(EXIT_FAILURE);
-  }
-
   if (pthread_create(&worker, 0, worker_thread, NULL) != 0)
   {
-    free(pglobal->in[id].buf);
     fprintf(stderr, "could not start worker thread\n");
     exit(EXIT_FAILURE);
   }
@@ -1046,9 +1047,6 @@ void worker_cleanup(void *arg)
 
   first_run = 0;
   DBG("cleaning up resources allocated by input thread\n");
-
-  if(pglobal->in[plugin_number].buf != NULL)
-    free(pglobal->in[plugin_number].buf);
 }
 
 
@@ -33,12 +33,22 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <syslog.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
 
+#ifndef NO_LIBJPEG
+#include <jpeglib.h>
+#endif
+
 #include "../../mjpg_streamer.h"
 #include "../../utils.h"
+#ifndef NO_LIBJPEG
+#include "../jpeg_utils.h"
+#include "../frame_stamp.h"
+#endif
 
 #include "testpictures.h"
 
@@ -56,10 +66,61 @@ void help(void);
 
 static int delay = 1000;
 
+/* load generation, fps overrides delay if set */
+static double fps = 0;
+static int burst = 1;
+static double jitter = 0;
+static unsigned int seed = 1;
+
+/* how the sizes of the frames get chosen */
+typedef enum {
+    SIZE_PICTURE,   /* as big as the embedded picture */
+    SIZE_FIXED,
+    SIZE_UNIFORM,
+    SIZE_TRACE      /* the sizes listed in a file, one after the other */
+} size_mode;
+
+static size_mode sizes = SIZE_PICTURE;
+static int size_min, size_max;
+static int *trace;
+static int trace_count;
+
+#ifndef NO_LIBJPEG
+/*
+ * With -stamp the pictures get decoded once and every frame is compressed
+ * again with a frame stamp drawn into its top rows, like a camera pointed
+ * at a clock would deliver them.
+ */
+#define STAMP_QUALITY 80
+
+static int stamp;
+static unsigned char *rgb[2];
+static int rgb_width, rgb_height;
+
+/* buffers of the worker thread to stamp and compress the frames */
+typedef struct {
+    jpeg_encoder *jpeg;
+    unsigned char *raw;         // the stamped picture
+    unsigned char *buffer;      // the compressed picture
+    int length;                 // size of each buffer
+} stamp_scratch;
+#endif
+
+/*
+ * Every frame carries a JPEG comment right after the SOI marker with its
+ * sequence number and capture time, so a client can tell which frames it
+ * got and how long they took.
+ */
+#define STAMP_FORMAT "MJPG-streamer seq=%010u ts=%010ld.%06ld"
+#define STAMP_MAX 64
+
+/* a comment segment holds at most this many bytes including its header */
+#define COM_MAX (4 + 65533)
+
 /* details of converted JPG pictures */
 struct pic {
     const unsigned char *data;
-    const int size;
+    int size;
 };
 
 /* lookup pictures by resolution */
@@ -76,6 +137,276 @@ static struct pictures {
 
 struct pictures *pics;
 
+#ifndef NO_LIBJPEG
+/******************************************************************************
+Description.: decodes a picture to RGB24
+Input Value.: * pic.....: the picture
+              * width, height: set to its size
+Return Value: the pixels or NULL if the picture could not be decoded
+******************************************************************************/
+static unsigned char *decode_picture(struct pic *pic, int *width, int *height)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char *pixels;
+    JSAMPROW row;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)pic->data, pic->size);
+
+    if(jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    if((pixels = malloc(*width * *height * 3)) == NULL) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+
+    while(cinfo.output_scanline < cinfo.output_height) {
+        row = pixels + cinfo.output_scanline * *width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+#endif
+
+/******************************************************************************
+Description.: reads the sizes of a trace, one per line, lines starting with
+              # are comments
+Input Value.: the file
+Return Value: 0 if everything is ok, -1 otherwise
+******************************************************************************/
+static int read_trace(const char *file)
+{
+    char line[256];
+    int allocated = 0, *sizes, size;
+    FILE *f;
+
+    if((f = fopen(file, "r")) == NULL) {
+        perror("could not open the trace");
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), f) != NULL) {
+        if(line[0] == '#' || sscanf(line, "%d", &size) != 1 || size <= 0)
+            continue;
+
+        if(trace_count == allocated) {
+            allocated = allocated ? 2 * allocated : 256;
+            if((sizes = realloc(trace, allocated * sizeof(int))) == NULL) {
+                fclose(f);
+                return -1;
+            }
+            trace = sizes;
+        }
+        trace[trace_count++] = size;
+    }
+    fclose(f);
+
+    if(trace_count == 0) {
+        fprintf(stderr, "the trace %s lists no sizes\n", file);
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: parses the -size parameter
+Input Value.: fixed:<bytes>, uniform:<min>-<max> or trace:<file>
+Return Value: 0 if everything is ok, -1 otherwise
+******************************************************************************/
+static int parse_size(const char *arg)
+{
+    if(sscanf(arg, "fixed:%d", &size_min) == 1 && size_min > 0) {
+        sizes = SIZE_FIXED;
+        size_max = size_min;
+    } else if(sscanf(arg, "uniform:%d-%d", &size_min, &size_max) == 2 &&
+              size_min > 0 && size_max >= size_min) {
+        sizes = SIZE_UNIFORM;
+    } else if(strncmp(arg, "trace:", 6) == 0 && read_trace(arg + 6) == 0) {
+        sizes = SIZE_TRACE;
+    } else {
+        fprintf(stderr, "invalid frame size: %s\n", arg);
+        return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: picks the size of the next frame
+Input Value.: * state...: of the random numbers
+              * seq.....: sequence number of the frame
+Return Value: size in bytes, 0 for the size of the picture
+******************************************************************************/
+static int next_size(unsigned int *state, unsigned int seq)
+{
+    switch(sizes) {
+    case SIZE_FIXED:
+        return size_min;
+    case SIZE_UNIFORM:
+        return size_min + rand_r(state) % (size_max - size_min + 1);
+    case SIZE_TRACE:
+        return trace[(seq - 1) % trace_count];
+    default:
+        return 0;
+    }
+}
+
+/******************************************************************************
+Description.: writes a JPEG comment segment
+Input Value.: * buf.....: where the segment starts
+              * length..: of the whole segment, at least 4 and at most COM_MAX
+Return Value: the payload of the segment
+******************************************************************************/
+static unsigned char *put_comment(unsigned char *buf, int length)
+{
+    buf[0] = 0xff;
+    buf[1] = 0xfe;
+    buf[2] = (length - 2) >> 8;
+    buf[3] = (length - 2) & 0xff;
+
+    return buf + 4;
+}
+
+/******************************************************************************
+Description.: builds a frame from a picture, stamped with its sequence number
+              and capture time and padded with comments to the wanted size
+Input Value.: * pic.....: the picture
+              * seq.....: sequence number of the frame
+              * size....: wanted size, frames can not get smaller than the
+                          stamped picture
+              * captured: capture time of the picture, NULL for now
+Return Value: the frame or NULL if there is no memory
+******************************************************************************/
+static input_frame *make_frame(struct pic *pic, unsigned int seq, int size, struct timeval *captured)
+{
+    char comment[STAMP_MAX];
+    input_frame *frame;
+    unsigned char *p;
+    struct timeval timestamp;
+    int stamped, padding, length;
+
+    if(captured != NULL)
+        timestamp = *captured;
+    else
+        gettimeofday(&timestamp, NULL);
+    stamped = snprintf(comment, sizeof(comment), STAMP_FORMAT, seq, (long)timestamp.tv_sec, (long)timestamp.tv_usec);
+    padding = MAX(size - (pic->size + 4 + stamped), 0);
+
+    frame = input_frame_get(&pglobal->in[plugin_number], pic->size + 4 + stamped + padding);
+    if(frame == NULL)
+        return NULL;
+
+    /* SOI, stamp, padding and the rest of the picture */
+    p = frame->buf;
+    memcpy(p, pic->data, 2);
+    p += 2;
+    memcpy(put_comment(p, 4 + stamped), comment, stamped);
+    p += 4 + stamped;
+
+    while(padding >= 4) {
+        length = MIN(padding, COM_MAX);
+        if(padding - length > 0 && padding - length < 4)
+            length -= 4;
+        memset(put_comment(p, length), 0, length - 4);
+        p += length;
+        padding -= length;
+    }
+
+    memcpy(p, pic->data + 2, pic->size - 2);
+    p += pic->size - 2;
+
+    frame->size = p - frame->buf;
+    frame->timestamp = timestamp;
+    frame->captured = timestamp;
+
+    return frame;
+}
+
+#ifndef NO_LIBJPEG
+/******************************************************************************
+Description.: builds a frame from a decoded picture with a frame stamp drawn
+              into it
+Input Value.: * s.......: buffers of the worker thread
+              * index...: which picture of the sequence
+              * seq.....: sequence number of the frame
+              * size....: wanted size, see make_frame
+Return Value: the frame or NULL on error
+******************************************************************************/
+static input_frame *make_stamped_frame(stamp_scratch *s, int index, unsigned int seq, int size)
+{
+    input_metrics *metrics = &pglobal->in[plugin_number].metrics;
+    struct timeval captured, encoded;
+    struct timespec start;
+    struct pic pic;
+    input_frame *frame;
+
+    gettimeofday(&captured, NULL);
+    memcpy(s->raw, rgb[index], rgb_width * rgb_height * 3);
+    frame_stamp_draw(s->raw, rgb_width, rgb_height, V4L2_PIX_FMT_RGB24, seq, &captured);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pic.data = s->buffer;
+    pic.size = jpeg_encoder_compress(s->jpeg, s->raw, rgb_width, rgb_height, V4L2_PIX_FMT_RGB24, JPEG_CHROMA_420,
+                                     s->buffer, s->length, STAMP_QUALITY);
+    if(pic.size <= 0)
+        return NULL;
+    gettimeofday(&encoded, NULL);
+    metric_observe_since(metrics->encode_time, &start);
+    metric_add(metrics->encoded, 1);
+
+    if((frame = make_frame(&pic, seq, size, &captured)) != NULL)
+        frame->encoded = encoded;
+
+    return frame;
+}
+
+/******************************************************************************
+Description.: releases the stamp buffers of the worker thread, also when it
+              gets cancelled
+Input Value.: the buffers
+Return Value: -
+******************************************************************************/
+static void stamp_cleanup(void *arg)
+{
+    stamp_scratch *s = arg;
+
+    if(s->jpeg != NULL)
+        jpeg_encoder_free(s->jpeg);
+    free(s->raw);
+    free(s->buffer);
+}
+#endif
+
+/******************************************************************************
+Description.: adds nanoseconds to a CLOCK_MONOTONIC time
+Input Value.: * ts......: the time to move
+              * ns......: nanoseconds, may be negative
+Return Value: -
+******************************************************************************/
+static void timespec_add(struct timespec *ts, long long ns)
+{
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000LL;
+    ts->tv_nsec = ns % 1000000000LL;
+    if(ts->tv_nsec < 0) {
+        ts->tv_sec--;
+        ts->tv_nsec += 1000000000LL;
+    }
+}
+
 /*** plugin interface functions ***/
 
 /******************************************************************************
@@ -87,6 +418,7 @@ int input_init(input_parameter *param, int plugin_no)
 {
     int i;
 
+    plugin_number = plugin_no;
     pics = &picture_lookup[1];
 
     if(pthread_mutex_init(&controls_mutex, NULL) != 0) {
@@ -112,6 +444,12 @@ int input_init(input_parameter *param, int plugin_no)
             {"delay", required_argument, 0, 0},
             {"r", required_argument, 0, 0},
             {"resolution", required_argument, 0, 0},
+            {"fps", required_argument, 0, 0},
+            {"size", required_argument, 0, 0},
+            {"burst", required_argument, 0, 0},
+            {"jitter", required_argument, 0, 0},
+            {"seed", required_argument, 0, 0},
+            {"stamp", no_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -154,6 +492,47 @@ int input_init(input_parameter *param, int plugin_no)
             }
             break;
 
+            /* fps */
+        case 6:
+            DBG("case 6\n");
+            fps = strtod(optarg, NULL);
+            break;
+
+            /* size */
+        case 7:
+            DBG("case 7\n");
+            if(parse_size(optarg) < 0) {
+                help();
+                return 1;
+            }
+            break;
+
+            /* burst */
+        case 8:
+            DBG("case 8\n");
+            burst = MAX(atoi(optarg), 1);
+            break;
+
+            /* jitter */
+        case 9:
+            DBG("case 9\n");
+            jitter = MAX(strtod(optarg, NULL), 0);
+            break;
+
+            /* seed */
+        case 10:
+            DBG("case 10\n");
+            seed = strtoul(optarg, NULL, 0);
+            break;
+
+#ifndef NO_LIBJPEG
+            /* stamp */
+        case 11:
+            DBG("case 11\n");
+            stamp = 1;
+            break;
+#endif
+
         default:
             DBG("default case\n");
             help();
@@ -163,8 +542,48 @@ int input_init(input_parameter *param, int plugin_no)
 
     pglobal = param->global;
 
-    IPRINT("delay.............: %i\n", delay);
+#ifndef NO_LIBJPEG
+    if(stamp) {
+        for(i = 0; i < LENGTH_OF(pics->sequence); i++) {
+            if((rgb[i] = decode_picture(&pics->sequence[i], &rgb_width, &rgb_height)) == NULL) {
+                fprintf(stderr, "could not decode the %s test picture\n", pics->resolution);
+                return 1;
+            }
+        }
+        if(frame_stamp_rows(rgb_width, rgb_height) < 0) {
+            fprintf(stderr, "a frame stamp does not fit the %s test picture\n", pics->resolution);
+            return 1;
+        }
+    }
+#endif
+
+    if(fps > 0) {
+        IPRINT("frames per second.: %g\n", fps);
+    } else {
+        IPRINT("delay.............: %i\n", delay);
+    }
     IPRINT("resolution........: %s\n", pics->resolution);
+    switch(sizes) {
+    case SIZE_FIXED:
+        IPRINT("frame size........: %d bytes\n", size_min);
+        break;
+    case SIZE_UNIFORM:
+        IPRINT("frame size........: %d to %d bytes\n", size_min, size_max);
+        break;
+    case SIZE_TRACE:
+        IPRINT("frame size........: %d sizes from the trace\n", trace_count);
+        break;
+    default:
+        break;
+    }
+    if(burst > 1)
+        IPRINT("burst.............: %d frames\n", burst);
+    if(jitter > 0)
+        IPRINT("jitter............: %g ms\n", jitter);
+#ifndef NO_LIBJPEG
+    if(stamp)
+        IPRINT("frame stamps......: drawn into the pictures\n");
+#endif
 
     return 0;
 }
@@ -183,20 +602,13 @@ int input_stop(int id)
 }
 
 /******************************************************************************
-Description.: starts the worker thread and allocates memory
+Description.: starts the worker thread
 Input Value.: -
 Return Value: 0
 ******************************************************************************/
 int input_run(int id)
 {
-    pglobal->in[id].buf = malloc(256 * 1024);
-    if(pglobal->in[id].buf == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        exit(EXIT_FAILURE);
-    }
-
     if(pthread_create(&worker, 0, worker_thread, NULL) != 0) {
-        free(pglobal->in[id].buf);
         fprintf(stderr, "could not start worker thread\n");
         exit(EXIT_FAILURE);
     }
@@ -217,7 +629,24 @@ void help(void)
     " ---------------------------------------------------------------\n" \
     " The following parameters can be passed to this plugin:\n\n" \
     " [-d | --delay ]........: delay to pause between frames\n" \
-    " [-r | --resolution]....: can be 960x720, 640x480, 320x240, 160x120\n"
+    " [-r | --resolution]....: can be 960x720, 640x480, 320x240, 160x120\n" \
+    " [-fps ]................: frames per second, paced precisely, overrides -d\n" \
+    " [-size ]...............: size of the frames in bytes, pictures get padded\n" \
+    "                          with JPEG comments: fixed:<bytes>,\n" \
+    "                          uniform:<min>-<max> or trace:<file> which lists\n" \
+    "                          one size per line and gets repeated\n" \
+    " [-burst ]..............: publish this many frames back to back, the bursts\n" \
+    "                          are paced to keep the frame rate\n" \
+    " [-jitter ].............: move every frame or burst up to this many\n" \
+    "                          milliseconds off its schedule\n" \
+    " [-seed ]...............: seed of the random sizes and jitter (default 1)\n");
+#ifndef NO_LIBJPEG
+    fprintf(stderr, " [-stamp ]..............: compress every frame again with a frame stamp\n" \
+    "                          of its sequence number and capture time drawn\n" \
+    "                          into the picture\n");
+#endif
+    fprintf(stderr, " Every frame carries a JPEG comment with its sequence number and\n" \
+    " capture time: \"MJPG-streamer seq=<n> ts=<seconds>.<microseconds>\"\n"
     " ---------------------------------------------------------------\n");
 }
 
@@ -229,28 +658,88 @@ Return Value: NULL
 ******************************************************************************/
 void *worker_thread(void *arg)
 {
-    int i = 0;
+    int i = 0, b;
+    unsigned int seq = 0, state = seed;
+    long long period, offset;
+    struct timespec next, due, now;
+    input *in = &pglobal->in[plugin_number];
+    input_frame *frame = NULL;
+#ifndef NO_LIBJPEG
+    stamp_scratch scratch;
+
+    memset(&scratch, 0, sizeof(stamp_scratch));
+    if(stamp) {
+        scratch.length = rgb_width * rgb_height * 3;
+        scratch.jpeg = jpeg_encoder_new(1);
+        scratch.raw = malloc(scratch.length);
+        scratch.buffer = malloc(scratch.length);
+        if(scratch.jpeg == NULL || scratch.raw == NULL || scratch.buffer == NULL) {
+            fprintf(stderr, "could not allocate memory\n");
+            stamp = 0;
+        }
+    }
+#endif
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
+#ifndef NO_LIBJPEG
+    pthread_cleanup_push(stamp_cleanup, &scratch);
+#endif
+
+    /* a burst is due every period, on a schedule that does not drift */
+    period = (fps > 0) ? (long long)(1000000000.0 / fps) : 1000000LL * delay;
+    period *= burst;
+    clock_gettime(CLOCK_MONOTONIC, &next);
 
     while(!pglobal->stop) {
+        if(input_demand(in) != INPUT_ACTIVE) {
+            DBG("nobody wants frames of input %d, waiting\n", plugin_number);
+            input_demand_wait(in);
+            clock_gettime(CLOCK_MONOTONIC, &next);
+            continue;
+        }
 
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&pglobal->in[plugin_number].db);
+        for(b = 0; b < burst && !pglobal->stop; b++) {
+            i = (i + 1) % LENGTH_OF(pics->sequence);
+            seq++;
+
+            /* copy the stamped JPG picture to a free frame of the ring */
+#ifndef NO_LIBJPEG
+            if(stamp)
+                frame = make_stamped_frame(&scratch, i, seq, next_size(&state, seq));
+            else
+#endif
+                frame = make_frame(&pics->sequence[i], seq, next_size(&state, seq), NULL);
+            if(frame == NULL) {
+                fprintf(stderr, "could not allocate memory\n");
+                goto thread_quit;
+            }
+            metric_add(in->metrics.captured, 1);
+
+            /* signal fresh_frame */
+            input_frame_publish(in, frame);
+        }
 
-        i = (i + 1) % LENGTH_OF(pics->sequence);
-        pglobal->in[plugin_number].size = pics->sequence[i].size;
-        memcpy(pglobal->in[plugin_number].buf, pics->sequence[i].data, pglobal->in[plugin_number].size);
+        timespec_add(&next, period);
 
-        /* signal fresh_frame */
-        pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
-        pthread_mutex_unlock(&pglobal->in[plugin_number].db);
+        /* start over if publishing fell behind by more than a second */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(now.tv_sec - next.tv_sec > 1)
+            next = now;
 
-        usleep(1000 * delay);
+        due = next;
+        if(jitter > 0) {
+            offset = (long long)(jitter * 1000000.0 * (2.0 * rand_r(&state) / RAND_MAX - 1.0));
+            timespec_add(&due, offset);
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
     }
 
+thread_quit:
     IPRINT("leaving input thread, calling cleanup function now\n");
+#ifndef NO_LIBJPEG
+    pthread_cleanup_pop(1);
+#endif
     pthread_cleanup_pop(1);
 
     return NULL;
@@ -272,8 +761,6 @@ void worker_cleanup(void *arg)
 
     first_run = 0;
     DBG("cleaning up resources allocated by input thread\n");
-
-    if(pglobal->in[plugin_number].buf != NULL) free(pglobal->in[plugin_number].buf);
 }
 
 
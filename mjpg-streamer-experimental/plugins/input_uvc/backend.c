@@ -0,0 +1,778 @@
+/*******************************************************************************
+# Linux-UVC streaming input-plugin for MJPG-streamer                           #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "../../utils.h"
+#include "../frame_stamp.h"
+#include "v4l2uvc.h"
+#include "backend.h"
+
+/* a frame of a recording */
+typedef struct {
+    struct record_header header;
+    const unsigned char *data;
+    unsigned long long at;      // nanoseconds after the first frame
+} replay_frame;
+
+/*
+ * A recorded or replayed device. A replayed one is a timerfd, it becomes
+ * readable when a filled buffer waits or the next frame of the recording is
+ * due, so poll() and epoll work on it like on a capture device.
+ */
+typedef struct {
+    int used;
+    int fd;
+    int replay;
+    pthread_mutex_t mutex;
+
+    unsigned char *mem[MAX_BUFFERS];    // where the buffers got mapped
+
+    /* record */
+    FILE *file;
+    unsigned int offsets[MAX_BUFFERS];  // of the buffers as told by VIDIOC_QUERYBUF
+
+    /* replay */
+    unsigned char *data;                // the mapped recording
+    size_t size;
+    struct record_header format;
+    replay_frame *frames;
+    int frame_count;
+    int next;                           // frame that gets captured next
+    double speed;                       // 0 to capture as fast as buffers get queued
+    int stamp;                          // draw frame stamps into the buffers
+    unsigned long long start;           // when the first frame of this pass is due
+    unsigned long long period;          // duration of one pass at the original timing
+    int streaming;
+    int count;                          // buffers requested
+    size_t length;                      // size of each buffer
+    int queue[MAX_BUFFERS], queued;     // empty buffers in the order they were queued
+    int done[MAX_BUFFERS], ready;       // filled buffers waiting for VIDIOC_DQBUF
+    struct v4l2_buffer filled[MAX_BUFFERS];
+    unsigned int sequence;
+    int armed;                          // the timer was set to expire
+} session;
+
+static session sessions[MAX_INPUT_PLUGINS];
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/******************************************************************************
+Description.: looks up the session of a descriptor
+Input Value.: the descriptor
+Return Value: the session or NULL for a plain device
+******************************************************************************/
+static session *session_find(int fd)
+{
+    session *s = NULL;
+    int i;
+
+    pthread_mutex_lock(&sessions_mutex);
+    for(i = 0; i < MAX_INPUT_PLUGINS; i++) {
+        if(sessions[i].used && sessions[i].fd == fd) {
+            s = &sessions[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+
+    return s;
+}
+
+/******************************************************************************
+Description.: claims an unused session for a descriptor
+Input Value.: the descriptor
+Return Value: the cleared session or NULL if all are taken
+******************************************************************************/
+static session *session_new(int fd)
+{
+    session *s = NULL;
+    int i;
+
+    pthread_mutex_lock(&sessions_mutex);
+    for(i = 0; i < MAX_INPUT_PLUGINS; i++) {
+        if(!sessions[i].used) {
+            s = &sessions[i];
+            memset(s, 0, sizeof(session));
+            s->used = 1;
+            s->fd = fd;
+            pthread_mutex_init(&s->mutex, NULL);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+
+    return s;
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/******************************************************************************
+Description.: appends a record to the recording, stops recording if the file
+              can not take it
+Input Value.: * s.......: the recorded session
+              * header..: the record
+              * data....: bytes following a buffer record, NULL for other
+                          records
+Return Value: -
+******************************************************************************/
+static void record_write(session *s, struct record_header *header, const void *data)
+{
+    if(s->file == NULL)
+        return;
+
+    if(fwrite(header, sizeof(struct record_header), 1, s->file) != 1 ||
+       (data != NULL && header->bytesused > 0 && fwrite(data, header->bytesused, 1, s->file) != 1)) {
+        perror("Unable to write the recording, it stops here");
+        fclose(s->file);
+        s->file = NULL;
+    }
+}
+
+/******************************************************************************
+Description.: notes what a successful ioctl of a recorded device did
+Input Value.: * s.......: the recorded session
+              * request.: the ioctl
+              * arg.....: its argument
+Return Value: -
+******************************************************************************/
+static void record_ioctl(session *s, unsigned int request, void *arg)
+{
+    struct v4l2_format *fmt = arg;
+    struct v4l2_buffer *buf = arg;
+    struct record_header header;
+
+    memset(&header, 0, sizeof(struct record_header));
+
+    pthread_mutex_lock(&s->mutex);
+    switch(request) {
+    case VIDIOC_S_FMT:
+        header.type = RECORD_FORMAT;
+        header.pixelformat = fmt->fmt.pix.pixelformat;
+        header.width = fmt->fmt.pix.width;
+        header.height = fmt->fmt.pix.height;
+        header.sizeimage = fmt->fmt.pix.sizeimage;
+        record_write(s, &header, NULL);
+        break;
+
+    case VIDIOC_QUERYBUF:
+        if(buf->index < MAX_BUFFERS)
+            s->offsets[buf->index] = buf->m.offset;
+        break;
+
+    case VIDIOC_DQBUF:
+        if(buf->index >= MAX_BUFFERS || s->mem[buf->index] == NULL)
+            break;
+        header.type = RECORD_BUFFER;
+        header.bytesused = buf->bytesused;
+        header.sec = buf->timestamp.tv_sec;
+        header.usec = buf->timestamp.tv_usec;
+        record_write(s, &header, s->mem[buf->index]);
+        break;
+    }
+    pthread_mutex_unlock(&s->mutex);
+}
+
+/******************************************************************************
+Description.: starts recording an opened device, the format and every
+              dequeued buffer get written to the file
+Input Value.: * fd......: the opened device
+              * file....: the recording
+              * append..: continue the recording of a reopened device, its
+                          new format gets appended as a record of its own
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
+int record_open(int fd, const char *file, int append)
+{
+    session *s;
+    FILE *f;
+    int i;
+
+    if((f = fopen(file, append ? "ab" : "wb")) == NULL) {
+        perror("Unable to create the recording");
+        return -1;
+    }
+
+    /* only a new file starts with the magic */
+    if(fseek(f, 0, SEEK_END) != 0 ||
+       (ftell(f) == 0 && fwrite(RECORD_MAGIC, strlen(RECORD_MAGIC), 1, f) != 1) ||
+       (s = session_new(fd)) == NULL) {
+        fprintf(stderr, "Unable to record to %s\n", file);
+        fclose(f);
+        return -1;
+    }
+
+    for(i = 0; i < MAX_BUFFERS; i++)
+        s->offsets[i] = (unsigned int) -1;
+    s->file = f;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: when the next frame of the recording is due
+Input Value.: the replayed session
+Return Value: CLOCK_MONOTONIC in nanoseconds
+******************************************************************************/
+static unsigned long long replay_due(session *s)
+{
+    return s->start + (unsigned long long)(s->frames[s->next].at / s->speed);
+}
+
+/******************************************************************************
+Description.: sets the timer of the session, it expires right away if a
+              filled buffer waits, otherwise when the next frame is due and
+              there is a buffer to capture it into
+Input Value.: the replayed session, its mutex must be locked
+Return Value: -
+******************************************************************************/
+static void replay_arm(session *s)
+{
+    struct itimerspec its;
+    unsigned long long due;
+    int flags = 0;
+
+    memset(&its, 0, sizeof(struct itimerspec));
+
+    if(s->ready > 0) {
+        /* still expired and readable, setting it again would clear that */
+        if(s->armed && timerfd_gettime(s->fd, &its) == 0 &&
+           its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            return;
+        its.it_value.tv_nsec = 1;
+    } else if(s->streaming && s->queued > 0 && s->speed > 0) {
+        due = replay_due(s);
+        its.it_value.tv_sec = due / 1000000000ULL;
+        its.it_value.tv_nsec = due % 1000000000ULL;
+        flags = TFD_TIMER_ABSTIME;
+    }
+
+    s->armed = (its.it_value.tv_sec != 0 || its.it_value.tv_nsec != 0);
+    timerfd_settime(s->fd, flags, &its, NULL);
+}
+
+/******************************************************************************
+Description.: captures the frames that are due into the queued buffers, like
+              a driver the frames without an empty buffer get dropped
+Input Value.: the replayed session, its mutex must be locked
+Return Value: -
+******************************************************************************/
+static void replay_capture(session *s)
+{
+    unsigned long long now = now_ns(), due, pass;
+    replay_frame *frame;
+    struct v4l2_buffer *buf;
+    struct timeval tv;
+    int index;
+
+    while(s->streaming && (s->queued > 0 || s->speed > 0)) {
+        if(s->speed > 0) {
+            due = replay_due(s);
+            if(due > now)
+                break;
+
+            /* skip the passes nobody was around for */
+            pass = MAX((unsigned long long)(s->period / s->speed), 1);
+            if(now - due > pass) {
+                s->start += (now - due) / pass * pass;
+                continue;
+            }
+        }
+
+        if(s->queued > 0) {
+            index = s->queue[0];
+            memmove(s->queue, s->queue + 1, --s->queued * sizeof(int));
+
+            frame = &s->frames[s->next];
+            buf = &s->filled[index];
+            memset(buf, 0, sizeof(struct v4l2_buffer));
+            buf->index = index;
+            buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf->memory = V4L2_MEMORY_MMAP;
+            buf->field = V4L2_FIELD_NONE;
+            buf->flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+            buf->length = s->length;
+            buf->m.offset = index * s->length;
+            buf->sequence = s->sequence;
+            buf->bytesused = MIN(frame->header.bytesused, s->length);
+            buf->timestamp.tv_sec = now / 1000000000ULL;
+            buf->timestamp.tv_usec = (now % 1000000000ULL) / 1000;
+            if(s->mem[index] != NULL) {
+                memcpy(s->mem[index], frame->data, buf->bytesused);
+                if(s->stamp) {
+                    gettimeofday(&tv, NULL);
+                    frame_stamp_draw(s->mem[index], s->format.width, s->format.height,
+                                     s->format.pixelformat, s->sequence, &tv);
+                }
+            } else {
+                buf->bytesused = 0;
+            }
+            s->done[s->ready++] = index;
+        }
+        s->sequence++;
+
+        if(++s->next == s->frame_count) {
+            s->next = 0;
+            s->start += MAX((unsigned long long)(s->period / (s->speed > 0 ? s->speed : 1)), 1);
+        }
+    }
+
+    replay_arm(s);
+}
+
+/******************************************************************************
+Description.: fills in the format of the recording
+Input Value.: * s.......: the replayed session
+              * fmt.....: the format to fill in
+Return Value: -
+******************************************************************************/
+static void replay_format(session *s, struct v4l2_format *fmt)
+{
+    memset(&fmt->fmt.pix, 0, sizeof(struct v4l2_pix_format));
+    fmt->fmt.pix.width = s->format.width;
+    fmt->fmt.pix.height = s->format.height;
+    fmt->fmt.pix.pixelformat = s->format.pixelformat;
+    fmt->fmt.pix.field = V4L2_FIELD_NONE;
+    fmt->fmt.pix.sizeimage = s->format.sizeimage;
+    if(s->format.pixelformat != V4L2_PIX_FMT_MJPEG)
+        fmt->fmt.pix.bytesperline = s->format.width * 2;
+    fmt->fmt.pix.colorspace = V4L2_COLORSPACE_SRGB;
+}
+
+/******************************************************************************
+Description.: emulates the ioctls input_uvc uses on a capture device
+Input Value.: * s.......: the replayed session
+              * request.: the ioctl
+              * arg.....: its argument
+Return Value: 0 if everything is OK, -1 with errno set otherwise
+******************************************************************************/
+static int replay_ioctl(session *s, unsigned int request, void *arg)
+{
+    struct v4l2_capability *cap = arg;
+    struct v4l2_input *in = arg;
+    struct v4l2_format *fmt = arg;
+    struct v4l2_fmtdesc *fmtdesc = arg;
+    struct v4l2_frmsizeenum *frmsize = arg;
+    struct v4l2_streamparm *parm = arg;
+    struct v4l2_requestbuffers *rb = arg;
+    struct v4l2_buffer *buf = arg;
+    struct pollfd pfd;
+    int i, index, ret = 0, err = 0;
+
+    pthread_mutex_lock(&s->mutex);
+
+    switch(request) {
+    case VIDIOC_QUERYCAP:
+        memset(cap, 0, sizeof(struct v4l2_capability));
+        snprintf((char *)cap->driver, sizeof(cap->driver), "uvc_replay");
+        snprintf((char *)cap->card, sizeof(cap->card), "Replayed recording");
+        snprintf((char *)cap->bus_info, sizeof(cap->bus_info), "replay");
+        cap->device_caps = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+        cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+        break;
+
+    case VIDIOC_ENUMINPUT:
+        if(in->index != 0) {
+            err = EINVAL;
+            break;
+        }
+        memset(in, 0, sizeof(struct v4l2_input));
+        snprintf((char *)in->name, sizeof(in->name), "Replay");
+        in->type = V4L2_INPUT_TYPE_CAMERA;
+        break;
+
+    case VIDIOC_G_FMT:
+    case VIDIOC_S_FMT:
+    case VIDIOC_TRY_FMT:
+        if(fmt->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            err = EINVAL;
+            break;
+        }
+        if(request == VIDIOC_S_FMT && s->count > 0) {
+            err = EBUSY;
+            break;
+        }
+        replay_format(s, fmt);
+        break;
+
+    case VIDIOC_ENUM_FMT:
+        if(fmtdesc->index != 0 || fmtdesc->type != V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+            err = EINVAL;
+            break;
+        }
+        memset(fmtdesc->description, 0, sizeof(fmtdesc->description));
+        snprintf((char *)fmtdesc->description, sizeof(fmtdesc->description), "Replayed %.4s", (char *)&s->format.pixelformat);
+        fmtdesc->pixelformat = s->format.pixelformat;
+        fmtdesc->flags = (s->format.pixelformat == V4L2_PIX_FMT_MJPEG) ? V4L2_FMT_FLAG_COMPRESSED : 0;
+        break;
+
+    case VIDIOC_ENUM_FRAMESIZES:
+        if(frmsize->index != 0 || frmsize->pixel_format != s->format.pixelformat) {
+            err = EINVAL;
+            break;
+        }
+        frmsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+        frmsize->discrete.width = s->format.width;
+        frmsize->discrete.height = s->format.height;
+        break;
+
+    case VIDIOC_G_PARM:
+        /* the timing is the recording's, frame rates get dropped to in software */
+        memset(&parm->parm, 0, sizeof(parm->parm));
+        break;
+
+    case VIDIOC_REQBUFS:
+        if(rb->memory != V4L2_MEMORY_MMAP) {
+            err = EINVAL;
+            break;
+        }
+        if(s->streaming) {
+            err = EBUSY;
+            break;
+        }
+        s->count = rb->count = MIN(rb->count, MAX_BUFFERS);
+        s->queued = s->ready = 0;
+        memset(s->mem, 0, sizeof(s->mem));
+        break;
+
+    case VIDIOC_QUERYBUF:
+        if(buf->index >= (unsigned int)s->count) {
+            err = EINVAL;
+            break;
+        }
+        buf->length = s->length;
+        buf->m.offset = buf->index * s->length;
+        buf->flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+        break;
+
+    case VIDIOC_QBUF:
+        index = buf->index;
+        if(index >= s->count) {
+            err = EINVAL;
+            break;
+        }
+        for(i = 0; i < s->queued; i++)
+            if(s->queue[i] == index)
+                err = EINVAL;
+        for(i = 0; i < s->ready; i++)
+            if(s->done[i] == index)
+                err = EINVAL;
+        if(err)
+            break;
+        s->queue[s->queued++] = index;
+        replay_capture(s);
+        break;
+
+    case VIDIOC_DQBUF:
+        while(1) {
+            replay_capture(s);
+            if(s->ready > 0) {
+                *buf = s->filled[s->done[0]];
+                memmove(s->done, s->done + 1, --s->ready * sizeof(int));
+                replay_arm(s);
+                break;
+            }
+            if(!s->streaming) {
+                err = EINVAL;
+                break;
+            }
+
+            /* block like a driver until the next frame got captured */
+            pthread_mutex_unlock(&s->mutex);
+            pfd.fd = s->fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, -1);
+            pthread_mutex_lock(&s->mutex);
+        }
+        break;
+
+    case VIDIOC_STREAMON:
+        if(!s->streaming) {
+            s->streaming = 1;
+            s->start = now_ns() - (unsigned long long)(s->frames[s->next].at / (s->speed > 0 ? s->speed : 1));
+            replay_capture(s);
+        }
+        break;
+
+    case VIDIOC_STREAMOFF:
+        s->streaming = 0;
+        s->queued = s->ready = 0;
+        replay_arm(s);
+        break;
+
+    case VIDIOC_QUERYCTRL:
+    case VIDIOC_QUERYMENU:
+    case VIDIOC_G_CTRL:
+    case VIDIOC_S_CTRL:
+    case VIDIOC_G_EXT_CTRLS:
+    case VIDIOC_S_EXT_CTRLS:
+        err = EINVAL;
+        break;
+
+    default:
+        err = ENOTTY;
+        break;
+    }
+
+    pthread_mutex_unlock(&s->mutex);
+
+    if(err) {
+        errno = err;
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/******************************************************************************
+Description.: opens a recording to be replayed instead of a capture device,
+              only the frames of its first format get served
+Input Value.: * file....: the recording
+              * speed...: 1 for the original timing, 2 for twice as fast and
+                          so on, 0 to serve frames as fast as buffers get queued
+              * stamp...: draw a frame stamp into every served raw picture
+Return Value: the descriptor standing in for the device, -1 on error
+******************************************************************************/
+int replay_open(const char *file, double speed, int stamp)
+{
+    struct stat st;
+    replay_frame *frames = NULL, *frame;
+    unsigned char *data;
+    unsigned long long first = 0, last = 0, at;
+    size_t pos, length = 0;
+    long page = sysconf(_SC_PAGESIZE);
+    struct record_header header, format;
+    int fd, i, count = 0, allocated = 0, have_format = 0;
+    session *s;
+
+    memset(&header, 0, sizeof(struct record_header));
+    memset(&format, 0, sizeof(struct record_header));
+
+    if((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror("Unable to open the recording");
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    data = (st.st_size > 0) ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if(data == MAP_FAILED || (size_t)st.st_size < strlen(RECORD_MAGIC) ||
+       memcmp(data, RECORD_MAGIC, strlen(RECORD_MAGIC)) != 0) {
+        fprintf(stderr, "%s is no recording\n", file);
+        goto err;
+    }
+
+    for(pos = strlen(RECORD_MAGIC); pos + sizeof(struct record_header) <= (size_t)st.st_size;) {
+        memcpy(&header, data + pos, sizeof(struct record_header));
+        pos += sizeof(struct record_header);
+
+        if(header.type == RECORD_FORMAT) {
+            if(have_format && (header.pixelformat != format.pixelformat ||
+                               header.width != format.width || header.height != format.height))
+                break;
+            format = header;
+            have_format = 1;
+        } else if(header.type == RECORD_BUFFER) {
+            if(header.bytesused > st.st_size - pos)
+                break;
+            if(have_format && header.bytesused > 0) {
+                if(count == allocated) {
+                    allocated = allocated ? 2 * allocated : 64;
+                    if((frame = realloc(frames, allocated * sizeof(replay_frame))) == NULL)
+                        goto err;
+                    frames = frame;
+                }
+
+                /* the capture times must not go back */
+                at = header.sec * 1000000000ULL + header.usec * 1000ULL;
+                if(count == 0)
+                    first = last = at;
+                last = MAX(at, last);
+
+                frame = &frames[count++];
+                frame->header = header;
+                frame->data = data + pos;
+                frame->at = last - first;
+                length = MAX(length, header.bytesused);
+            }
+            pos += header.bytesused;
+        } else {
+            break;
+        }
+    }
+
+    if(count == 0) {
+        fprintf(stderr, "%s contains no frames\n", file);
+        goto err;
+    }
+
+    if(stamp && frame_stamp_rows(format.width, format.height) < 0) {
+        fprintf(stderr, "%s: a frame stamp does not fit a %ux%u picture\n", file, format.width, format.height);
+        stamp = 0;
+    } else if(stamp && format.pixelformat == V4L2_PIX_FMT_MJPEG) {
+        fprintf(stderr, "%s holds compressed pictures, they get replayed without frame stamps\n", file);
+        stamp = 0;
+    }
+
+    if((fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+        perror("Unable to create the replay timer");
+        goto err;
+    }
+    if((s = session_new(fd)) == NULL) {
+        fprintf(stderr, "Unable to replay %s, too many devices\n", file);
+        close(fd);
+        goto err;
+    }
+
+    s->replay = 1;
+    s->data = data;
+    s->size = st.st_size;
+    s->format = format;
+    s->frames = frames;
+    s->frame_count = count;
+    s->speed = MAX(speed, 0);
+    s->stamp = stamp;
+    length = MAX(length, format.sizeimage);
+    s->length = (length + page - 1) / page * page;
+
+    /* without distinct capture times the frames get replayed at 30 fps */
+    if(last == first) {
+        for(i = 0; i < count; i++)
+            frames[i].at = i * (1000000000ULL / 30);
+        last = first + frames[count - 1].at;
+    }
+
+    /* a pass lasts one mean frame interval longer than from first to last frame */
+    if(count > 1)
+        s->period = (last - first) * count / (count - 1);
+    else
+        s->period = 1000000000ULL / 30;
+
+    return fd;
+
+err:
+    free(frames);
+    if(data != MAP_FAILED)
+        munmap(data, st.st_size);
+    return -1;
+}
+
+/******************************************************************************
+Description.: ioctl on a capture device, replayed devices get emulated and
+              recorded ones note the formats and buffers
+Input Value.: * fd......: the device
+              * request.: the ioctl
+              * arg.....: its argument
+Return Value: like ioctl()
+******************************************************************************/
+int backend_ioctl(int fd, unsigned int request, void *arg)
+{
+    session *s = session_find(fd);
+    int ret;
+
+    if(s != NULL && s->replay)
+        return replay_ioctl(s, request, arg);
+
+    ret = DEVICE_IOCTL(fd, request, arg);
+    if(ret == 0 && s != NULL)
+        record_ioctl(s, request, arg);
+
+    return ret;
+}
+
+/******************************************************************************
+Description.: maps a capture buffer, a replayed device hands out anonymous
+              memory the frames get copied to
+Input Value.: * length..: of the buffer
+              * fd......: the device
+              * offset..: of the buffer as told by VIDIOC_QUERYBUF
+Return Value: like mmap()
+******************************************************************************/
+void *backend_mmap(size_t length, int fd, off_t offset)
+{
+    session *s = session_find(fd);
+    void *mem;
+    int i;
+
+    if(s == NULL)
+        return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+
+    pthread_mutex_lock(&s->mutex);
+    if(s->replay) {
+        i = offset / s->length;
+        if(offset % s->length != 0 || i >= s->count || length > s->length) {
+            errno = EINVAL;
+            mem = MAP_FAILED;
+        } else {
+            mem = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            s->mem[i] = (mem == MAP_FAILED) ? NULL : mem;
+        }
+    } else {
+        mem = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+        for(i = 0; i < MAX_BUFFERS && mem != MAP_FAILED; i++)
+            if(s->offsets[i] == offset)
+                s->mem[i] = mem;
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    return mem;
+}
+
+/******************************************************************************
+Description.: closes a capture device and ends its recording or replay
+Input Value.: the device
+Return Value: like close()
+******************************************************************************/
+int backend_close(int fd)
+{
+    session *s = session_find(fd);
+    int replay;
+
+    if(s == NULL)
+        return DEVICE_CLOSE(fd);
+
+    if(s->file != NULL)
+        fclose(s->file);
+    free(s->frames);
+    if(s->data != NULL)
+        munmap(s->data, s->size);
+    pthread_mutex_destroy(&s->mutex);
+    replay = s->replay;
+
+    pthread_mutex_lock(&sessions_mutex);
+    s->used = 0;
+    pthread_mutex_unlock(&sessions_mutex);
+
+    return replay ? close(fd) : DEVICE_CLOSE(fd);
+}
@@ -0,0 +1,60 @@
+/*******************************************************************************
+# Linux-UVC streaming input-plugin for MJPG-streamer                           #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Every access to a capture device passes this layer. Descriptors of plain
+ * devices go straight to V4L2, a recorded device additionally writes every
+ * dequeued buffer to a file and a replayed one is no device at all but
+ * serves such a recording through the same ioctls.
+ */
+
+/* first bytes of a recording */
+#define RECORD_MAGIC "UVCREC01"
+
+typedef enum {
+    RECORD_FORMAT = 1,      /* the format VIDIOC_S_FMT settled on */
+    RECORD_BUFFER = 2       /* a dequeued buffer, its bytes follow the header */
+} record_type;
+
+/* header of every record after the magic, fields in host byte order */
+struct record_header {
+    uint32_t type;
+    uint32_t pixelformat;   // format records
+    uint32_t width;
+    uint32_t height;
+    uint32_t sizeimage;
+    uint32_t bytesused;     // buffer records
+    int64_t sec;            // capture time of the buffer
+    int64_t usec;
+};
+
+int backend_ioctl(int fd, unsigned int request, void *arg);
+void *backend_mmap(size_t length, int fd, off_t offset);
+int backend_close(int fd);
+
+int record_open(int fd, const char *file, int append);
+int replay_open(const char *file, double speed, int stamp);
+
+#endif
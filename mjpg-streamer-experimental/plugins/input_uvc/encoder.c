@@ -0,0 +1,286 @@
+/*******************************************************************************
+# Linux-UVC streaming input-plugin for MJPG-streamer                           #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <syslog.h>
+
+#include "v4l2uvc.h"
+#include "../jpeg_utils.h"
+#include "encoder.h"
+
+/******************************************************************************
+Description.: Publishes the encoded jobs, the pool mutex must be locked.
+              In capture order only the job that is next in line may be
+              published, with the latency order every job that is newer
+              than the last published one.
+Input Value.: the encoder pool
+Return Value: -
+******************************************************************************/
+static void encoder_publish(encoder_pool *pool)
+{
+    encoder_job *job;
+    int i, found = 1;
+
+    while(found) {
+        found = 0;
+
+        for(i = 0; i < pool->job_count; i++) {
+            job = &pool->jobs[i];
+            if(job->state != JOB_DONE)
+                continue;
+
+            if(pool->order == ENCODE_ORDER_CAPTURE && job->seq != pool->next_publish)
+                continue;
+
+            if((int)(job->seq - pool->next_publish) >= 0 && job->frame != NULL && job->frame->size > 0) {
+                input_frame_publish(pool->in, job->frame);
+            } else {
+                DBG("dropping frame %u, it was encoded too late\n", job->seq);
+                metric_add(pool->in->metrics.dropped, 1);
+                input_frame_release(job->frame);
+            }
+
+            if((int)(job->seq - pool->next_publish) >= 0)
+                pool->next_publish = job->seq + 1;
+
+            job->frame = NULL;
+            job->state = JOB_FREE;
+            found = 1;
+        }
+    }
+
+    pthread_cond_broadcast(&pool->freed);
+}
+
+/******************************************************************************
+Description.: encoder thread, compresses queued jobs, oldest first, with
+              a JPEG encoder of its own
+Input Value.: the encoder pool
+Return Value: always NULL
+******************************************************************************/
+static void *encoder_thread(void *arg)
+{
+    encoder_pool *pool = arg;
+    encoder_job *job;
+    input_frame *frame;
+    jpeg_encoder *jpeg = jpeg_encoder_new(pool->stripes);
+    struct timespec start;
+    int i;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    while(!pool->stop) {
+        job = NULL;
+        for(i = 0; i < pool->job_count; i++) {
+            if(pool->jobs[i].state == JOB_QUEUED &&
+               (job == NULL || (int)(pool->jobs[i].seq - job->seq) < 0))
+                job = &pool->jobs[i];
+        }
+
+        if(job == NULL) {
+            pthread_cond_wait(&pool->queued, &pool->mutex);
+            continue;
+        }
+
+        job->state = JOB_ENCODING;
+        pthread_mutex_unlock(&pool->mutex);
+
+        /* compress into a private frame of the ring */
+        frame = input_frame_get(pool->in, pool->framesize);
+        if(frame != NULL) {
+            frame->size = 0;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if(jpeg != NULL)
+                frame->size = jpeg_encoder_compress(jpeg, job->raw, pool->width, pool->height, pool->format, pool->chroma,
+                                                    frame->buf, pool->framesize, pool->quality);
+            if(frame->size > 0) {
+                metric_observe_since(pool->in->metrics.encode_time, &start);
+                metric_add(pool->in->metrics.encoded, 1);
+            }
+            frame->timestamp = job->timestamp;
+            frame->captured = job->captured;
+            gettimeofday(&frame->encoded, NULL);
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        job->frame = frame;
+        job->state = JOB_DONE;
+        encoder_publish(pool);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+    jpeg_encoder_free(jpeg);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: prepares the pool and starts the encoder threads
+Input Value.: * pool...: the pool to initialize
+              * in.....: the input plugin the frames get published to
+              * threads: number of encoder threads
+              * order..: order the frames get published in
+              * width, height, format (V4L2_PIX_FMT_*) and size of the raw pictures
+              * chroma.: JPEG chroma subsampling of YUYV/UYVY
+              * stripes: stripes every encoder splits a picture into
+              * quality: JPEG quality
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
+int encoder_pool_init(encoder_pool *pool, input *in, int threads, encode_order order,
+                      int width, int height, int format, int chroma, int stripes, int framesize, int quality)
+{
+    int i;
+
+    memset(pool, 0, sizeof(encoder_pool));
+    pool->in = in;
+    pool->order = order;
+    pool->width = width;
+    pool->height = height;
+    pool->format = format;
+    pool->chroma = chroma;
+    pool->stripes = stripes;
+    pool->framesize = framesize;
+    pool->quality = quality;
+    pool->next_seq = 1;
+    pool->next_publish = 1;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pthread_cond_init(&pool->freed, NULL);
+
+    /* one picture per encoder plus as many being grabbed or waiting */
+    pool->job_count = 2 * threads;
+
+    /*
+     * every job may hold a frame while it gets encoded or waits to be
+     * published in order, the latest frame and the one being sent come on top
+     */
+    input_frame_ring_size(in, pool->job_count + 2);
+    for(i = 0; i < pool->job_count; i++) {
+        if((pool->jobs[i].raw = malloc(framesize)) == NULL)
+            goto err;
+        pool->jobs[i].state = JOB_FREE;
+    }
+
+    for(i = 0; i < threads; i++) {
+        if(pthread_create(&pool->threads[i], NULL, encoder_thread, pool) != 0)
+            goto err;
+        pool->thread_count++;
+    }
+
+    return 0;
+
+err:
+    encoder_pool_free(pool);
+    return -1;
+}
+
+/******************************************************************************
+Description.: unlocks the pool mutex if the camera thread gets cancelled
+Input Value.: the mutex
+Return Value: -
+******************************************************************************/
+static void encoder_pool_unlock(void *arg)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+/******************************************************************************
+Description.: Waits for a free job to grab the next raw picture into.
+Input Value.: the encoder pool
+Return Value: the job, its raw buffer can take a picture of the configured size
+******************************************************************************/
+encoder_job *encoder_pool_job(encoder_pool *pool)
+{
+    encoder_job *job = NULL;
+    int i;
+
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cleanup_push(encoder_pool_unlock, &pool->mutex);
+
+    while(job == NULL) {
+        for(i = 0; i < pool->job_count; i++) {
+            if(pool->jobs[i].state == JOB_FREE) {
+                job = &pool->jobs[i];
+                job->state = JOB_GRAB;
+                break;
+            }
+        }
+
+        if(job == NULL)
+            pthread_cond_wait(&pool->freed, &pool->mutex);
+    }
+
+    pthread_cleanup_pop(1);
+
+    return job;
+}
+
+/******************************************************************************
+Description.: queues a grabbed picture for compression
+Input Value.: * pool...: the encoder pool
+              * job....: job obtained by encoder_pool_job()
+              * timestamp: capture time of the picture
+              * captured: wall clock time it was grabbed
+Return Value: -
+******************************************************************************/
+void encoder_pool_submit(encoder_pool *pool, encoder_job *job, struct timeval timestamp, struct timeval captured)
+{
+    pthread_mutex_lock(&pool->mutex);
+    job->timestamp = timestamp;
+    job->captured = captured;
+    job->seq = pool->next_seq++;
+    job->state = JOB_QUEUED;
+    pthread_cond_signal(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/******************************************************************************
+Description.: stops the encoder threads and frees all jobs
+Input Value.: the encoder pool
+Return Value: -
+******************************************************************************/
+void encoder_pool_free(encoder_pool *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+    pool->thread_count = 0;
+
+    for(i = 0; i < pool->job_count; i++) {
+        input_frame_release(pool->jobs[i].frame);
+        pool->jobs[i].frame = NULL;
+        free(pool->jobs[i].raw);
+        pool->jobs[i].raw = NULL;
+    }
+    pool->job_count = 0;
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->queued);
+    pthread_cond_destroy(&pool->freed);
+}
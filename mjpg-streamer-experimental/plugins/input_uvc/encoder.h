@@ -0,0 +1,85 @@
+/*******************************************************************************
+# Linux-UVC streaming input-plugin for MJPG-streamer                           #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "../../mjpg_streamer.h"
+
+/* maximum number of encoder threads of one camera */
+#define MAX_ENCODERS 16
+
+/* in which order the encoded frames get published */
+typedef enum {
+    ENCODE_ORDER_CAPTURE,   /* strictly in capture order, waits for slow encoders */
+    ENCODE_ORDER_LATENCY    /* as soon as they are done, older frames get dropped */
+} encode_order;
+
+typedef enum {
+    JOB_FREE,               /* raw buffer is unused */
+    JOB_GRAB,               /* handed to the camera thread to grab into */
+    JOB_QUEUED,             /* waiting for an encoder */
+    JOB_ENCODING,
+    JOB_DONE                /* encoded, waiting to get published */
+} job_state;
+
+/* one raw picture on its way through the pool */
+typedef struct {
+    unsigned char *raw;
+    struct timeval timestamp;
+    struct timeval captured;    /* wall clock time of the grab */
+    unsigned int seq;       /* capture order */
+    input_frame *frame;     /* the compressed picture */
+    job_state state;
+} encoder_job;
+
+/*
+ * The camera thread grabs raw pictures into the jobs of the pool, the
+ * encoder threads compress them in parallel and publish the results.
+ */
+typedef struct {
+    input *in;
+    int width, height, format, chroma, stripes, framesize, quality;
+    encode_order order;
+
+    pthread_t threads[MAX_ENCODERS];
+    int thread_count;
+
+    encoder_job jobs[2 * MAX_ENCODERS];
+    int job_count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t queued;  /* a job waits for an encoder */
+    pthread_cond_t freed;   /* a job got free again */
+
+    unsigned int next_seq;      /* sequence number of the next grabbed picture */
+    unsigned int next_publish;  /* sequence number to publish next */
+    int stop;
+} encoder_pool;
+
+int encoder_pool_init(encoder_pool *pool, input *in, int threads, encode_order order,
+                      int width, int height, int format, int chroma, int stripes, int framesize, int quality);
+encoder_job *encoder_pool_job(encoder_pool *pool);
+void encoder_pool_submit(encoder_pool *pool, encoder_job *job, struct timeval timestamp, struct timeval captured);
+void encoder_pool_free(encoder_pool *pool);
+
+#endif
@@ -37,6 +37,8 @@
 #include <getopt.h>
 #include <pthread.h>
 #include <syslog.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
@@ -45,7 +47,7 @@
 #include "v4l2uvc.h" // this header will includes the ../../mjpg_streamer.h
 
 #ifndef NO_LIBJPEG
-    #include "jpeg_utils.h"
+    #include "../jpeg_utils.h"
     #include "huffman.h"
 #endif
 
@@ -92,6 +94,9 @@ static const struct {
 
 void *cam_thread(void *);
 void cam_cleanup(void *);
+static int cam_group_add(cam_group *group, context *cam);
+static int cam_group_run(cam_group *group);
+static void cam_group_stop(cam_group *group);
 void help(void);
 int input_cmd(int plugin, unsigned int control, unsigned int group, int value, char *value_string);
 
@@ -131,10 +136,15 @@ Return Value: 0 if everything is fine
 ******************************************************************************/
 int input_init(input_parameter *param, int id)
 {
-    char *dev = "/dev/video0", *s;
+    char *devs[MAX_INPUT_PLUGINS] = {"/dev/video0"}, *s, *record = NULL;
+    int replays[MAX_INPUT_PLUGINS] = {0};
+    double speed = 1;
+    int stamp = 0;
     int width = 640, height = 480, fps = -1, format = V4L2_PIX_FMT_MJPEG, i;
+    int buffers = NB_BUFFER, zerocopy = 1, validate = 1, drain = 0;
+    int devcount = 0, workers = 2, k, slot;
     v4l2_std_id tvnorm = V4L2_STD_UNKNOWN;
-    context *pctx;
+    context *pctx, *cam;
     context_settings *settings;
     
     pctx = calloc(1, sizeof(context));
@@ -144,11 +154,16 @@ int input_init(input_parameter *param, int id)
     }
     
     settings = pctx->init_settings = init_settings();
+    #ifndef NO_LIBJPEG
+    pctx->chroma = JPEG_CHROMA_420;
+    pctx->stripes = 1;
+    #endif
     pglobal = param->global;
     pglobal->in[id].context = pctx;
 
     /* initialize the mutes variable */
-    if(pthread_mutex_init(&pctx->controls_mutex, NULL) != 0) {
+    if(pthread_mutex_init(&pctx->controls_mutex, NULL) != 0 ||
+       pthread_mutex_init(&pctx->grab_mutex, NULL) != 0) {
         IPRINT("could not initialize mutex variable\n");
         exit(EXIT_FAILURE);
     }
@@ -205,6 +220,19 @@ int input_init(input_parameter *param, int id)
             {"gain", required_argument, 0, 0},
             {"cagc", required_argument, 0, 0},
             {"cb", required_argument, 0, 0},
+            {"encoders", required_argument, 0, 0},
+            {"encode_order", required_argument, 0, 0},
+            {"chroma", required_argument, 0, 0},
+            {"stripes", required_argument, 0, 0},
+            {"buffers", required_argument, 0, 0},
+            {"no_zerocopy", no_argument, 0, 0},
+            {"no_validate", no_argument, 0, 0},
+            {"latency", required_argument, 0, 0},
+            {"workers", required_argument, 0, 0},
+            {"record", required_argument, 0, 0},
+            {"replay", required_argument, 0, 0},
+            {"replay_speed", required_argument, 0, 0},
+            {"replay_stamp", no_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -234,7 +262,11 @@ int input_init(input_parameter *param, int id)
         case 2:
         case 3:
             DBG("case 2,3\n");
-            dev = canonicalize_file_name(optarg);
+            if(devcount >= MAX_INPUT_PLUGINS) {
+                fprintf(stderr, "too many devices, at most %d are supported\n", MAX_INPUT_PLUGINS);
+                exit(EXIT_FAILURE);
+            }
+            devs[devcount++] = canonicalize_file_name(optarg);
             break;
 
         /* r, resolution */
@@ -361,6 +393,114 @@ int input_init(input_parameter *param, int id)
             break;
         OPTION_INT_AUTO(38, cb)
             break;
+
+        /* encoders */
+        case 39:
+            DBG("case 39\n");
+            pctx->encoders = MIN(MAX(atoi(optarg), 0), MAX_ENCODERS);
+            break;
+
+        /* encode_order */
+        case 40:
+            DBG("case 40\n");
+            if(strcasecmp(optarg, "capture") == 0) {
+                pctx->encode_order = ENCODE_ORDER_CAPTURE;
+            } else if(strcasecmp(optarg, "latency") == 0) {
+                pctx->encode_order = ENCODE_ORDER_LATENCY;
+            } else {
+                fprintf(stderr, "Invalid value '%s' for -encode_order (capture or latency)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        /* chroma */
+        case 41:
+            DBG("case 41\n");
+            #ifndef NO_LIBJPEG
+            if(strcmp(optarg, "420") == 0) {
+                pctx->chroma = JPEG_CHROMA_420;
+            } else if(strcmp(optarg, "422") == 0) {
+                pctx->chroma = JPEG_CHROMA_422;
+            } else {
+                fprintf(stderr, "Invalid value '%s' for -chroma (420 or 422)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            #endif
+            break;
+
+        /* stripes */
+        case 42:
+            DBG("case 42\n");
+            #ifndef NO_LIBJPEG
+            pctx->stripes = MIN(MAX(atoi(optarg), 1), JPEG_MAX_STRIPES);
+            #endif
+            break;
+
+        /* buffers */
+        case 43:
+            DBG("case 43\n");
+            buffers = MIN(MAX(atoi(optarg), 2), MAX_BUFFERS);
+            break;
+
+        /* no_zerocopy */
+        case 44:
+            DBG("case 44\n");
+            zerocopy = 0;
+            break;
+
+        /* no_validate */
+        case 45:
+            DBG("case 45\n");
+            validate = 0;
+            break;
+
+        /* latency */
+        case 46:
+            DBG("case 46\n");
+            if(strcasecmp(optarg, "low") == 0) {
+                drain = 1;
+            } else if(strcasecmp(optarg, "normal") == 0) {
+                drain = 0;
+            } else {
+                fprintf(stderr, "Invalid value '%s' for -latency (normal or low)\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+
+        /* workers */
+        case 47:
+            DBG("case 47\n");
+            workers = MIN(MAX(atoi(optarg), 1), MAX_CAPTURE_WORKERS);
+            break;
+
+        /* record */
+        case 48:
+            DBG("case 48\n");
+            record = strdup(optarg);
+            break;
+
+        /* replay */
+        case 49:
+            DBG("case 49\n");
+            if(devcount >= MAX_INPUT_PLUGINS) {
+                fprintf(stderr, "too many devices, at most %d are supported\n", MAX_INPUT_PLUGINS);
+                exit(EXIT_FAILURE);
+            }
+            replays[devcount] = 1;
+            devs[devcount++] = strdup(optarg);
+            break;
+
+        /* replay_speed */
+        case 50:
+            DBG("case 50\n");
+            speed = MAX(strtod(optarg, NULL), 0);
+            break;
+
+        /* replay_stamp */
+        case 51:
+            DBG("case 51\n");
+            stamp = 1;
+            break;
     
         default:
             DBG("default case\n");
@@ -371,16 +511,25 @@ int input_init(input_parameter *param, int id)
     DBG("input id: %d\n", id);
     pctx->id = id;
     pctx->pglobal = param->global;
+    if(devcount == 0)
+        devcount = 1;
 
-    /* allocate webcam datastructure */
-    pctx->videoIn = calloc(1, sizeof(struct vdIn));
-    if(pctx->videoIn == NULL) {
-        IPRINT("not enough memory for videoIn\n");
-        exit(EXIT_FAILURE);
+    /* several cameras share a few capture threads */
+    if(devcount > 1) {
+        pctx->group = calloc(1, sizeof(cam_group));
+        if(pctx->group == NULL) {
+            IPRINT("error allocating context");
+            exit(EXIT_FAILURE);
+        }
+        pctx->group->epfd = -1;
+        pctx->group->wake_fd = -1;
+        pctx->group->workers = MIN(workers, devcount);
+        pthread_mutex_init(&pctx->group->mutex, NULL);
     }
-    
+
     /* display the parsed values */
-    IPRINT("Using V4L2 device.: %s\n", dev);
+    if(pctx->group != NULL)
+        IPRINT("Capture threads...: %d for %d devices\n", pctx->group->workers, devcount);
     IPRINT("Desired Resolution: %i x %i\n", width, height);
     IPRINT("Frames Per Second.: %i\n", fps);
     char *fmtString = NULL;
@@ -404,9 +553,26 @@ int input_init(input_parameter *param, int id)
     }
 
     IPRINT("Format............: %s\n", fmtString);
+    IPRINT("Capture buffers...: %d%s%s\n", buffers,
+           (format == V4L2_PIX_FMT_MJPEG && (!zerocopy || buffers <= MIN_QUEUED_BUFFERS)) ? ", frames get copied" : "",
+           drain ? ", low latency" : "");
+    /* a frame is only served from its buffer while MIN_QUEUED_BUFFERS stay queued */
+    if(format == V4L2_PIX_FMT_MJPEG && zerocopy && drain && buffers <= MIN_QUEUED_BUFFERS + 1)
+        IPRINT("Warning...........: with -latency low and %d buffers MJPEG frames %s get copied, "
+               "use -buffers %d or more for zerocopy\n", buffers,
+               (buffers <= MIN_QUEUED_BUFFERS) ? "always" : "mostly", MIN_QUEUED_BUFFERS + 2);
     #ifndef NO_LIBJPEG
-        if(format != V4L2_PIX_FMT_MJPEG)
+        if(format != V4L2_PIX_FMT_MJPEG) {
             IPRINT("JPEG Quality......: %d\n", settings->quality);
+            if(pctx->encoders > 0) {
+                IPRINT("Encoder threads...: %d, publishing in %s order\n", pctx->encoders,
+                       (pctx->encode_order == ENCODE_ORDER_CAPTURE) ? "capture" : "latency");
+            }
+            if(format != V4L2_PIX_FMT_RGB565)
+                IPRINT("Chroma subsampling: 4:%s\n", (pctx->chroma == JPEG_CHROMA_422) ? "2:2" : "2:0");
+            if(pctx->stripes > 1)
+                IPRINT("Stripes per frame.: %d\n", pctx->stripes);
+        }
     #endif
 
     if (tvnorm != V4L2_STD_UNKNOWN) {
@@ -415,23 +581,88 @@ int input_init(input_parameter *param, int id)
         IPRINT("TV-Norm...........: DEFAULT\n");
     }
 
-    DBG("vdIn pn: %d\n", id);
-    /* open video device and prepare data structure */
-    if(init_videoIn(pctx->videoIn, dev, width, height, fps, format, 1, pctx->pglobal, id, tvnorm) < 0) {
-        IPRINT("init_VideoIn failed\n");
-        closelog();
-        exit(EXIT_FAILURE);
+    for(k = 0; k < devcount; k++) {
+        cam = pctx;
+        slot = id;
+
+        /* every further device is an input of its own for the output plugins */
+        if(k > 0) {
+            if((slot = input_slot_add(pglobal, id)) < 0) {
+                IPRINT("no input slot left for %s\n", devs[k]);
+                exit(EXIT_FAILURE);
+            }
+            cam = malloc(sizeof(context));
+            if(cam == NULL) {
+                IPRINT("error allocating context");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(cam, pctx, sizeof(context));
+            cam->id = slot;
+            cam->init_settings = init_settings();
+            memcpy(cam->init_settings, settings, sizeof(context_settings));
+            if(pthread_mutex_init(&cam->controls_mutex, NULL) != 0 ||
+               pthread_mutex_init(&cam->grab_mutex, NULL) != 0) {
+                IPRINT("could not initialize mutex variable\n");
+                exit(EXIT_FAILURE);
+            }
+            pglobal->in[slot].context = cam;
+        }
+        if(cam->group != NULL)
+            cam->group->cams[cam->group->count++] = cam;
+
+        /* allocate webcam datastructure */
+        cam->videoIn = calloc(1, sizeof(struct vdIn));
+        if(cam->videoIn == NULL) {
+            IPRINT("not enough memory for videoIn\n");
+            exit(EXIT_FAILURE);
+        }
+        cam->videoIn->nbuffers = buffers;
+        cam->videoIn->zerocopy = zerocopy;
+        cam->videoIn->validate = validate;
+        cam->videoIn->drain = drain;
+        cam->videoIn->replay = replays[k];
+        cam->videoIn->speed = speed;
+        cam->videoIn->stamp = stamp;
+
+        /* every further device records to a file of its own */
+        if(record != NULL && !replays[k]) {
+            if(k == 0) {
+                cam->videoIn->record = strdup(record);
+            } else if((cam->videoIn->record = malloc(strlen(record) + 8)) != NULL) {
+                sprintf(cam->videoIn->record, "%s.%d", record, k);
+            }
+        }
+
+        if(replays[k]) {
+            if(speed > 0) {
+                IPRINT("Replaying.........: %s at %gx speed (input %d)\n", devs[k], speed, slot);
+            } else {
+                IPRINT("Replaying.........: %s as fast as possible (input %d)\n", devs[k], slot);
+            }
+        } else {
+            IPRINT("Using V4L2 device.: %s (input %d)\n", devs[k], slot);
+        }
+        if(cam->videoIn->record != NULL)
+            IPRINT("Recording to......: %s\n", cam->videoIn->record);
+
+        DBG("vdIn pn: %d\n", slot);
+        /* open video device and prepare data structure */
+        if(init_videoIn(cam->videoIn, devs[k], width, height, fps, format, 1, pctx->pglobal, slot, tvnorm) < 0) {
+            IPRINT("init_VideoIn failed\n");
+            closelog();
+            exit(EXIT_FAILURE);
+        }
+        /*
+         * recent linux-uvc driver (revision > ~#125) requires to use dynctrls
+         * for pan/tilt/focus/...
+         * dynctrls must get initialized
+         */
+        if(dynctrls && !replays[k])
+            initDynCtrls(cam->videoIn->fd);
+
+        enumerateControls(cam->videoIn, pctx->pglobal, slot); // enumerate V4L2 controls after UVC extended mapping
     }
-    /*
-     * recent linux-uvc driver (revision > ~#125) requires to use dynctrls
-     * for pan/tilt/focus/...
-     * dynctrls must get initialized
-     */
-    if(dynctrls)
-        initDynCtrls(pctx->videoIn->fd);
-    
-    enumerateControls(pctx->videoIn, pctx->pglobal, id); // enumerate V4L2 controls after UVC extended mapping
-    
+
     return 0;
 }
 
@@ -444,7 +675,13 @@ int input_stop(int id)
 {
     input * in = &pglobal->in[id];
     context *pctx = (context*)in->context;
-    
+
+    if(pctx->group != NULL) {
+        DBG("will stop the capture threads of input #%02d\n", id);
+        cam_group_stop(pctx->group);
+        return 0;
+    }
+
     DBG("will cancel camera thread #%02d\n", id);
     pthread_cancel(pctx->threadID);
     return 0;
@@ -459,11 +696,10 @@ int input_run(int id)
 {
     input * in = &pglobal->in[id];
     context *pctx = (context*)in->context;
-    
-    in->buf = malloc(pctx->videoIn->framesizeIn);
-    if(in->buf == NULL) {
-        fprintf(stderr, "could not allocate memory\n");
-        exit(EXIT_FAILURE);
+
+    if(pctx->group != NULL) {
+        DBG("launching the capture threads of input #%02d\n", id);
+        return cam_group_run(pctx->group);
     }
 
     DBG("launching camera thread #%02d\n", id);
@@ -488,6 +724,8 @@ void help(void)
     " ---------------------------------------------------------------\n" \
     " The following parameters can be passed to this plugin:\n\n" \
     " [-d | --device ].......: video device to open (your camera)\n" \
+    "                          may be given several times, every device becomes\n" \
+    "                          an input of its own, numbered in order\n" \
     " [-r | --resolution ]...: the resolution of the video device,\n" \
     "                          can be one of the following strings:\n" \
     "                          ");
@@ -505,7 +743,38 @@ void help(void)
     " [-n | --no_dynctrl ]...: do not initalize dynctrls of Linux-UVC driver\n" \
     " [-l | --led ]..........: switch the LED \"on\", \"off\", let it \"blink\" or leave\n" \
     "                          it up to the driver using the value \"auto\"\n" \
-    " [-t | --tvnorm ] ......: set TV-Norm pal, ntsc or secam\n"
+    " [-t | --tvnorm ] ......: set TV-Norm pal, ntsc or secam\n" \
+    " [-encoders ]...........: number of threads compressing raw formats\n" \
+    "                          (YUYV, UYVY, RGB565) in parallel, 0 compresses\n" \
+    "                          in the camera thread (default)\n" \
+    " [-encode_order ].......: publish frames in \"capture\" order (default) or\n" \
+    "                          with lowest \"latency\", dropping late frames\n" \
+    " [-chroma ].............: chroma subsampling of compressed YUYV/UYVY frames,\n" \
+    "                          420 (default) or 422 for more color detail\n" \
+    " [-stripes ]............: compress every raw frame in this many stripes\n" \
+    "                          in parallel, lowers the latency of large frames\n" \
+    " [-buffers ]............: number of V4L2 capture buffers (default 4), MJPEG\n" \
+    "                          frames are served from them while 2 stay queued,\n" \
+    "                          with 3 they mostly get copied, below always\n" \
+    " [-no_zerocopy ]........: always copy MJPEG frames out of the capture buffers\n" \
+    " [-no_validate ]........: publish MJPEG frames without checking their JPEG\n" \
+    "                          structure, resolution and EOI first\n" \
+    " [-latency ]............: \"normal\" (default) or \"low\", which always serves\n" \
+    "                          the newest ready frame and skips stale ones,\n" \
+    "                          best combined with -buffers 4, with fewer buffers\n" \
+    "                          MJPEG frames get copied (see -buffers)\n" \
+    " [-workers ]............: number of threads capturing from several devices\n" \
+    "                          (default 2), encoder threads stay per device\n" \
+    " [-record ].............: write every dequeued buffer with its timestamp\n" \
+    "                          and the format to this file, further devices\n" \
+    "                          record to <file>.1, <file>.2, ...\n" \
+    " [-replay ].............: serve such a recording instead of a device, can\n" \
+    "                          be given several times like -d\n" \
+    " [-replay_speed ].......: 1 replays at the recorded timing (default), 2 twice\n" \
+    "                          as fast and so on, 0 as fast as frames get consumed\n" \
+    " [-replay_stamp ].......: draw a frame stamp with the sequence number and\n" \
+    "                          wall clock time into every replayed raw picture,\n" \
+    "                          for glass to glass latency measurements\n"
     " ---------------------------------------------------------------\n");
 
     fprintf(stderr, "\n"\
@@ -529,22 +798,20 @@ void help(void)
 }
 
 /******************************************************************************
-Description.: this thread worker grabs a frame and copies it to the global buffer
-Input Value.: unused
-Return Value: unused, always NULL
+Description.: applies the initial settings to the camera and sets up the
+              compression of raw formats, runs once before the first grab
+Input Value.: the input of the camera
+Return Value: -
 ******************************************************************************/
-void *cam_thread(void *arg)
+static void cam_prepare(input *in)
 {
-    input * in = (input*)arg;
     context *pcontext = (context*)in->context;
     context_settings *settings = pcontext->init_settings;
-    
-    unsigned int every_count = 0;
-    int quality = settings->quality;
-    
-    /* set cleanup handler to cleanup allocated resources */
-    pthread_cleanup_push(cam_cleanup, in);
-    
+
+    pcontext->quality = settings->quality;
+    pcontext->every_count = 0;
+    pcontext->last = 0;
+
     #define V4L_OPT_SET(vid, var, desc) \
       if (input_cmd(pcontext->id, vid, IN_CMD_V4L2, settings->var, NULL) != 0) {\
           fprintf(stderr, "Failed to set " desc "\n"); \
@@ -618,93 +885,323 @@ void *cam_thread(void *arg)
     settings = NULL;
     pcontext->init_settings = NULL;
 
-    while(!pglobal->stop) {
-        while(pcontext->videoIn->streamingState == STREAMING_PAUSED) {
-            usleep(1); // maybe not the best way so FIXME
-        }
-
-        /* grab a frame */
-        if(uvcGrab(pcontext->videoIn) < 0) {
-            IPRINT("Error grabbing frames\n");
+    #ifndef NO_LIBJPEG
+    /* compress raw formats in parallel, the camera thread only grabs */
+    if(pcontext->encoders > 0 &&
+       ((pcontext->videoIn->formatIn == V4L2_PIX_FMT_YUYV) ||
+        (pcontext->videoIn->formatIn == V4L2_PIX_FMT_UYVY) ||
+        (pcontext->videoIn->formatIn == V4L2_PIX_FMT_RGB565))) {
+        pcontext->encoder = calloc(1, sizeof(encoder_pool));
+        if(pcontext->encoder == NULL ||
+           encoder_pool_init(pcontext->encoder, in, pcontext->encoders, pcontext->encode_order,
+                             pcontext->videoIn->width, pcontext->videoIn->height,
+                             pcontext->videoIn->formatIn, pcontext->chroma, pcontext->stripes,
+                             pcontext->videoIn->framesizeIn, pcontext->quality) != 0) {
+            IPRINT("could not start the encoder threads\n");
             exit(EXIT_FAILURE);
         }
+        pcontext->framebuffer = pcontext->videoIn->framebuffer;
+    } else {
+        pcontext->jpeg = jpeg_encoder_new(pcontext->stripes);
+    }
+    #endif
+}
 
-        if ( every_count < every - 1 ) {
-            DBG("dropping %d frame for every=%d\n", every_count + 1, every);
-            ++every_count;
-            continue;
-        } else {
-            every_count = 0;
+/******************************************************************************
+Description.: grabs one frame of a camera, compresses or copies it as needed
+              and publishes it, unless it gets dropped
+Input Value.: * pcontext: the context of the camera
+              * publish.: 0 while nobody wants the frames, the frame only
+                          gets grabbed to keep the device running
+Return Value: 0 if everything is OK, -1 if the camera failed
+******************************************************************************/
+static int cam_grab(context *pcontext, int publish)
+{
+    input *in = &pglobal->in[pcontext->id];
+    input_frame *frame = NULL;
+    struct timespec start;
+    unsigned int drained;
+
+    #ifndef NO_LIBJPEG
+    /* grab straight into the raw buffer of a free encoder job */
+    if(pcontext->encoder != NULL && pcontext->job == NULL) {
+        pcontext->job = encoder_pool_job(pcontext->encoder);
+        pcontext->videoIn->framebuffer = pcontext->job->raw;
+    }
+    #endif
+
+    /* grab a frame */
+    if(uvcGrab(pcontext->videoIn) < 0)
+        return -1;
+
+    /* the stale frames the grab skipped were captured as well */
+    drained = pcontext->videoIn->drained - in->stats.drained;
+    metric_add(in->metrics.captured, 1 + drained);
+    metric_add(in->metrics.dropped, drained);
+
+    in->stats.queued = pcontext->videoIn->queued;
+    in->stats.drained = pcontext->videoIn->drained;
+    in->stats.age = pcontext->videoIn->age;
+
+    /* idle, the MJPEG buffer goes back with the next grab and the job gets reused */
+    if(!publish) {
+        metric_add(in->metrics.dropped, 1);
+        return 0;
+    }
+
+    if ( pcontext->every_count < every - 1 ) {
+        DBG("dropping %d frame for every=%d\n", pcontext->every_count + 1, every);
+        ++pcontext->every_count;
+        metric_add(in->metrics.dropped, 1);
+        return 0;
+    } else {
+        pcontext->every_count = 0;
+    }
+
+    //DBG("received frame of size: %d from plugin: %d\n", pcontext->videoIn->tmpbytesused, pcontext->id);
+
+    /*
+     * Workaround for broken, corrupted frames:
+     * Under low light conditions corrupted frames may get captured.
+     * The good thing is such frames are quite small compared to the regular pictures.
+     * For example a VGA (640x480) webcam picture is normally >= 8kByte large,
+     * corrupted frames are smaller.
+     */
+    if(pcontext->videoIn->tmpbytesused < minimum_size) {
+        DBG("dropping too small frame, assuming it as broken\n");
+        in->stats.rejected++;
+        metric_add(in->metrics.dropped, 1);
+        return 0;
+    }
+
+    // use software frame dropping on low fps
+    if (pcontext->videoIn->soft_framedrop == 1) {
+        unsigned long current = pcontext->videoIn->buf.timestamp.tv_sec * 1000 +
+                                pcontext->videoIn->buf.timestamp.tv_usec/1000; // convert to ms
+
+        // if the requested time did not esplashed skip the frame
+        if ((current - pcontext->last) < pcontext->videoIn->frame_period_time) {
+            //DBG("Last frame taken %d ms ago so drop it\n", (current - pcontext->last));
+            metric_add(in->metrics.dropped, 1);
+            return 0;
         }
+        DBG("Lagg: %ld\n", (current - pcontext->last) - pcontext->videoIn->frame_period_time);
+        pcontext->last = current;
+    }
 
-        //DBG("received frame of size: %d from plugin: %d\n", pcontext->videoIn->tmpbytesused, pcontext->id);
+    /* the consumers asked for fewer frames, drop it before it gets compressed */
+    if(!input_frame_due(in, &pcontext->videoIn->buf.timestamp))
+        return 0;
 
+    #ifndef NO_LIBJPEG
+    /* the encoder threads compress and publish it */
+    if(pcontext->encoder != NULL) {
+        encoder_pool_submit(pcontext->encoder, pcontext->job, pcontext->videoIn->buf.timestamp,
+                            pcontext->videoIn->captured);
+        pcontext->job = NULL;
+        return 0;
+    }
+    #endif
+
+    /*
+     * If capturing in YUV mode convert to JPEG now.
+     * This compression requires many CPU cycles, so try to avoid YUV format.
+     * Getting JPEGs straight from the webcam, is one of the major advantages of
+     * Linux-UVC compatible devices.
+     */
+    #ifndef NO_LIBJPEG
+    if ((pcontext->videoIn->formatIn == V4L2_PIX_FMT_YUYV) ||
+	    (pcontext->videoIn->formatIn == V4L2_PIX_FMT_UYVY) ||
+	    (pcontext->videoIn->formatIn == V4L2_PIX_FMT_RGB565) ) {
         /*
-         * Workaround for broken, corrupted frames:
-         * Under low light conditions corrupted frames may get captured.
-         * The good thing is such frames are quite small compared to the regular pictures.
-         * For example a VGA (640x480) webcam picture is normally >= 8kByte large,
-         * corrupted frames are smaller.
+         * get a free frame of the ring, readers keep using the older ones.
+         * Nobody else can see this frame until it is published, so it gets
+         * compressed without holding the mutex of the input.
          */
-        if(pcontext->videoIn->tmpbytesused < minimum_size) {
-            DBG("dropping too small frame, assuming it as broken\n");
-            continue;
+        frame = input_frame_get(in, pcontext->videoIn->framesizeIn);
+        if(frame == NULL) {
+            IPRINT("could not allocate memory\n");
+            exit(EXIT_FAILURE);
         }
 
-        // use software frame dropping on low fps
-        if (pcontext->videoIn->soft_framedrop == 1) {
-            unsigned long last = pglobal->in[pcontext->id].timestamp.tv_sec * 1000 +
-                                (pglobal->in[pcontext->id].timestamp.tv_usec/1000); // convert to ms
-            unsigned long current = pcontext->videoIn->buf.timestamp.tv_sec * 1000 +
-                                    pcontext->videoIn->buf.timestamp.tv_usec/1000; // convert to ms
-
-            // if the requested time did not esplashed skip the frame
-            if ((current - last) < pcontext->videoIn->frame_period_time) {
-                //DBG("Last frame taken %d ms ago so drop it\n", (current - last));
-                continue;
-            }
-            DBG("Lagg: %ld\n", (current - last) - pcontext->videoIn->frame_period_time);
+        DBG("compressing frame from input: %d\n", (int)pcontext->id);
+        frame->size = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if(pcontext->jpeg != NULL)
+            frame->size = jpeg_encoder_compress(pcontext->jpeg, pcontext->videoIn->framebuffer,
+                                                pcontext->videoIn->width, pcontext->videoIn->height,
+                                                pcontext->videoIn->formatIn, pcontext->chroma,
+                                                frame->buf, pcontext->videoIn->framesizeIn, pcontext->quality);
+        if(frame->size > 0) {
+            metric_observe_since(in->metrics.encode_time, &start);
+            metric_add(in->metrics.encoded, 1);
+        }
+        /* copy this frame's timestamp to user space */
+        frame->timestamp = pcontext->videoIn->buf.timestamp;
+        frame->captured = pcontext->videoIn->captured;
+        gettimeofday(&frame->encoded, NULL);
+    } else {
+    #endif
+        /* publish the capture buffer itself, or a copy of it */
+        frame = uvcFrame(pcontext->videoIn, in);
+        if(frame == NULL) {
+            metric_add(in->metrics.dropped, 1);
+            return 0;
         }
+    #ifndef NO_LIBJPEG
+    }
+    #endif
 
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&pglobal->in[pcontext->id].db);
+#if 0
+    /* motion detection can be done just by comparing the picture size, but it is not very accurate!! */
+    if((prev_size - global->size)*(prev_size - global->size) > 4 * 1024 * 1024) {
+        DBG("motion detected (delta: %d kB)\n", (prev_size - global->size) / 1024);
+    }
+    prev_size = global->size;
+#endif
 
-        /*
-         * If capturing in YUV mode convert to JPEG now.
-         * This compression requires many CPU cycles, so try to avoid YUV format.
-         * Getting JPEGs straight from the webcam, is one of the major advantages of
-         * Linux-UVC compatible devices.
-         */
-        #ifndef NO_LIBJPEG
-        if ((pcontext->videoIn->formatIn == V4L2_PIX_FMT_YUYV) ||
-	    (pcontext->videoIn->formatIn == V4L2_PIX_FMT_UYVY) ||
-	    (pcontext->videoIn->formatIn == V4L2_PIX_FMT_RGB565) ) {
-            DBG("compressing frame from input: %d\n", (int)pcontext->id);
-            pglobal->in[pcontext->id].size = compress_image_to_jpeg(pcontext->videoIn, pglobal->in[pcontext->id].buf, pcontext->videoIn->framesizeIn, quality);
-            /* copy this frame's timestamp to user space */
-            pglobal->in[pcontext->id].timestamp = pcontext->videoIn->buf.timestamp;
+    /* the compressed picture did not fit into the frame */
+    if(frame->size == 0) {
+        metric_add(in->metrics.dropped, 1);
+        input_frame_release(frame);
+        return 0;
+    }
+
+    /* make it the latest frame, this only swaps a pointer under the mutex */
+    input_frame_publish(in, frame);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: unlocks the grab mutex if a capture thread gets cancelled
+Input Value.: the mutex
+Return Value: -
+******************************************************************************/
+static void cam_unlock(void *arg)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+/******************************************************************************
+Description.: Grabs one frame of a camera while holding its grab mutex, so
+              cam_resolution() can not change the device meanwhile.
+Input Value.: * pcontext: the context of the camera
+              * publish.: see cam_grab()
+Return Value: 0 if everything is OK, 1 if the stream got paused meanwhile,
+              -1 if the camera failed
+******************************************************************************/
+static int cam_grab_locked(context *pcontext, int publish)
+{
+    int ret = 1;
+
+    pthread_mutex_lock(&pcontext->grab_mutex);
+    pthread_cleanup_push(cam_unlock, &pcontext->grab_mutex);
+
+    /* the resolution could not be changed while waiting for the mutex,
+     * a stream that is off gets turned on by uvcGrab() */
+    if(pcontext->videoIn->streamingState != STREAMING_PAUSED)
+        ret = cam_grab(pcontext, publish);
+
+    pthread_cleanup_pop(1);
+
+    return ret;
+}
+
+/******************************************************************************
+Description.: Changes the resolution of a camera. No capture thread is
+              inside cam_grab() meanwhile and the encoder threads get
+              started again for the new picture size.
+Input Value.: * pctx...: the camera
+              * width..: the new width
+              * height.: the new height
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
+static int cam_resolution(context *pctx, int width, int height)
+{
+    int ret;
+
+    pthread_mutex_lock(&pctx->grab_mutex);
+
+    /* the group must not turn the stream on or off meanwhile */
+    if(pctx->group != NULL) {
+        pthread_mutex_lock(&pctx->group->mutex);
+        epoll_ctl(pctx->group->epfd, EPOLL_CTL_DEL, pctx->videoIn->fd, NULL);
+    }
+
+    #ifndef NO_LIBJPEG
+    /* the raw buffers of the jobs have the old size */
+    if(pctx->encoder != NULL) {
+        encoder_pool_free(pctx->encoder);
+        pctx->videoIn->framebuffer = pctx->framebuffer;
+        pctx->job = NULL;
+    }
+    #endif
+
+    ret = setResolution(pctx->videoIn, width, height);
+
+    #ifndef NO_LIBJPEG
+    if(pctx->encoder != NULL) {
+        if(ret == 0 &&
+           encoder_pool_init(pctx->encoder, &pglobal->in[pctx->id], pctx->encoders, pctx->encode_order,
+                             pctx->videoIn->width, pctx->videoIn->height,
+                             pctx->videoIn->formatIn, pctx->chroma, pctx->stripes,
+                             pctx->videoIn->framesizeIn, pctx->quality) == 0) {
+            pctx->framebuffer = pctx->videoIn->framebuffer;
         } else {
-        #endif
-            DBG("copying frame from input: %d\n", (int)pcontext->id);
-            pglobal->in[pcontext->id].size = memcpy_picture(pglobal->in[pcontext->id].buf, pcontext->videoIn->tmpbuffer, pcontext->videoIn->tmpbytesused);
-            /* copy this frame's timestamp to user space */
-            pglobal->in[pcontext->id].timestamp = pcontext->videoIn->tmptimestamp;
-        #ifndef NO_LIBJPEG
+            IPRINT("could not restart the encoder threads, compressing in the capture thread\n");
+            free(pctx->encoder);
+            pctx->encoder = NULL;
+            pctx->jpeg = jpeg_encoder_new(pctx->stripes);
         }
-        #endif
+    }
+    #endif
 
-#if 0
-        /* motion detection can be done just by comparing the picture size, but it is not very accurate!! */
-        if((prev_size - global->size)*(prev_size - global->size) > 4 * 1024 * 1024) {
-            DBG("motion detected (delta: %d kB)\n", (prev_size - global->size) / 1024);
+    if(pctx->group != NULL) {
+        /* the device got reopened, the capture threads have to watch the new descriptor */
+        if(ret == 0) {
+            pctx->standby = 0;
+            ret = cam_group_add(pctx->group, pctx);
         }
-        prev_size = global->size;
-#endif
+        pthread_mutex_unlock(&pctx->group->mutex);
+    }
+
+    pthread_mutex_unlock(&pctx->grab_mutex);
+
+    return ret;
+}
+
+/******************************************************************************
+Description.: this thread worker grabs a frame and copies it to the global buffer
+Input Value.: unused
+Return Value: unused, always NULL
+******************************************************************************/
+void *cam_thread(void *arg)
+{
+    input * in = (input*)arg;
+    context *pcontext = (context*)in->context;
+    demand_state demand;
+
+    /* set cleanup handler to cleanup allocated resources */
+    pthread_cleanup_push(cam_cleanup, in);
 
+    cam_prepare(in);
+
+    while(!pglobal->stop) {
+        uvcWaitStream(pcontext->videoIn);
+
+        demand = input_demand(in);
+        if(demand == INPUT_STANDBY) {
+            DBG("nobody wants frames of input %d, turning the stream off\n", pcontext->id);
+            uvcStandby(pcontext->videoIn);
+            input_demand_wait(in);
+            continue;
+        }
 
-        /* signal fresh_frame */
-        pthread_cond_broadcast(&pglobal->in[pcontext->id].db_update);
-        pthread_mutex_unlock(&pglobal->in[pcontext->id].db);
+        if(cam_grab_locked(pcontext, demand == INPUT_ACTIVE) < 0) {
+            IPRINT("Error grabbing frames\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
     DBG("leaving input thread, calling cleanup function now\n");
@@ -713,6 +1210,222 @@ void *cam_thread(void *arg)
     return NULL;
 }
 
+/******************************************************************************
+Description.: (re)arms a camera of the group, one capture thread gets woken
+              up once it has a frame ready
+Input Value.: * group..: the camera group
+              * cam....: the camera, its stream must be on
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
+static int cam_group_add(cam_group *group, context *cam)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = cam;
+
+    if(epoll_ctl(group->epfd, EPOLL_CTL_MOD, cam->videoIn->fd, &ev) == 0)
+        return 0;
+    if(errno == ENOENT && epoll_ctl(group->epfd, EPOLL_CTL_ADD, cam->videoIn->fd, &ev) == 0)
+        return 0;
+
+    perror("Unable to add the camera to the capture group");
+    return -1;
+}
+
+/******************************************************************************
+Description.: Turns the stream of a camera off if nobody wants its frames,
+              it stays out of the group until cam_group_resume() takes it
+              back. The demand is checked again under the group mutex, so a
+              consumer attaching meanwhile can not get lost.
+Input Value.: * group..: the camera group
+              * cam....: the camera
+Return Value: 1 if the camera is in standby now, 0 otherwise
+******************************************************************************/
+static int cam_group_standby(cam_group *group, context *cam)
+{
+    pthread_mutex_lock(&group->mutex);
+    if(input_demand(&pglobal->in[cam->id]) == INPUT_STANDBY && uvcStandby(cam->videoIn) == 0) {
+        DBG("nobody wants frames of input %d, turning the stream off\n", cam->id);
+        cam->standby = 1;
+    }
+    pthread_mutex_unlock(&group->mutex);
+
+    return cam->standby;
+}
+
+/******************************************************************************
+Description.: turns the streams of all wanted cameras in standby on again
+              and adds them back to the group
+Input Value.: the camera group
+Return Value: -
+******************************************************************************/
+static void cam_group_resume(cam_group *group)
+{
+    uint64_t count;
+    int i;
+
+    if(read(group->wake_fd, &count, sizeof(count)) < 0)
+        return;
+
+    pthread_mutex_lock(&group->mutex);
+    for(i = 0; i < group->count; i++) {
+        if(!group->cams[i]->standby || input_demand(&pglobal->in[group->cams[i]->id]) == INPUT_STANDBY)
+            continue;
+
+        DBG("input %d is wanted again, turning the stream on\n", group->cams[i]->id);
+        group->cams[i]->standby = 0;
+        if(uvcStreamOn(group->cams[i]->videoIn) == 0)
+            cam_group_add(group, group->cams[i]);
+    }
+    pthread_mutex_unlock(&group->mutex);
+}
+
+/******************************************************************************
+Description.: resume hook of the inputs of a group, called by the core when
+              the first consumer attaches
+Input Value.: the input plugin
+Return Value: -
+******************************************************************************/
+static void cam_group_wake(input *in)
+{
+    context *cam = in->context;
+    uint64_t one = 1;
+
+    /* the camera may be going to standby right now, so always wake up */
+    if(cam->group->wake_fd >= 0 && write(cam->group->wake_fd, &one, sizeof(one)) < 0)
+        perror("Unable to wake up the capture threads");
+}
+
+/******************************************************************************
+Description.: capture thread of a camera group. It takes up to CAPTURE_BATCH
+              ready cameras per wakeup and grabs one frame of each, one-shot
+              events make sure no other thread serves the same camera until
+              it gets rearmed. A failing camera is left out, the others keep
+              running.
+Input Value.: the camera group
+Return Value: always NULL
+******************************************************************************/
+static void *cam_group_thread(void *arg)
+{
+    cam_group *group = arg;
+    struct epoll_event events[CAPTURE_BATCH];
+    demand_state demand;
+    context *cam;
+    int i, n, ret;
+
+    while(!pglobal->stop) {
+        n = epoll_wait(group->epfd, events, CAPTURE_BATCH, -1);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for(i = 0; i < n; i++) {
+            cam = events[i].data.ptr;
+
+            /* a camera in standby is wanted again */
+            if(cam == NULL) {
+                cam_group_resume(group);
+                continue;
+            }
+
+            /* cam_resolution() adds the camera again once it streams */
+            if(cam->videoIn->streamingState != STREAMING_ON)
+                continue;
+
+            demand = input_demand(&pglobal->in[cam->id]);
+            if(demand == INPUT_STANDBY && cam_group_standby(group, cam))
+                continue;
+
+            ret = cam_grab_locked(cam, demand == INPUT_ACTIVE);
+            if(ret < 0) {
+                IPRINT("Error grabbing frames from input %d, leaving it out\n", cam->id);
+                continue;
+            }
+
+            /* cam_resolution() already rearmed a reopened device */
+            if(ret == 0)
+                cam_group_add(group, cam);
+        }
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: prepares all cameras of the group, turns their streams on and
+              starts the capture threads
+Input Value.: the camera group
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
+static int cam_group_run(cam_group *group)
+{
+    struct epoll_event ev;
+    int i;
+
+    if((group->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("Unable to create the epoll instance");
+        return -1;
+    }
+
+    /* wakes up one of the threads to resume cameras in standby */
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if((group->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+       epoll_ctl(group->epfd, EPOLL_CTL_ADD, group->wake_fd, &ev) < 0) {
+        perror("Unable to create the wakeup event");
+        return -1;
+    }
+
+    for(i = 0; i < group->count; i++) {
+        pglobal->in[group->cams[i]->id].resume = cam_group_wake;
+        cam_prepare(&pglobal->in[group->cams[i]->id]);
+        if(uvcStreamOn(group->cams[i]->videoIn) < 0 || cam_group_add(group, group->cams[i]) < 0)
+            return -1;
+    }
+
+    for(i = 0; i < group->workers; i++) {
+        if(pthread_create(&group->threads[i], NULL, cam_group_thread, group) != 0) {
+            IPRINT("could not start the capture threads\n");
+            return -1;
+        }
+        group->thread_count++;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops the capture threads and cleans up all cameras of the group
+Input Value.: the camera group
+Return Value: -
+******************************************************************************/
+static void cam_group_stop(cam_group *group)
+{
+    int i;
+
+    for(i = 0; i < group->thread_count; i++)
+        pthread_cancel(group->threads[i]);
+    for(i = 0; i < group->thread_count; i++)
+        pthread_join(group->threads[i], NULL);
+    group->thread_count = 0;
+
+    for(i = 0; i < group->count; i++)
+        cam_cleanup(&pglobal->in[group->cams[i]->id]);
+
+    if(group->epfd >= 0)
+        close(group->epfd);
+    group->epfd = -1;
+    if(group->wake_fd >= 0)
+        close(group->wake_fd);
+    group->wake_fd = -1;
+}
+
 /******************************************************************************
 Description.:
 Input Value.:
@@ -725,16 +1438,23 @@ void cam_cleanup(void *arg)
     
     IPRINT("cleaning up resources allocated by input thread\n");
 
+    #ifndef NO_LIBJPEG
+    if (pctx->encoder != NULL) {
+        encoder_pool_free(pctx->encoder);
+        free(pctx->encoder);
+        pctx->encoder = NULL;
+        if (pctx->videoIn != NULL)
+            pctx->videoIn->framebuffer = pctx->framebuffer;
+    }
+    jpeg_encoder_free(pctx->jpeg);
+    pctx->jpeg = NULL;
+    #endif
+
     if (pctx->videoIn != NULL) {
         close_v4l2(pctx->videoIn);
-        free(pctx->videoIn->tmpbuffer);
         free(pctx->videoIn);
         pctx->videoIn = NULL;
     }
-    
-    free(in->buf);
-    in->buf = NULL;
-    in->size = 0;
 }
 
 /******************************************************************************
@@ -784,10 +1504,9 @@ int input_cmd(int plugin_number, unsigned int control_id, unsigned int group, in
         }
         int height = in->in_formats[in->currentFormat].supportedResolutions[value].height;
         int width = in->in_formats[in->currentFormat].supportedResolutions[value].width;
-        ret = setResolution(pctx->videoIn, width, height);
-        if(ret == 0) {
+        ret = cam_resolution(pctx, width, height);
+        if(ret == 0)
             in->in_formats[in->currentFormat].currentResolution = value;
-        }
         return ret;
     } break;
     case IN_CMD_JPEG_QUALITY:
@@ -1 +0,0 @@
-int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int quality);
@@ -25,12 +25,23 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
 #include "v4l2uvc.h"
 #include "huffman.h"
 #include "dynctrl.h"
 
 static int debug = 0;
 
+/* protects the published/retired state of the capture buffers */
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* signals the end of a paused stream */
+static pthread_mutex_t streaming_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t streaming_cond = PTHREAD_COND_INITIALIZER;
+
 /* ioctl with a number of retries in the case of failure
 * args:
 * fd - device descriptor
@@ -66,10 +77,9 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
     vd->videodevice = NULL;
     vd->status = NULL;
     vd->pictName = NULL;
-    vd->videodevice = (char *) calloc(1, 16 * sizeof(char));
+    vd->videodevice = strdup(device);
     vd->status = (char *) calloc(1, 100 * sizeof(char));
     vd->pictName = (char *) calloc(1, 80 * sizeof(char));
-    snprintf(vd->videodevice, (16 - 1), "%s", device);
     vd->toggleAvi = 0;
     vd->getPict = 0;
     vd->signalquit = 1;
@@ -179,10 +189,7 @@ int init_videoIn(struct vdIn *vd, char *device, int width,
     /* alloc a temp buffer to reconstruct the pict */
     vd->framesizeIn = (vd->width * vd->height << 1);
     switch(vd->formatIn) {
-    case V4L2_PIX_FMT_MJPEG: // in JPG mode the frame size is varies at every frame, so we allocate a bit bigger buffer
-        vd->tmpbuffer = (unsigned char *) calloc(1, (size_t) vd->framesizeIn);
-        if(!vd->tmpbuffer)
-            goto error;
+    case V4L2_PIX_FMT_MJPEG: // in JPG mode the frames are published from the capture buffers
         vd->framebuffer =
             (unsigned char *) calloc(1, (size_t) vd->width * (vd->height + 8) * 2);
         break;
@@ -218,12 +225,24 @@ static int init_v4l2(struct vdIn *vd)
 {
     int i;
     int ret = 0;
-    if((vd->fd = OPEN_VIDEO(vd->videodevice, O_RDWR)) == -1) {
+    if(vd->replay)
+        vd->fd = replay_open(vd->videodevice, vd->speed, vd->stamp);
+    else
+        vd->fd = OPEN_VIDEO(vd->videodevice, O_RDWR);
+    if(vd->fd == -1) {
         perror("ERROR opening V4L interface");
         DBG("errno: %d", errno);
         return -1;
     }
 
+    if(vd->record != NULL && !vd->replay) {
+        if(record_open(vd->fd, vd->record, vd->recording) < 0) {
+            CLOSE_VIDEO(vd->fd);
+            return -1;
+        }
+        vd->recording = 1;
+    }
+
     memset(&vd->cap, 0, sizeof(struct v4l2_capability));
     ret = xioctl(vd->fd, VIDIOC_QUERYCAP, &vd->cap);
     if(ret < 0) {
@@ -250,7 +269,7 @@ static int init_v4l2(struct vdIn *vd)
     }
 
     if (vd->vstd != V4L2_STD_UNKNOWN) {
-        if (ioctl(vd->fd, VIDIOC_S_STD, &vd->vstd) == -1) {
+        if (IOCTL_VIDEO(vd->fd, VIDIOC_S_STD, &vd->vstd) == -1) {
             fprintf(stderr, "Can't set video standard: %s\n",strerror(errno));
             goto fatal;
         }
@@ -364,7 +383,9 @@ static int init_v4l2(struct vdIn *vd)
      * request buffers
      */
     memset(&vd->rb, 0, sizeof(struct v4l2_requestbuffers));
-    vd->rb.count = NB_BUFFER;
+    if(vd->nbuffers <= 0)
+        vd->nbuffers = NB_BUFFER;
+    vd->rb.count = vd->nbuffers;
     vd->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     vd->rb.memory = V4L2_MEMORY_MMAP;
 
@@ -374,10 +395,20 @@ static int init_v4l2(struct vdIn *vd)
         goto fatal;
     }
 
+    /* the driver may hand out a different number of buffers */
+    vd->nbuffers = (vd->rb.count > MAX_BUFFERS) ? MAX_BUFFERS : vd->rb.count;
+    vd->buffers_out = 0;
+    vd->dequeued = 0;
+    memset(&vd->profile, 0, sizeof(struct jpeg_profile));
+    if(vd->nbuffers < 2) {
+        fprintf(stderr, "Insufficient buffer memory\n");
+        goto fatal;
+    }
+
     /*
      * map the buffers
      */
-    for(i = 0; i < NB_BUFFER; i++) {
+    for(i = 0; i < vd->nbuffers; i++) {
         memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
         vd->buf.index = i;
         vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -391,21 +422,28 @@ static int init_v4l2(struct vdIn *vd)
         if(debug)
             fprintf(stderr, "length: %u offset: %u\n", vd->buf.length, vd->buf.m.offset);
 
-        vd->mem[i] = mmap(0 /* start anywhere */ ,
-                          vd->buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, vd->fd,
-                          vd->buf.m.offset);
-        if(vd->mem[i] == MAP_FAILED) {
+        if((vd->mem[i] = calloc(1, sizeof(struct uvc_buffer))) == NULL) {
+            perror("Unable to allocate buffer");
+            goto fatal;
+        }
+        vd->mem[i]->vd = vd;
+        vd->mem[i]->index = i;
+        vd->mem[i]->length = vd->buf.length;
+        vd->mem[i]->mem = MMAP_VIDEO(vd->buf.length, vd->fd, vd->buf.m.offset);
+        if(vd->mem[i]->mem == MAP_FAILED) {
             perror("Unable to map buffer");
+            free(vd->mem[i]);
+            vd->mem[i] = NULL;
             goto fatal;
         }
         if(debug)
-            fprintf(stderr, "Buffer mapped at address %p.\n", vd->mem[i]);
+            fprintf(stderr, "Buffer mapped at address %p.\n", vd->mem[i]->mem);
     }
 
     /*
      * Queue the buffers.
      */
-    for(i = 0; i < NB_BUFFER; ++i) {
+    for(i = 0; i < vd->nbuffers; ++i) {
         memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
         vd->buf.index = i;
         vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -418,10 +456,84 @@ static int init_v4l2(struct vdIn *vd)
     }
     return 0;
 fatal:
+    uvc_buffers_free(vd);
     return -1;
 
 }
 
+/******************************************************************************
+Description.: Release hook of the frames published from a capture buffer,
+              called when the last reader let go of the frame. The buffer
+              gets queued to the driver again, or unmapped if the device was
+              closed in the meantime.
+Input Value.: the frame embedded in the uvc_buffer
+Return Value: -
+******************************************************************************/
+static void uvc_buffer_release(input_frame *frame)
+{
+    struct uvc_buffer *b = (struct uvc_buffer *)frame;
+    struct v4l2_buffer buf;
+
+    pthread_mutex_lock(&buffers_mutex);
+
+    if(b->retired) {
+        pthread_mutex_unlock(&buffers_mutex);
+        munmap(b->mem, b->length);
+        free(b);
+        return;
+    }
+
+    b->published = 0;
+    b->vd->buffers_out--;
+
+    /* the stream is off, uvcStreamOn() queues it */
+    if(b->vd->requeue) {
+        pthread_mutex_unlock(&buffers_mutex);
+        return;
+    }
+
+    memset(&buf, 0, sizeof(struct v4l2_buffer));
+    buf.index = b->index;
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if(xioctl(b->vd->fd, VIDIOC_QBUF, &buf) < 0)
+        perror("Unable to requeue buffer");
+
+    pthread_mutex_unlock(&buffers_mutex);
+}
+
+/******************************************************************************
+Description.: Unmaps the capture buffers. Buffers still held by frame readers
+              are left to them, their last reader unmaps them.
+              The stream must be turned off already.
+Input Value.: video device
+Return Value: -
+******************************************************************************/
+void uvc_buffers_free(struct vdIn *vd)
+{
+    int i;
+
+    pthread_mutex_lock(&buffers_mutex);
+
+    for(i = 0; i < MAX_BUFFERS; i++) {
+        if(vd->mem[i] == NULL)
+            continue;
+
+        if(vd->mem[i]->published) {
+            vd->mem[i]->retired = 1;
+        } else {
+            munmap(vd->mem[i]->mem, vd->mem[i]->length);
+            free(vd->mem[i]);
+        }
+        vd->mem[i] = NULL;
+    }
+    vd->buffers_out = 0;
+    vd->dequeued = 0;
+    vd->requeue = 0;
+
+    pthread_mutex_unlock(&buffers_mutex);
+}
+
 static int video_enable(struct vdIn *vd)
 {
     int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -432,7 +544,11 @@ static int video_enable(struct vdIn *vd)
         perror("Unable to start capture");
         return ret;
     }
+
+    pthread_mutex_lock(&streaming_mutex);
     vd->streamingState = STREAMING_ON;
+    pthread_cond_broadcast(&streaming_cond);
+    pthread_mutex_unlock(&streaming_mutex);
     return 0;
 }
 
@@ -452,62 +568,331 @@ static int video_disable(struct vdIn *vd, streaming_state disabledState)
 }
 
 /******************************************************************************
-Description.:
-Input Value.:
-Return Value:
+Description.: Walks the marker segments of a JPEG header up to the start of
+              scan and records the offsets of its huffman tables, its frame
+              header and its scan. Every segment has to fit into the picture.
+Input Value.: * p......: profile to fill in
+              * buf....: the JPEG picture
+              * size...: its size in bytes
+Return Value: 0 if the header could be parsed, -1 otherwise
+******************************************************************************/
+static int jpeg_profile_learn(struct jpeg_profile *p, unsigned char *buf, int size)
+{
+    int pos = 2, len;
+    unsigned char marker;
+
+    memset(p, 0, sizeof(struct jpeg_profile));
+    p->dht = p->sof = -1;
+
+    if(size < 4 || buf[0] != 0xff || buf[1] != 0xd8)
+        return -1;
+
+    while(pos + 4 <= size) {
+        if(buf[pos] != 0xff)
+            return -1;
+
+        marker = buf[pos + 1];
+        if(marker == 0xff) {        // fill byte
+            pos++;
+            continue;
+        }
+        if(marker == 0xda) {        // SOS, the tables must come before it
+            if(p->sof < 0)
+                return -1;
+            p->sos = pos;
+            p->valid = 1;
+            return 0;
+        }
+
+        len = (buf[pos + 2] << 8) | buf[pos + 3];
+        if(len < 2 || pos + 2 + len > size)
+            return -1;
+
+        if(marker == 0xc4 && p->dht < 0)
+            p->dht = pos;
+
+        /* SOF0-15 except DHT, JPG and DAC, it holds the dimensions */
+        if(marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc && p->sof < 0) {
+            if(len < 8)
+                return -1;
+            p->sof = pos;
+            p->sof_marker = marker;
+        }
+
+        pos += 2 + len;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: Makes sure the cached header profile matches this picture, it
+              is only learned again if the markers are not where they used
+              to be.
+Input Value.: * p......: the header profile of the camera
+              * buf....: the JPEG picture
+              * size...: its size in bytes
+Return Value: 0 if the profile describes the picture, -1 if it is broken
+******************************************************************************/
+static int jpeg_profile_check(struct jpeg_profile *p, unsigned char *buf, int size)
+{
+    if(p->valid && p->sos + 2 <= size &&
+       buf[0] == 0xff && buf[1] == 0xd8 &&
+       (p->dht < 0 || (buf[p->dht] == 0xff && buf[p->dht + 1] == 0xc4)) &&
+       buf[p->sof] == 0xff && buf[p->sof + 1] == p->sof_marker &&
+       buf[p->sos] == 0xff && buf[p->sos + 1] == 0xda)
+        return 0;
+
+    if(jpeg_profile_learn(p, buf, size) < 0) {
+        DBG("unable to parse the JPEG header\n");
+        return -1;
+    }
+    DBG("JPEG header profile: DHT at %d, SOF at %d, SOS at %d\n", p->dht, p->sof, p->sos);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Tells where the huffman tables have to be spliced into a MJPEG
+              picture of this camera.
+Input Value.: * vd.....: video device
+              * buf....: the JPEG picture
+              * size...: its size in bytes
+Return Value: 0 if the picture carries its huffman tables, the offset to
+              insert dht_data at otherwise, -1 if the picture is broken
+******************************************************************************/
+int uvc_dht_offset(struct vdIn *vd, unsigned char *buf, int size)
+{
+    struct jpeg_profile *p = &vd->profile;
+
+    if(jpeg_profile_check(p, buf, size) < 0)
+        return -1;
+
+    if(p->dht >= 0)
+        return 0;
+
+    return p->sof;
+}
+
+/******************************************************************************
+Description.: Structural check of a MJPEG picture before it gets published.
+              The header must match the profile of the camera, the frame
+              header the negotiated resolution and the picture has to end
+              with EOI. Trailing garbage after EOI is cut off.
+Input Value.: * vd.....: video device
+              * buf....: the JPEG picture
+              * size...: its size in bytes
+Return Value: size of the picture up to and including EOI, 0 if it is broken
+******************************************************************************/
+int uvc_jpeg_valid(struct vdIn *vd, unsigned char *buf, int size)
+{
+    struct jpeg_profile *p = &vd->profile;
+    unsigned char *eoi;
+    int width, height, len = size;
+
+    if(jpeg_profile_check(p, buf, size) < 0)
+        return 0;
+
+    height = (buf[p->sof + 5] << 8) | buf[p->sof + 6];
+    width = (buf[p->sof + 7] << 8) | buf[p->sof + 8];
+    if(width != vd->width || height != vd->height) {
+        DBG("picture is %dx%d instead of %dx%d\n", width, height, vd->width, vd->height);
+        return 0;
+    }
+
+    /*
+     * EOI is at the very end or followed by a few padding bytes, memrchr()
+     * scans backwards a vector at a time. Stuffed 0xff bytes of the
+     * entropy coded data are followed by 0x00 and never match.
+     */
+    while((eoi = memrchr(buf + p->sos, 0xff, len - p->sos - 1)) != NULL) {
+        if(eoi[1] == 0xd9)
+            return eoi + 2 - buf;
+        len = eoi - buf + 1;
+    }
+
+    DBG("picture has no EOI\n");
+    return 0;
+}
+
+/******************************************************************************
+Description.: Turns the stream on, uvcGrab() does it on its first call
+              otherwise. The device only becomes pollable once it streams.
+              After uvcStandby() all buffers not held by frame readers get
+              queued again first.
+Input Value.: video device
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
+int uvcStreamOn(struct vdIn *vd)
+{
+    struct v4l2_buffer buf;
+    int i, ret;
+
+    if(vd->streamingState != STREAMING_OFF)
+        return 0;
+
+    pthread_mutex_lock(&buffers_mutex);
+
+    for(i = 0; vd->requeue && i < MAX_BUFFERS; i++) {
+        if(vd->mem[i] == NULL || vd->mem[i]->published)
+            continue;
+
+        memset(&buf, 0, sizeof(struct v4l2_buffer));
+        buf.index = i;
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        if(xioctl(vd->fd, VIDIOC_QBUF, &buf) < 0)
+            perror("Unable to requeue buffer");
+    }
+    vd->requeue = 0;
+
+    ret = video_enable(vd);
+
+    pthread_mutex_unlock(&buffers_mutex);
+
+    return ret;
+}
+
+/******************************************************************************
+Description.: Turns the stream off while nobody wants frames, the device
+              stops transferring. The driver gives back all buffers,
+              uvcGrab() or uvcStreamOn() turn it on again.
+Input Value.: video device
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
+int uvcStandby(struct vdIn *vd)
+{
+    int ret = 0;
+
+    if(vd->streamingState != STREAMING_ON)
+        return 0;
+
+    /* readers releasing buffers now must leave them to uvcStreamOn() */
+    pthread_mutex_lock(&buffers_mutex);
+    if((ret = video_disable(vd, STREAMING_OFF)) == 0) {
+        vd->requeue = 1;
+        vd->dequeued = 0;
+    }
+    pthread_mutex_unlock(&buffers_mutex);
+
+    return ret;
+}
+
+/******************************************************************************
+Description.: unlocks the streaming mutex if a waiting thread gets cancelled
+Input Value.: the mutex
+Return Value: -
 ******************************************************************************/
-int is_huffman(unsigned char *buf)
+static void uvc_wait_unlock(void *arg)
 {
-    unsigned char *ptbuf;
-    int i = 0;
-    ptbuf = buf;
-    while(((ptbuf[0] << 8) | ptbuf[1]) != 0xffda) {
-        if(i++ > 2048)
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+/******************************************************************************
+Description.: blocks while the stream is paused, e.g. for a resolution change
+Input Value.: video device
+Return Value: -
+******************************************************************************/
+void uvcWaitStream(struct vdIn *vd)
+{
+    pthread_mutex_lock(&streaming_mutex);
+    pthread_cleanup_push(uvc_wait_unlock, &streaming_mutex);
+
+    while(vd->streamingState == STREAMING_PAUSED)
+        pthread_cond_wait(&streaming_cond, &streaming_mutex);
+
+    pthread_cleanup_pop(1);
+}
+
+/******************************************************************************
+Description.: Dequeues every further buffer that is ready without blocking,
+              stale ones go straight back to the driver, vd->buf ends up
+              holding the newest picture. A source that fills every requeued
+              buffer right away, like a replay at full speed, stops it after
+              as many buffers as there are.
+Input Value.: video device, vd->buf holds a dequeued buffer
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
+static int uvc_drain(struct vdIn *vd)
+{
+    struct v4l2_buffer newer;
+    struct pollfd pfd;
+    int i;
+
+    /* poll() since a reopened device may get a descriptor above FD_SETSIZE */
+    for(i = 0; i < vd->nbuffers; i++) {
+        pfd.fd = vd->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if(poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+            return 0;
+
+        memset(&newer, 0, sizeof(struct v4l2_buffer));
+        newer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        newer.memory = V4L2_MEMORY_MMAP;
+        if(xioctl(vd->fd, VIDIOC_DQBUF, &newer) < 0)
             return 0;
-        if(((ptbuf[0] << 8) | ptbuf[1]) == 0xffc4)
-            return 1;
-        ptbuf++;
+
+        if(xioctl(vd->fd, VIDIOC_QBUF, &vd->buf) < 0) {
+            perror("Unable to requeue buffer");
+            return -1;
+        }
+        vd->buf = newer;
+        vd->queued++;
+        vd->drained++;
     }
+
     return 0;
 }
 
 /******************************************************************************
-Description.:
-Input Value.:
-Return Value:
+Description.: microseconds since the capture of a dequeued buffer
+Input Value.: the buffer
+Return Value: age in microseconds
 ******************************************************************************/
-int memcpy_picture(unsigned char *out, unsigned char *buf, int size)
+static int uvc_buffer_age(struct v4l2_buffer *buf)
 {
-    unsigned char *ptdeb, *ptlimit, *ptcur = buf;
-    int sizein, pos = 0;
-
-    if(!is_huffman(buf)) {
-        ptdeb = ptcur = buf;
-        ptlimit = buf + size;
-        while((((ptcur[0] << 8) | ptcur[1]) != 0xffc0) && (ptcur < ptlimit))
-            ptcur++;
-        if(ptcur >= ptlimit)
-            return pos;
-        sizein = ptcur - ptdeb;
-
-        memcpy(out + pos, buf, sizein); pos += sizein;
-        memcpy(out + pos, dht_data, sizeof(dht_data)); pos += sizeof(dht_data);
-        memcpy(out + pos, ptcur, size - sizein); pos += size - sizein;
+    struct timespec ts;
+    struct timeval now;
+
+    if((buf->flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now.tv_sec = ts.tv_sec;
+        now.tv_usec = ts.tv_nsec / 1000;
     } else {
-        memcpy(out + pos, ptcur, size); pos += size;
+        gettimeofday(&now, NULL);
     }
-    return pos;
+
+    return (now.tv_sec - buf->timestamp.tv_sec) * 1000000 + (now.tv_usec - buf->timestamp.tv_usec);
 }
 
+/******************************************************************************
+Description.: Dequeues the next picture. Raw pictures are copied to the
+              framebuffer, MJPEG pictures stay in their capture buffer until
+              uvcFrame() is called, so dropped frames never get copied.
+              In drain mode only the newest of all ready pictures is kept.
+Input Value.: video device
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
 int uvcGrab(struct vdIn *vd)
 {
 #define HEADERFRAME1 0xaf
     int ret;
 
     if(vd->streamingState == STREAMING_OFF) {
-        if(video_enable(vd))
+        if(uvcStreamOn(vd))
             goto err;
     }
+
+    /* the previous MJPEG picture was dropped without uvcFrame() */
+    if(vd->dequeued) {
+        vd->dequeued = 0;
+        ret = xioctl(vd->fd, VIDIOC_QBUF, &vd->buf);
+        if(ret < 0) {
+            perror("Unable to requeue buffer");
+            goto err;
+        }
+    }
     memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
     vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     vd->buf.memory = V4L2_MEMORY_MMAP;
@@ -518,36 +903,37 @@ int uvcGrab(struct vdIn *vd)
         goto err;
     }
 
+    vd->queued = 1;
+    if(vd->drain && uvc_drain(vd) < 0)
+        goto err;
+    vd->age = uvc_buffer_age(&vd->buf);
+    gettimeofday(&vd->captured, NULL);
+
     switch(vd->formatIn) {
     case V4L2_PIX_FMT_MJPEG:
+        /* keep the buffer until uvcFrame() published or copied it */
+        vd->dequeued = 1;
+        vd->tmptimestamp = vd->buf.timestamp;
+
         if(vd->buf.bytesused <= HEADERFRAME1) {
             /* Prevent crash
                                                         * on empty image */
             fprintf(stderr, "Ignoring empty buffer ...\n");
+            vd->tmpbytesused = 0;
             return 0;
         }
-
-        /* memcpy(vd->tmpbuffer, vd->mem[vd->buf.index], vd->buf.bytesused);
-
-        memcpy (vd->tmpbuffer, vd->mem[vd->buf.index], HEADERFRAME1);
-        memcpy (vd->tmpbuffer + HEADERFRAME1, dht_data, sizeof(dht_data));
-        memcpy (vd->tmpbuffer + HEADERFRAME1 + sizeof(dht_data), vd->mem[vd->buf.index] + HEADERFRAME1, (vd->buf.bytesused - HEADERFRAME1));
-        */
-
-        memcpy(vd->tmpbuffer, vd->mem[vd->buf.index], vd->buf.bytesused);
         vd->tmpbytesused = vd->buf.bytesused;
-        vd->tmptimestamp = vd->buf.timestamp;
 
         if(debug)
             fprintf(stderr, "bytes in used %d \n", vd->buf.bytesused);
-        break;
+        return 0;
     case V4L2_PIX_FMT_RGB565:
     case V4L2_PIX_FMT_YUYV:
     case V4L2_PIX_FMT_UYVY:
         if(vd->buf.bytesused > vd->framesizeIn)
-            memcpy(vd->framebuffer, vd->mem[vd->buf.index], (size_t) vd->framesizeIn);
+            memcpy(vd->framebuffer, vd->mem[vd->buf.index]->mem, (size_t) vd->framesizeIn);
         else
-            memcpy(vd->framebuffer, vd->mem[vd->buf.index], (size_t) vd->buf.bytesused);
+            memcpy(vd->framebuffer, vd->mem[vd->buf.index]->mem, (size_t) vd->buf.bytesused);
         break;
 
     default:
@@ -568,13 +954,99 @@ err:
     return -1;
 }
 
+/******************************************************************************
+Description.: Turns the MJPEG picture dequeued by uvcGrab() into a frame.
+              The capture buffer itself gets published if enough buffers
+              stay queued to the driver, missing huffman tables are spliced
+              in place if the buffer has room for them. Otherwise the
+              picture is copied into a frame of the ring and the buffer
+              goes straight back to the driver.
+Input Value.: * vd.....: video device
+              * in.....: the input plugin the frame will be published to
+Return Value: frame with one reference held by the caller, NULL if the
+              picture was empty, broken or on error
+******************************************************************************/
+input_frame *uvcFrame(struct vdIn *vd, input *in)
+{
+    struct uvc_buffer *b;
+    input_frame *frame = NULL;
+    int size = vd->tmpbytesused, offset = -1;
+
+    if(!vd->dequeued)
+        return NULL;
+
+    b = vd->mem[vd->buf.index];
+
+    if(size > 0)
+        offset = uvc_dht_offset(vd, b->mem, size);
+
+    /* broken pictures never reach the readers */
+    if(offset >= 0 && vd->validate && (size = uvc_jpeg_valid(vd, b->mem, size)) == 0)
+        offset = -1;
+    if(offset < 0) {
+        DBG("rejecting broken frame of %d bytes\n", vd->tmpbytesused);
+        in->stats.rejected++;
+    }
+
+    if(offset >= 0 && vd->zerocopy && (offset == 0 || size + sizeof(dht_data) <= b->length)) {
+        pthread_mutex_lock(&buffers_mutex);
+        if(vd->buffers_out + 1 <= vd->nbuffers - MIN_QUEUED_BUFFERS) {
+            memset(&b->frame, 0, sizeof(input_frame));
+            b->frame.buf = b->mem;
+            b->frame.size = size;
+            b->frame.capacity = b->length;
+            b->frame.timestamp = vd->tmptimestamp;
+            b->frame.captured = vd->captured;
+            b->frame.refcount = 1;
+            b->frame.release = uvc_buffer_release;
+            b->published = 1;
+            vd->buffers_out++;
+            vd->dequeued = 0;
+            frame = &b->frame;
+        }
+        pthread_mutex_unlock(&buffers_mutex);
+
+        if(frame != NULL) {
+            /* nobody else sees this buffer yet, so the tables can go in place */
+            if(offset > 0) {
+                memmove(b->mem + offset + sizeof(dht_data), b->mem + offset, size - offset);
+                memcpy(b->mem + offset, dht_data, sizeof(dht_data));
+                frame->size = size + sizeof(dht_data);
+            }
+            return frame;
+        }
+        DBG("only %d of %d buffers queued, copying the frame\n", vd->nbuffers - vd->buffers_out - 1, vd->nbuffers);
+    }
+
+    if(offset >= 0) {
+        frame = input_frame_get(in, size + sizeof(dht_data));
+        if(frame != NULL) {
+            if(offset > 0) {
+                memcpy(frame->buf, b->mem, offset);
+                memcpy(frame->buf + offset, dht_data, sizeof(dht_data));
+                memcpy(frame->buf + offset + sizeof(dht_data), b->mem + offset, size - offset);
+                frame->size = size + sizeof(dht_data);
+            } else {
+                memcpy(frame->buf, b->mem, size);
+                frame->size = size;
+            }
+            frame->timestamp = vd->tmptimestamp;
+            frame->captured = vd->captured;
+        }
+    }
+
+    vd->dequeued = 0;
+    if(xioctl(vd->fd, VIDIOC_QBUF, &vd->buf) < 0)
+        perror("Unable to requeue buffer");
+
+    return frame;
+}
+
 int close_v4l2(struct vdIn *vd)
 {
     if(vd->streamingState == STREAMING_ON)
         video_disable(vd, STREAMING_OFF);
-    if(vd->tmpbuffer)
-        free(vd->tmpbuffer);
-    vd->tmpbuffer = NULL;
+    uvc_buffers_free(vd);
     free(vd->framebuffer);
     vd->framebuffer = NULL;
     free(vd->videodevice);
@@ -858,9 +1330,7 @@ int setResolution(struct vdIn *vd, int width, int height)
     vd->streamingState = STREAMING_PAUSED;
     if(video_disable(vd, STREAMING_PAUSED) == 0) {  // do streamoff
         DBG("Unmap buffers\n");
-        int i;
-        for(i = 0; i < NB_BUFFER; i++)
-            munmap(vd->mem[i], vd->buf.length);
+        uvc_buffers_free(vd);
 
         if(CLOSE_VIDEO(vd->fd) == 0) {
             DBG("Device closed successfully\n");
@@ -873,6 +1343,17 @@ int setResolution(struct vdIn *vd, int width, int height)
             return -1;
         } else {
             DBG("reinit done\n");
+
+            /* the raw pictures have the new size, the driver may have adjusted it */
+            vd->framesizeIn = (vd->width * vd->height << 1);
+            free(vd->framebuffer);
+            if(vd->formatIn == V4L2_PIX_FMT_MJPEG)
+                vd->framebuffer = (unsigned char *) calloc(1, (size_t) vd->width * (vd->height + 8) * 2);
+            else
+                vd->framebuffer = (unsigned char *) calloc(1, (size_t) vd->framesizeIn);
+            if(vd->framebuffer == NULL)
+                return -1;
+
             video_enable(vd);
             return 0;
         }
@@ -41,7 +41,17 @@
 #include <linux/videodev2.h>
 
 #include "../../mjpg_streamer.h"
+#include "encoder.h"
+#include "../jpeg_utils.h"
+/* default and maximum number of capture buffers */
 #define NB_BUFFER 4
+#define MAX_BUFFERS 32
+
+/*
+ * Buffers the driver keeps at least, MJPEG frames are copied instead of
+ * published from their buffer if less would be left.
+ */
+#define MIN_QUEUED_BUFFERS 2
 
 
 #define IOCTL_RETRY 4
@@ -57,15 +67,22 @@ int xioctl(int fd, int IOCTL_X, void *arg);
 
 #ifdef USE_LIBV4L2
 #include <libv4l2.h>
-#define IOCTL_VIDEO(fd, req, value) v4l2_ioctl(fd, req, value)
-#define OPEN_VIDEO(fd, flags) v4l2_open(fd, flags)
-#define CLOSE_VIDEO(fd) v4l2_close(fd)
+#define DEVICE_IOCTL(fd, req, value) v4l2_ioctl(fd, req, value)
+#define DEVICE_OPEN(fd, flags) v4l2_open(fd, flags)
+#define DEVICE_CLOSE(fd) v4l2_close(fd)
 #else
-#define IOCTL_VIDEO(fd, req, value) ioctl(fd, req, value)
-#define OPEN_VIDEO(fd, flags) open(fd, flags)
-#define CLOSE_VIDEO(fd) close(fd)
+#define DEVICE_IOCTL(fd, req, value) ioctl(fd, req, value)
+#define DEVICE_OPEN(fd, flags) open(fd, flags)
+#define DEVICE_CLOSE(fd) close(fd)
 #endif
 
+/* recorded and replayed devices are handled by backend.c */
+#include "backend.h"
+#define IOCTL_VIDEO(fd, req, value) backend_ioctl(fd, req, value)
+#define OPEN_VIDEO(fd, flags) DEVICE_OPEN(fd, flags)
+#define CLOSE_VIDEO(fd) backend_close(fd)
+#define MMAP_VIDEO(length, fd, offset) backend_mmap(length, fd, offset)
+
 typedef enum _streaming_state streaming_state;
 enum _streaming_state {
     STREAMING_OFF = 0,
@@ -73,6 +90,36 @@ enum _streaming_state {
     STREAMING_PAUSED = 2,
 };
 
+struct vdIn;
+
+/*
+ * Header layout of the MJPEG pictures of a camera, it does not change from
+ * frame to frame. Learned by walking the marker segments of the first
+ * picture, every following one only gets its markers compared at the
+ * cached offsets, see jpeg_profile_check().
+ */
+struct jpeg_profile {
+    int valid;
+    int dht;                // offset of the first DHT marker, -1 if there is none
+    int sof;                // offset of the SOFn marker
+    int sos;                // offset of the SOS marker
+    unsigned char sof_marker;
+};
+
+/*
+ * A mmap'ed capture buffer. MJPEG frames are published straight from it, it
+ * goes back to the driver when the last reader releases the frame.
+ */
+struct uvc_buffer {
+    input_frame frame;      // must be the first member, see uvc_buffer_release()
+    struct vdIn *vd;
+    unsigned char *mem;
+    size_t length;
+    int index;
+    int published;          // held by the frame readers
+    int retired;            // unmapped by the last reader, the device is gone
+};
+
 struct vdIn {
     int fd;
     char *videodevice;
@@ -82,8 +129,22 @@ struct vdIn {
     struct v4l2_format fmt;
     struct v4l2_buffer buf;
     struct v4l2_requestbuffers rb;
-    void *mem[NB_BUFFER];
-    unsigned char *tmpbuffer;
+    struct uvc_buffer *mem[MAX_BUFFERS];
+    int nbuffers;           // number of capture buffers
+    int buffers_out;        // buffers held by frame readers
+    int dequeued;           // buf is dequeued and needs to go back to the driver
+    int requeue;            // the stream was turned off, uvcStreamOn() queues the buffers again
+    int zerocopy;           // publish MJPEG frames from the capture buffers
+    int validate;           // drop MJPEG frames which fail uvc_jpeg_valid()
+    int drain;              // dequeue every ready buffer, only keep the newest
+    int queued;             // buffers that were ready at the last grab
+    unsigned int drained;   // stale buffers requeued by the drain
+    int age;                // microseconds from capture to dequeue of the last buffer
+    char *record;           // file every dequeued buffer gets recorded to
+    int recording;          // record was created, reopening the device appends to it
+    int replay;             // videodevice is a recording to replay instead of a device
+    double speed;           // of the replay, 0 for as fast as frames get consumed
+    int stamp;              // the replay draws frame stamps into raw pictures
     unsigned char *framebuffer;
     streaming_state streamingState;
     int grabmethod;
@@ -111,6 +172,8 @@ struct vdIn {
     int recordtime;
     uint32_t tmpbytesused;
     struct timeval tmptimestamp;
+    struct timeval captured;    // wall clock time the last buffer got dequeued
+    struct jpeg_profile profile;
     v4l2_std_id vstd;
     unsigned long frame_period_time; // in ms
     unsigned char soft_framedrop;
@@ -135,23 +198,71 @@ typedef struct {
         cb_set, cb_auto, cb;
 } context_settings;
 
+/* maximum number of threads capturing the cameras of one plugin instance */
+#define MAX_CAPTURE_WORKERS 16
+
+/* ready cameras a capture thread serves per wakeup */
+#define CAPTURE_BATCH 8
+
+/*
+ * Several cameras of one plugin instance, a few capture threads wait for
+ * all of them with epoll and grab whichever camera has a frame ready.
+ */
+typedef struct _context context;
+typedef struct _cam_group cam_group;
+struct _cam_group {
+    int epfd;
+    int wake_fd;            // eventfd, signaled when a camera in standby is wanted again
+    pthread_mutex_t mutex;  // serializes standby and resume of the cameras
+    int workers;
+    pthread_t threads[MAX_CAPTURE_WORKERS];
+    int thread_count;
+    int count;
+    context *cams[MAX_INPUT_PLUGINS];
+};
+
 /* context of each camera thread */
-typedef struct {
+struct _context {
     int id;
     globals *pglobal;
     pthread_t threadID;
     pthread_mutex_t controls_mutex;
+    pthread_mutex_t grab_mutex;     // held while grabbing, see cam_resolution()
     struct vdIn *videoIn;
     context_settings *init_settings;
-} context;
+
+    /* parallel JPEG compression of raw formats, NULL if disabled */
+    int encoders;
+    encode_order encode_order;
+    encoder_pool *encoder;
+    int chroma;                 // JPEG chroma subsampling of YUYV/UYVY
+    int stripes;                // every frame is compressed in as many stripes in parallel
+    jpeg_encoder *jpeg;         // compresses raw formats if there is no pool
+    unsigned char *framebuffer; // own framebuffer of videoIn while the pool is used
+    encoder_job *job;           // job the next raw picture gets grabbed into
+
+    /* state of the capture loop */
+    int quality;
+    unsigned int every_count;
+    unsigned long last;
+
+    cam_group *group;           // shared by all cameras of the instance, NULL with one camera
+    int standby;                // the group turned the stream off, nobody wants frames
+};
 
 int init_videoIn(struct vdIn *vd, char *device, int width, int height, int fps, int format, int grabmethod, globals *pglobal, int id, v4l2_std_id vstd);
 void enumerateControls(struct vdIn *vd, globals *pglobal, int id);
 void control_readed(struct vdIn *vd, struct v4l2_queryctrl *ctrl, globals *pglobal, int id);
 int setResolution(struct vdIn *vd, int width, int height);
 
-int memcpy_picture(unsigned char *out, unsigned char *buf, int size);
+int uvc_dht_offset(struct vdIn *vd, unsigned char *buf, int size);
+int uvc_jpeg_valid(struct vdIn *vd, unsigned char *buf, int size);
 int uvcGrab(struct vdIn *vd);
+int uvcStreamOn(struct vdIn *vd);
+int uvcStandby(struct vdIn *vd);
+void uvcWaitStream(struct vdIn *vd);
+input_frame *uvcFrame(struct vdIn *vd, input *in);
+void uvc_buffers_free(struct vdIn *vd);
 int close_v4l2(struct vdIn *vd);
 
 int v4l2GetControl(struct vdIn *vd, int control);
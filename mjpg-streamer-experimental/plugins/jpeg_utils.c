@@ -0,0 +1,904 @@
+/*******************************************************************************
+# JPEG compression of raw pictures for the MJPG-streamer input plugins         #
+#                                                                              #
+#   Orginally Copyright (C) 2005 2006 Laurent Pinchart &&  Michel Xhaard       #
+#   Modifications Copyright (C) 2006  Gabriel A. Devenyi                       #
+#   Modifications Copyright (C) 2007  Tom Stöveken                             #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <jpeglib.h>
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+#include "jpeg_utils.h"
+
+/* what gets written after the destination buffer ran full is discarded here */
+#define OUTPUT_BUF_SIZE  4096
+
+typedef struct {
+    struct jpeg_destination_mgr pub; /* public fields */
+
+    unsigned char *outbuffer;
+    int outbuffer_size;
+    int written;        /* -1 if the picture did not fit into outbuffer */
+
+    JOCTET scratch[OUTPUT_BUF_SIZE];
+} mjpg_destination_mgr;
+
+typedef mjpg_destination_mgr * mjpg_dest_ptr;
+
+/* a stripe of the picture, compressed by a thread of its own */
+typedef struct {
+    jpeg_encoder *owner;
+    jpeg_encoder *enc;
+    int index;
+    pthread_t thread;
+
+    unsigned char *buffer;
+    int buffer_size;
+    int written;
+} jpeg_stripe;
+
+struct _jpeg_encoder {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    mjpg_destination_mgr dest;
+
+    /* parameters cinfo is set up for, the setup is skipped if they match */
+    int width, height, format, chroma, quality, restart;
+
+    /* plane rows or a RGB line, kept between the frames */
+    unsigned char *lines;
+    size_t lines_size;
+
+#ifdef HAVE_TURBOJPEG
+    tjhandle tj;
+    unsigned char *tj_buffer;
+    unsigned long tj_size;
+#endif
+
+    /*
+     * Compression in horizontal stripes, the calling thread does the first
+     * one, stripe_threads[i] stripe i + 1. The stripes are joined with
+     * restart markers, see compress_stripes().
+     */
+    int stripe_count;
+    jpeg_stripe *stripe_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned int generation;    /* incremented for every picture */
+    int pending;                /* stripes not compressed yet */
+    int stop;
+
+    /* the picture being compressed in stripes */
+    struct {
+        unsigned char *raw;
+        int width, height, format, chroma, quality;
+        int lines;              /* lines per stripe */
+        int used;               /* number of stripes */
+        int restart;            /* MCUs per stripe */
+        int size;               /* size of the destination buffer */
+    } job;
+};
+
+/******************************************************************************
+Description.: libjpeg writes straight into the destination buffer
+Input Value.: the compressor
+Return Value: -
+******************************************************************************/
+METHODDEF(void) init_destination(j_compress_ptr cinfo)
+{
+    mjpg_dest_ptr dest = (mjpg_dest_ptr) cinfo->dest;
+
+    dest->written = 0;
+    dest->pub.next_output_byte = dest->outbuffer;
+    dest->pub.free_in_buffer = dest->outbuffer_size;
+}
+
+/******************************************************************************
+Description.: Called if the destination buffer is full. The rest of the
+              picture gets compressed into the scratch buffer and dropped.
+Input Value.: the compressor
+Return Value: TRUE, libjpeg can go on
+******************************************************************************/
+METHODDEF(boolean) empty_output_buffer(j_compress_ptr cinfo)
+{
+    mjpg_dest_ptr dest = (mjpg_dest_ptr) cinfo->dest;
+
+    dest->written = -1;
+    dest->pub.next_output_byte = dest->scratch;
+    dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+
+    return TRUE;
+}
+
+/******************************************************************************
+Description.: called by jpeg_finish_compress after all data has been written
+Input Value.: the compressor
+Return Value: -
+******************************************************************************/
+METHODDEF(void) term_destination(j_compress_ptr cinfo)
+{
+    mjpg_dest_ptr dest = (mjpg_dest_ptr) cinfo->dest;
+
+    if(dest->written == 0)
+        dest->written = dest->outbuffer_size - dest->pub.free_in_buffer;
+}
+
+/*
+ * Splitting YUYV/UYVY lines into planes
+ *
+ * libjpeg takes the Y, Cb and Cr planes with jpeg_write_raw_data(), so no
+ * color conversion is necessary at all. The deinterleaving is done with
+ * SSE2/AVX2 or NEON if the CPU supports it, the function is selected once
+ * at runtime.
+ */
+typedef void (*deinterleave_fn)(const unsigned char *src, unsigned char *y, unsigned char *u, unsigned char *v, int pairs, int uyvy);
+
+/******************************************************************************
+Description.: splits a line of YUYV or UYVY pixels into Y, U and V
+Input Value.: * src....: the packed line
+              * y, u, v: destination planes
+              * pairs..: number of pixel pairs (width / 2)
+              * uyvy...: the line is UYVY instead of YUYV
+Return Value: -
+******************************************************************************/
+static void deinterleave_c(const unsigned char *src, unsigned char *y, unsigned char *u, unsigned char *v, int pairs, int uyvy)
+{
+    int i, yo = uyvy ? 1 : 0, co = uyvy ? 0 : 1;
+
+    for(i = 0; i < pairs; i++) {
+        y[2 * i] = src[yo];
+        y[2 * i + 1] = src[yo + 2];
+        u[i] = src[co];
+        v[i] = src[co + 2];
+        src += 4;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static void deinterleave_sse2(const unsigned char *src, unsigned char *y, unsigned char *u, unsigned char *v, int pairs, int uyvy)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    __m128i a, b, luma, chroma;
+    int i;
+
+    /* 16 pixels per round */
+    for(i = 0; i + 8 <= pairs; i += 8) {
+        a = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        b = _mm_loadu_si128((const __m128i *)(src + 4 * i + 16));
+
+        if(uyvy) {
+            luma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            chroma = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+        } else {
+            luma = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+            chroma = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        }
+
+        /* chroma holds U V U V ..., split it once more */
+        _mm_storeu_si128((__m128i *)(y + 2 * i), luma);
+        _mm_storel_epi64((__m128i *)(u + i), _mm_packus_epi16(_mm_and_si128(chroma, mask), chroma));
+        _mm_storel_epi64((__m128i *)(v + i), _mm_packus_epi16(_mm_srli_epi16(chroma, 8), chroma));
+    }
+
+    deinterleave_c(src + 4 * i, y + 2 * i, u + i, v + i, pairs - i, uyvy);
+}
+
+__attribute__((target("avx2")))
+static void deinterleave_avx2(const unsigned char *src, unsigned char *y, unsigned char *u, unsigned char *v, int pairs, int uyvy)
+{
+    const __m256i mask = _mm256_set1_epi16(0x00ff);
+    __m256i a, b, luma, chroma, uv;
+    int i;
+
+    /* 32 pixels per round, packus works per 128 bit lane, so fix the order */
+    for(i = 0; i + 16 <= pairs; i += 16) {
+        a = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        b = _mm256_loadu_si256((const __m256i *)(src + 4 * i + 32));
+
+        if(uyvy) {
+            luma = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+            chroma = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+        } else {
+            luma = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+            chroma = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+        }
+        luma = _mm256_permute4x64_epi64(luma, 0xd8);
+        chroma = _mm256_permute4x64_epi64(chroma, 0xd8);
+
+        uv = _mm256_packus_epi16(_mm256_and_si256(chroma, mask), _mm256_srli_epi16(chroma, 8));
+        uv = _mm256_permute4x64_epi64(uv, 0xd8);
+
+        _mm256_storeu_si256((__m256i *)(y + 2 * i), luma);
+        _mm_storeu_si128((__m128i *)(u + i), _mm256_castsi256_si128(uv));
+        _mm_storeu_si128((__m128i *)(v + i), _mm256_extracti128_si256(uv, 1));
+    }
+
+    deinterleave_c(src + 4 * i, y + 2 * i, u + i, v + i, pairs - i, uyvy);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+
+static void deinterleave_neon(const unsigned char *src, unsigned char *y, unsigned char *u, unsigned char *v, int pairs, int uyvy)
+{
+    uint8x16x4_t px;
+    uint8x16x2_t luma;
+    int i;
+
+    /* 32 pixels per round */
+    for(i = 0; i + 16 <= pairs; i += 16) {
+        px = vld4q_u8(src + 4 * i);
+
+        if(uyvy) {
+            luma.val[0] = px.val[1];
+            luma.val[1] = px.val[3];
+            vst1q_u8(u + i, px.val[0]);
+            vst1q_u8(v + i, px.val[2]);
+        } else {
+            luma.val[0] = px.val[0];
+            luma.val[1] = px.val[2];
+            vst1q_u8(u + i, px.val[1]);
+            vst1q_u8(v + i, px.val[3]);
+        }
+        vst2q_u8(y + 2 * i, luma);
+    }
+
+    deinterleave_c(src + 4 * i, y + 2 * i, u + i, v + i, pairs - i, uyvy);
+}
+#endif
+
+static deinterleave_fn deinterleave = deinterleave_c;
+static pthread_once_t deinterleave_once = PTHREAD_ONCE_INIT;
+
+/******************************************************************************
+Description.: selects the fastest deinterleave function for this CPU
+Input Value.: -
+Return Value: -
+******************************************************************************/
+static void deinterleave_select(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        deinterleave = deinterleave_avx2;
+    else if(__builtin_cpu_supports("sse2"))
+        deinterleave = deinterleave_sse2;
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+    deinterleave = deinterleave_neon;
+#endif
+}
+
+/******************************************************************************
+Description.: repeats the last sample of a plane line up to the padded width
+Input Value.: * line...: the line
+              * width..: samples set
+              * padded.: samples libjpeg reads
+Return Value: -
+******************************************************************************/
+static void pad_line(unsigned char *line, int width, int padded)
+{
+    if(padded > width)
+        memset(line + width, line[width - 1], padded - width);
+}
+
+
+static void *stripe_thread(void *arg);
+
+/******************************************************************************
+Description.: Creates an encoder, it keeps its state between the pictures.
+              With more than one stripe the pictures are split into as many
+              horizontal stripes, compressed in parallel.
+Input Value.: stripes: number of stripes and so of threads, 0 or 1 compresses
+                       in the calling thread only
+Return Value: the encoder or NULL if there is not enough memory
+******************************************************************************/
+jpeg_encoder *jpeg_encoder_new(int stripes)
+{
+    jpeg_encoder *enc;
+    jpeg_stripe *stripe;
+    int i;
+
+    if((enc = calloc(1, sizeof(jpeg_encoder))) == NULL)
+        return NULL;
+
+    enc->cinfo.err = jpeg_std_error(&enc->jerr);
+    jpeg_create_compress(&enc->cinfo);
+
+    enc->dest.pub.init_destination = init_destination;
+    enc->dest.pub.empty_output_buffer = empty_output_buffer;
+    enc->dest.pub.term_destination = term_destination;
+    enc->cinfo.dest = &enc->dest.pub;
+
+    pthread_mutex_init(&enc->mutex, NULL);
+    pthread_cond_init(&enc->start, NULL);
+    pthread_cond_init(&enc->done, NULL);
+    enc->stripe_count = 1;
+
+    if(stripes > 1) {
+        if((enc->stripe_threads = calloc(stripes - 1, sizeof(jpeg_stripe))) == NULL)
+            goto err;
+
+        for(i = 0; i < stripes - 1; i++) {
+            stripe = &enc->stripe_threads[i];
+            stripe->owner = enc;
+            stripe->index = i + 1;
+            if((stripe->enc = jpeg_encoder_new(1)) == NULL)
+                goto err;
+            if(pthread_create(&stripe->thread, NULL, stripe_thread, stripe) != 0) {
+                jpeg_encoder_free(stripe->enc);
+                stripe->enc = NULL;
+                goto err;
+            }
+            enc->stripe_count++;
+        }
+    }
+
+    return enc;
+
+err:
+    jpeg_encoder_free(enc);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: stops the stripe threads and frees the encoder and its buffers
+Input Value.: the encoder, may be NULL
+Return Value: -
+******************************************************************************/
+void jpeg_encoder_free(jpeg_encoder *enc)
+{
+    int i;
+
+    if(enc == NULL)
+        return;
+
+    pthread_mutex_lock(&enc->mutex);
+    enc->stop = 1;
+    pthread_cond_broadcast(&enc->start);
+    pthread_mutex_unlock(&enc->mutex);
+
+    for(i = 0; i < enc->stripe_count - 1; i++) {
+        pthread_join(enc->stripe_threads[i].thread, NULL);
+        jpeg_encoder_free(enc->stripe_threads[i].enc);
+        free(enc->stripe_threads[i].buffer);
+    }
+    free(enc->stripe_threads);
+
+    pthread_mutex_destroy(&enc->mutex);
+    pthread_cond_destroy(&enc->start);
+    pthread_cond_destroy(&enc->done);
+
+    jpeg_destroy_compress(&enc->cinfo);
+    free(enc->lines);
+#ifdef HAVE_TURBOJPEG
+    if(enc->tj != NULL)
+        tjDestroy(enc->tj);
+    tjFree(enc->tj_buffer);
+#endif
+    free(enc);
+}
+
+/******************************************************************************
+Description.: returns the line buffer of the encoder, grown to size if needed
+Input Value.: * enc....: the encoder
+              * size...: required size in bytes
+Return Value: the buffer or NULL if there is not enough memory
+******************************************************************************/
+static unsigned char *encoder_lines(jpeg_encoder *enc, size_t size)
+{
+    unsigned char *lines;
+
+    if(size > enc->lines_size) {
+        if((lines = realloc(enc->lines, size)) == NULL)
+            return NULL;
+        enc->lines = lines;
+        enc->lines_size = size;
+    }
+
+    return enc->lines;
+}
+
+/******************************************************************************
+Description.: Sets the compressor up for the picture. This is only done if
+              anything changed since the last picture, libjpeg keeps the
+              tables and parameters between jpeg_finish_compress() and the
+              next jpeg_start_compress().
+Input Value.: * enc....: the encoder
+              * width, height, format, chroma and quality of the picture
+              * restart: restart interval in MCUs, 0 for none
+Return Value: -
+******************************************************************************/
+static void encoder_setup(jpeg_encoder *enc, int width, int height, int format, int chroma, int quality, int restart)
+{
+    struct jpeg_compress_struct *cinfo = &enc->cinfo;
+
+    if(width == enc->width && height == enc->height && format == enc->format &&
+       chroma == enc->chroma && quality == enc->quality && restart == enc->restart)
+        return;
+
+    cinfo->image_width = width;
+    cinfo->image_height = height;
+    cinfo->input_components = 3;
+    if(format == V4L2_PIX_FMT_RGB565 || format == V4L2_PIX_FMT_RGB24)
+        cinfo->in_color_space = JCS_RGB;
+    else
+        cinfo->in_color_space = JCS_YCbCr;
+
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, quality, TRUE);
+
+    /* YCbCr pictures are handed over as planes, see compress_planes() */
+    cinfo->raw_data_in = (cinfo->in_color_space == JCS_YCbCr);
+#if JPEG_LIB_VERSION >= 70
+    cinfo->do_fancy_downsampling = FALSE;
+#endif
+    cinfo->comp_info[0].h_samp_factor = 2;
+    cinfo->comp_info[0].v_samp_factor = (chroma == JPEG_CHROMA_422) ? 1 : 2;
+    cinfo->restart_interval = restart;
+
+    enc->width = width;
+    enc->height = height;
+    enc->format = format;
+    enc->chroma = chroma;
+    enc->quality = quality;
+    enc->restart = restart;
+}
+
+/******************************************************************************
+Description.: Compresses YUYV, UYVY or YUV420 with jpeg_write_raw_data(). The
+              chroma of YUYV/UYVY is kept as 4:2:2 or averaged over two lines
+              for 4:2:0.
+Input Value.: * enc....: encoder, set up by encoder_setup() for the lines
+              * raw....: the raw picture
+              * width, height and format of the picture
+              * first..: first line to compress
+Return Value: 0 if the lines were compressed, -1 otherwise
+******************************************************************************/
+static int compress_planes(jpeg_encoder *enc, unsigned char *raw, int width, int height, int format, int first)
+{
+    struct jpeg_compress_struct *cinfo = &enc->cinfo;
+    int vsamp = cinfo->comp_info[0].v_samp_factor;
+    int rows = DCTSIZE * vsamp;          /* lines per jpeg_write_raw_data() */
+    int ywidth = (width + 15) & ~15;     /* padded to full MCUs */
+    int cwidth = ywidth / 2;
+    unsigned char *planes, *cu, *cv, *u, *v;
+    JSAMPROW yrows[2 * DCTSIZE], urows[DCTSIZE], vrows[DCTSIZE];
+    JSAMPARRAY data[3] = { yrows, urows, vrows };
+    int i, j, line;
+
+    pthread_once(&deinterleave_once, deinterleave_select);
+
+    planes = encoder_lines(enc, rows * ywidth + 2 * DCTSIZE * cwidth + 2 * cwidth);
+    if(planes == NULL)
+        return -1;
+
+    for(i = 0; i < rows; i++)
+        yrows[i] = planes + i * ywidth;
+    for(i = 0; i < DCTSIZE; i++) {
+        urows[i] = planes + rows * ywidth + i * cwidth;
+        vrows[i] = planes + rows * ywidth + (DCTSIZE + i) * cwidth;
+    }
+    cu = planes + rows * ywidth + 2 * DCTSIZE * cwidth;
+    cv = cu + cwidth;
+
+    jpeg_start_compress(cinfo, TRUE);
+
+    while(cinfo->next_scanline < cinfo->image_height) {
+        for(i = 0; i < rows; i++) {
+            /* the last lines get repeated to fill the MCU row */
+            line = first + cinfo->next_scanline + i;
+            if(line >= height)
+                line = height - 1;
+
+            u = urows[i / vsamp];
+            v = vrows[i / vsamp];
+
+            if(format == V4L2_PIX_FMT_YUV420) {
+                memcpy(yrows[i], raw + line * width, width);
+                if((i & 1) == 0) {
+                    memcpy(u, raw + width * height + (line / 2) * (width / 2), width / 2);
+                    memcpy(v, raw + width * height * 5 / 4 + (line / 2) * (width / 2), width / 2);
+                }
+            } else if(vsamp == 1 || (i & 1) == 0) {
+                deinterleave(raw + line * width * 2, yrows[i], u, v, width / 2, format == V4L2_PIX_FMT_UYVY);
+            } else {
+                deinterleave(raw + line * width * 2, yrows[i], cu, cv, width / 2, format == V4L2_PIX_FMT_UYVY);
+                for(j = 0; j < width / 2; j++) {
+                    u[j] = (u[j] + cu[j] + 1) >> 1;
+                    v[j] = (v[j] + cv[j] + 1) >> 1;
+                }
+            }
+
+            pad_line(yrows[i], width, ywidth);
+            pad_line(u, width / 2, cwidth);
+            pad_line(v, width / 2, cwidth);
+        }
+
+        jpeg_write_raw_data(cinfo, data, rows);
+    }
+
+    jpeg_finish_compress(cinfo);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: compresses RGB888 or RGB565, the latter gets expanded per line
+Input Value.: * enc....: encoder, set up by encoder_setup() for the lines
+              * raw....: the raw picture
+              * width and format of the picture
+              * first..: first line to compress
+Return Value: 0 if the lines were compressed, -1 otherwise
+******************************************************************************/
+static int compress_rgb(jpeg_encoder *enc, unsigned char *raw, int width, int format, int first)
+{
+    struct jpeg_compress_struct *cinfo = &enc->cinfo;
+    JSAMPROW row_pointer[1];
+    unsigned char *line_buffer = NULL, *rgb, *ptr;
+    int x;
+
+    if(format == V4L2_PIX_FMT_RGB565 && (line_buffer = encoder_lines(enc, width * 3)) == NULL)
+        return -1;
+
+    jpeg_start_compress(cinfo, TRUE);
+
+    while(cinfo->next_scanline < cinfo->image_height) {
+        if(format == V4L2_PIX_FMT_RGB24) {
+            row_pointer[0] = raw + (first + cinfo->next_scanline) * width * 3;
+        } else {
+            rgb = raw + (first + cinfo->next_scanline) * width * 2;
+            ptr = line_buffer;
+
+            for(x = 0; x < width; x++) {
+                unsigned int twoByte = (rgb[1] << 8) + rgb[0];
+                *(ptr++) = (rgb[1] & 248);
+                *(ptr++) = (unsigned char)((twoByte & 2016) >> 3);
+                *(ptr++) = ((rgb[0] & 31) * 8);
+                rgb += 2;
+            }
+
+            row_pointer[0] = line_buffer;
+        }
+
+        jpeg_write_scanlines(cinfo, row_pointer, 1);
+    }
+
+    jpeg_finish_compress(cinfo);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: compresses lines of the picture to a JPEG of their own
+Input Value.: * enc....: the encoder
+              * raw....: the raw picture
+              * width, height, format, chroma and quality of the picture
+              * first..: first line to compress
+              * lines..: number of lines to compress
+              * restart: restart interval in MCUs, 0 for none
+              * buffer.: destination buffer
+              * size...: size of the destination buffer
+Return Value: number of bytes written to buffer, 0 if the format is not
+              supported or the JPEG did not fit into the buffer
+******************************************************************************/
+static int compress_part(jpeg_encoder *enc, unsigned char *raw, int width, int height, int format, int chroma, int quality,
+                         int first, int lines, int restart, unsigned char *buffer, int size)
+{
+    int result;
+
+    encoder_setup(enc, width, lines, format, chroma, quality, restart);
+    enc->dest.outbuffer = buffer;
+    enc->dest.outbuffer_size = size;
+
+    switch(format) {
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    case V4L2_PIX_FMT_YUV420:
+        result = compress_planes(enc, raw, width, height, format, first);
+        break;
+    case V4L2_PIX_FMT_RGB565:
+    case V4L2_PIX_FMT_RGB24:
+        result = compress_rgb(enc, raw, width, format, first);
+        break;
+    default:
+        return 0;
+    }
+
+    if(result < 0 || enc->dest.written < 0)
+        return 0;
+
+    return enc->dest.written;
+}
+
+/******************************************************************************
+Description.: thread compressing one stripe of every picture
+Input Value.: the stripe
+Return Value: always NULL
+******************************************************************************/
+static void *stripe_thread(void *arg)
+{
+    jpeg_stripe *stripe = arg;
+    jpeg_encoder *enc = stripe->owner;
+    unsigned int generation = 0;
+    unsigned char *buffer;
+    int first, lines;
+
+    pthread_mutex_lock(&enc->mutex);
+
+    while(1) {
+        while(!enc->stop && enc->generation == generation)
+            pthread_cond_wait(&enc->start, &enc->mutex);
+        if(enc->stop)
+            break;
+        generation = enc->generation;
+
+        /* small pictures may need less stripes than there are threads */
+        if(stripe->index >= enc->job.used)
+            continue;
+
+        pthread_mutex_unlock(&enc->mutex);
+
+        stripe->written = 0;
+        if(stripe->buffer_size < enc->job.size &&
+           (buffer = realloc(stripe->buffer, enc->job.size)) != NULL) {
+            stripe->buffer = buffer;
+            stripe->buffer_size = enc->job.size;
+        }
+
+        if(stripe->buffer_size >= enc->job.size) {
+            first = stripe->index * enc->job.lines;
+            lines = enc->job.height - first;
+            if(lines > enc->job.lines)
+                lines = enc->job.lines;
+
+            stripe->written = compress_part(stripe->enc, enc->job.raw, enc->job.width, enc->job.height,
+                                            enc->job.format, enc->job.chroma, enc->job.quality,
+                                            first, lines, enc->job.restart, stripe->buffer, stripe->buffer_size);
+        }
+
+        pthread_mutex_lock(&enc->mutex);
+        if(--enc->pending == 0)
+            pthread_cond_signal(&enc->done);
+    }
+
+    pthread_mutex_unlock(&enc->mutex);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: finds the scan data and the frame header of a JPEG
+Input Value.: * jpeg...: the JPEG
+              * size...: its size
+              * sof....: set to the offset of the height in the frame header
+Return Value: offset of the entropy coded data, -1 if the JPEG is broken
+******************************************************************************/
+static int jpeg_scan_offset(unsigned char *jpeg, int size, int *sof)
+{
+    int pos = 2, length;
+
+    *sof = -1;
+    while(pos + 4 <= size && jpeg[pos] == 0xff) {
+        length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+        if(jpeg[pos + 1] == 0xc0 || jpeg[pos + 1] == 0xc1)
+            *sof = pos + 5;
+        if(jpeg[pos + 1] == 0xda)
+            return (*sof < 0 || pos + 2 + length > size) ? -1 : pos + 2 + length;
+        pos += 2 + length;
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+Description.: Compresses the picture in horizontal stripes of whole MCU rows
+              in parallel. Every stripe is a JPEG of its own with the same
+              tables and a restart interval of exactly one stripe, so none of
+              them contains restart markers. The first JPEG gets the height
+              of the whole picture, the scan data of the others is appended
+              with RSTn markers in between. Restart markers reset the DC
+              predictors, so the result is one valid baseline JPEG.
+Input Value.: * enc....: the encoder
+              * raw....: the raw picture
+              * width, height, format and chroma of the picture
+              * buffer.: destination buffer
+              * size...: size of the destination buffer
+              * quality: JPEG quality
+Return Value: number of bytes written to buffer, 0 if the picture did not fit
+              or -1 if the picture can not be split
+******************************************************************************/
+static int compress_stripes(jpeg_encoder *enc, unsigned char *raw, int width, int height, int format, int chroma, unsigned char *buffer, int size, int quality)
+{
+    int mcu_height = (chroma == JPEG_CHROMA_422) ? DCTSIZE : 2 * DCTSIZE;
+    int mcu_rows = (height + mcu_height - 1) / mcu_height;
+    int rows = (mcu_rows + enc->stripe_count - 1) / enc->stripe_count;
+    int used = (mcu_rows + rows - 1) / rows;
+    int restart = rows * ((width + 15) / 16);
+    jpeg_stripe *stripe;
+    int written, pos, scan, sof, i;
+
+    /* the restart interval is a 16 bit value */
+    if(used < 2 || restart > 65535)
+        return -1;
+
+    pthread_mutex_lock(&enc->mutex);
+    enc->job.raw = raw;
+    enc->job.width = width;
+    enc->job.height = height;
+    enc->job.format = format;
+    enc->job.chroma = chroma;
+    enc->job.quality = quality;
+    enc->job.lines = rows * mcu_height;
+    enc->job.used = used;
+    enc->job.restart = restart;
+    enc->job.size = size;
+    enc->pending = used - 1;
+    enc->generation++;
+    pthread_cond_broadcast(&enc->start);
+    pthread_mutex_unlock(&enc->mutex);
+
+    written = compress_part(enc, raw, width, height, format, chroma, quality,
+                            0, enc->job.lines, restart, buffer, size);
+
+    pthread_mutex_lock(&enc->mutex);
+    while(enc->pending > 0)
+        pthread_cond_wait(&enc->done, &enc->mutex);
+    pthread_mutex_unlock(&enc->mutex);
+
+    if(written == 0 || jpeg_scan_offset(buffer, written, &sof) < 0)
+        return 0;
+
+    /* the first stripe becomes the whole picture */
+    buffer[sof] = height >> 8;
+    buffer[sof + 1] = height & 0xff;
+    pos = written - 2;
+
+    for(i = 1; i < used; i++) {
+        stripe = &enc->stripe_threads[i - 1];
+        if(stripe->written == 0 || (scan = jpeg_scan_offset(stripe->buffer, stripe->written, &sof)) < 0)
+            return 0;
+
+        written = stripe->written - 2 - scan;
+        if(pos + 2 + written + 2 > size)
+            return 0;
+
+        buffer[pos++] = 0xff;
+        buffer[pos++] = 0xd0 + ((i - 1) & 7);
+        memcpy(buffer + pos, stripe->buffer + scan, written);
+        pos += written;
+    }
+
+    buffer[pos++] = 0xff;
+    buffer[pos++] = 0xd9;
+
+    return pos;
+}
+
+#ifdef HAVE_TURBOJPEG
+/******************************************************************************
+Description.: Compresses RGB888 or YUV420 with TurboJPEG, which takes both
+              formats as they are. The output buffer of TurboJPEG is kept
+              and is large enough for the worst case, so it never has to be
+              reallocated.
+Input Value.: * enc....: the encoder
+              * raw....: the raw picture
+              * width, height, format and chroma of the picture
+              * buffer.: destination buffer
+              * size...: size of the destination buffer
+              * quality: JPEG quality
+Return Value: number of bytes written to buffer, 0 if the picture did not fit
+              or -1 if TurboJPEG failed
+******************************************************************************/
+static int compress_turbo(jpeg_encoder *enc, unsigned char *raw, int width, int height, int format, int chroma, unsigned char *buffer, int size, int quality)
+{
+    const unsigned char *planes[3];
+    int strides[3];
+    int subsamp = (chroma == JPEG_CHROMA_422) ? TJSAMP_422 : TJSAMP_420;
+    unsigned long jpeg_size;
+    int result;
+
+    if(enc->tj == NULL && (enc->tj = tjInitCompress()) == NULL)
+        return -1;
+
+    jpeg_size = tjBufSize(width, height, subsamp);
+    if(jpeg_size > enc->tj_size) {
+        tjFree(enc->tj_buffer);
+        enc->tj_size = 0;
+        if((enc->tj_buffer = tjAlloc(jpeg_size)) == NULL)
+            return -1;
+        enc->tj_size = jpeg_size;
+    }
+    jpeg_size = enc->tj_size;
+
+    if(format == V4L2_PIX_FMT_RGB24) {
+        result = tjCompress2(enc->tj, raw, width, width * 3, height, TJPF_RGB,
+                             &enc->tj_buffer, &jpeg_size, subsamp, quality, TJFLAG_NOREALLOC);
+    } else {
+        planes[0] = raw;
+        planes[1] = raw + width * height;
+        planes[2] = raw + width * height * 5 / 4;
+        strides[0] = width;
+        strides[1] = strides[2] = width / 2;
+        result = tjCompressFromYUVPlanes(enc->tj, planes, width, strides, height, TJSAMP_420,
+                                         &enc->tj_buffer, &jpeg_size, quality, TJFLAG_NOREALLOC);
+    }
+
+    if(result != 0) {
+        fprintf(stderr, "TurboJPEG: %s\n", tjGetErrorStr2(enc->tj));
+        return -1;
+    }
+
+    if(jpeg_size > (unsigned long)size)
+        return 0;
+
+    memcpy(buffer, enc->tj_buffer, jpeg_size);
+
+    return jpeg_size;
+}
+#endif
+
+/******************************************************************************
+Description.: Compresses a raw picture to JPEG. YUYV, UYVY and YUV420 get
+              passed to libjpeg as YCbCr planes without any color conversion,
+              RGB565 gets expanded to RGB888. With TurboJPEG RGB888 and YUV420
+              are compressed by it, unless the encoder uses stripes.
+Input Value.: * enc....: the encoder, must not be used by other threads meanwhile
+              * raw....: the raw picture
+              * width, height and format (V4L2_PIX_FMT_*) of the picture
+              * chroma.: subsampling, JPEG_CHROMA_422 or JPEG_CHROMA_420,
+                         YUV420 is always compressed as 4:2:0
+              * buffer.: destination buffer
+              * size...: size of the destination buffer
+              * quality: JPEG quality
+Return Value: number of bytes written to buffer, 0 if the format is not
+              supported or the picture did not fit into the buffer
+******************************************************************************/
+int jpeg_encoder_compress(jpeg_encoder *enc, unsigned char *raw, int width, int height, int format, int chroma, unsigned char *buffer, int size, int quality)
+{
+    int result;
+
+    if(format == V4L2_PIX_FMT_YUV420)
+        chroma = JPEG_CHROMA_420;
+
+    if(enc->stripe_count > 1) {
+        result = compress_stripes(enc, raw, width, height, format, chroma, buffer, size, quality);
+        if(result >= 0)
+            return result;
+    }
+#ifdef HAVE_TURBOJPEG
+    else if(format == V4L2_PIX_FMT_RGB24 || format == V4L2_PIX_FMT_YUV420) {
+        result = compress_turbo(enc, raw, width, height, format, chroma, buffer, size, quality);
+        if(result >= 0)
+            return result;
+    }
+#endif
+
+    return compress_part(enc, raw, width, height, format, chroma, quality, 0, height, 0, buffer, size);
+}
@@ -0,0 +1,45 @@
+/*******************************************************************************
+# JPEG compression of raw pictures for the MJPG-streamer input plugins         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef JPEG_UTILS_H
+#define JPEG_UTILS_H
+
+#include <linux/types.h>          /* for videodev2.h */
+#include <linux/videodev2.h>
+
+/* chroma subsampling of the compressed pictures */
+#define JPEG_CHROMA_420 420
+#define JPEG_CHROMA_422 422
+
+/* maximum number of stripes a picture is split into */
+#define JPEG_MAX_STRIPES 16
+
+/*
+ * The encoder keeps its libjpeg (or TurboJPEG) state and line buffers from
+ * one picture to the next. There is no global state, each thread can use an
+ * encoder of its own, but one encoder must not be used by two threads at once.
+ * With stripes it splits every picture and compresses the parts in parallel.
+ */
+typedef struct _jpeg_encoder jpeg_encoder;
+
+jpeg_encoder *jpeg_encoder_new(int stripes);
+int jpeg_encoder_compress(jpeg_encoder *enc, unsigned char *raw, int width, int height, int format, int chroma, unsigned char *buffer, int size, int quality);
+void jpeg_encoder_free(jpeg_encoder *enc);
+
+#endif
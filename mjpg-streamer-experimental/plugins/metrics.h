@@ -0,0 +1,93 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Counters, gauges and histograms any plugin can register, the core keeps
+ * them in a registry that output plugins can print. Registering takes a
+ * lock and is meant for the start of a plugin. Updating is lock-free, a
+ * relaxed atomic add per counter or bucket, so it is cheap enough for
+ * every frame and every send. All functions accept NULL for a metric that
+ * could not be registered.
+ */
+
+#define METRICS_MAX 512
+#define METRIC_BUCKETS_MAX 16
+
+typedef enum {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM
+} metric_type;
+
+typedef struct _metric metric;
+struct _metric {
+    metric_type type;
+    char name[64];
+    char help[128];
+    char labels[128];       // like input="0",plugin="input_uvc.so", may be empty
+
+    int64_t value;          // counters and gauges
+
+    /* histograms, the buckets are not cumulative, the last one is +Inf */
+    int bucket_count;
+    double bounds[METRIC_BUCKETS_MAX];
+    uint64_t buckets[METRIC_BUCKETS_MAX + 1];
+    uint64_t count;
+    uint64_t sum;           // the bits of a double
+};
+
+/*
+ * a metric with the same name and labels is only registered once, later
+ * calls return it again. Histograms without bounds get buckets for
+ * durations from 10us to 1s.
+ */
+metric *metric_counter(const char *name, const char *help, const char *labels);
+metric *metric_gauge(const char *name, const char *help, const char *labels);
+metric *metric_histogram(const char *name, const char *help, const char *labels, const double *bounds, int count);
+
+void metric_observe(metric *m, double value);
+void metric_observe_since(metric *m, struct timespec *start);
+
+/* prints all metrics in the Prometheus text format */
+void metrics_print(FILE *f);
+
+/* counters only go up, gauges also down */
+static inline void metric_add(metric *m, int64_t n)
+{
+    if(m != NULL)
+        __atomic_fetch_add(&m->value, n, __ATOMIC_RELAXED);
+}
+
+static inline void metric_set(metric *m, int64_t value)
+{
+    if(m != NULL)
+        __atomic_store_n(&m->value, value, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -54,3 +54,21 @@ struct _output {
     int (*cmd)(int plugin, unsigned int control_id, unsigned int group, int value, char *value_str);
 };
 
+/*
+ * frame access for output plugins, implemented in the core
+ * input_frame_acquire() must be called with the db mutex of the input locked,
+ * the returned frame stays valid until it is handed to input_frame_release()
+ * input_frame_gap() tells how many frames were missed since the last one
+ */
+input_frame *input_frame_acquire(input *in);
+void input_frame_release(input_frame *frame);
+unsigned int input_frame_gap(unsigned int *last, input_frame *frame);
+
+/*
+ * consumers attach to an input as long as they want its frames, inputs
+ * without consumers stop compressing and eventually stop capturing.
+ * fps is the frame rate the consumer needs, 0 for every frame, the input
+ * delivers the highest rate any of its consumers asked for.
+ */
+void input_consumer_attach(input *in, int fps);
+void input_consumer_detach(input *in, int fps);
@@ -49,7 +49,7 @@
 static pthread_t worker;
 static globals *pglobal;
 static int fd, delay;
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
 static int input_number;
 
 /******************************************************************************
@@ -84,7 +84,9 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
-    free(frame);
+    input_frame_release(frame);
+    frame = NULL;
+    input_consumer_detach(&pglobal->in[input_number], 0);
     close(fd);
 }
 
@@ -98,31 +100,35 @@ Return Value:
 ******************************************************************************/
 void *worker_thread(void *arg)
 {
-    int frame_size = 0;
     double sv = -1.0, max_sv = 100.0, delta = 500;
     int focus = 255, step = 10, max_focus = 100, search_focus = 1;
 
-    if((frame = malloc(256 * 1024)) == NULL) {
-        OPRINT("not enough memory for worker thread\n");
-        exit(EXIT_FAILURE);
-    }
-
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
+    /* every frame is wanted, keep the input capturing */
+    input_consumer_attach(&pglobal->in[input_number], 0);
+
     while(!pglobal->stop) {
         DBG("waiting for fresh frame\n");
+
+        /* drop the frame of the previous round */
+        input_frame_release(frame);
+        frame = NULL;
+
         pthread_mutex_lock(&pglobal->in[input_number].db);
         pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+        /* take a reference, the input plugin will not touch this frame anymore */
+        frame = input_frame_acquire(&pglobal->in[input_number]);
 
         pthread_mutex_unlock(&pglobal->in[input_number].db);
 
+        if(frame == NULL)
+            continue;
+
         /* process frame */
-        sv = getFrameSharpnessValue(frame, frame_size);
+        sv = getFrameSharpnessValue(frame->buf, frame->size);
         DBG("sharpness is: %f\n", sv);
 
         if(search_focus || (ABS(sv - max_sv) > delta)) {
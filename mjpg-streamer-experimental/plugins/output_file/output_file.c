@@ -46,9 +46,12 @@
 
 static pthread_t worker;
 static globals *pglobal;
-static int fd, delay, ringbuffer_size = -1, ringbuffer_exceed = 0, max_frame_size;
+static int fd, delay, ringbuffer_size = -1, ringbuffer_exceed = 0;
+static int fps = 0; // frames per second saved with the delay, 0 for every frame
 static char *folder = "/tmp";
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
+static unsigned int last_seq = 0;
+static unsigned long frames_missed = 0;
 static char *command = NULL;
 static int input_number = 0;
 static char *mjpgFileName = NULL;
@@ -96,9 +99,12 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
-    if(frame != NULL) {
-        free(frame);
-    }
+    if(frames_missed > 0)
+        OPRINT("missed %lu frames of input #%02d\n", frames_missed, input_number);
+
+    input_frame_release(frame);
+    frame = NULL;
+    input_consumer_detach(&pglobal->in[input_number], fps);
     close(fd);
 }
 
@@ -201,45 +207,41 @@ Return Value:
 ******************************************************************************/
 void *worker_thread(void *arg)
 {
-    int ok = 1, frame_size = 0, rc = 0;
+    int ok = 1, rc = 0;
     char buffer1[1024] = {0}, buffer2[1024] = {0};
     unsigned long long counter = 0;
     time_t t;
     struct tm *now;
-    unsigned char *tmp_framebuffer = NULL;
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
+    /* with a delay the input only needs to deliver one frame per delay */
+    if(delay > 0)
+        fps = (1000 + delay - 1) / delay;
+    input_consumer_attach(&pglobal->in[input_number], fps);
+
     while(ok >= 0 && !pglobal->stop) {
         DBG("waiting for fresh frame\n");
 
+        /* drop the frame of the previous round */
+        input_frame_release(frame);
+        frame = NULL;
+
         pthread_mutex_lock(&pglobal->in[input_number].db);
         pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
-
-            max_frame_size = frame_size + (1 << 16);
-            if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                LOG("not enough memory\n");
-                return NULL;
-            }
-
-            frame = tmp_framebuffer;
-        }
-
-        /* copy frame to our local buffer now */
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+        /* take a reference, the input plugin will not touch this frame anymore */
+        frame = input_frame_acquire(&pglobal->in[input_number]);
 
         /* allow others to access the global buffer again */
         pthread_mutex_unlock(&pglobal->in[input_number].db);
 
+        if(frame == NULL)
+            continue;
+
+        frames_missed += input_frame_gap(&last_seq, frame);
+
         if (mjpgFileName == NULL) { // single files with ringbuffer mode
             /* prepare filename */
             memset(buffer1, 0, sizeof(buffer1));
@@ -256,7 +258,7 @@ void *worker_thread(void *arg)
             /* prepare string, add time and date values */
             if(strftime(buffer1, sizeof(buffer1), "%%s/%Y_%m_%d_%H_%M_%S_picture_%%09llu.jpg", now) == 0) {
                 OPRINT("strftime returned 0\n");
-                free(frame); frame = NULL;
+                input_frame_release(frame); frame = NULL;
                 return NULL;
             }
 
@@ -274,7 +276,7 @@ void *worker_thread(void *arg)
             }
 
             /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
+            if(write(fd, frame->buf, frame->size) < 0) {
                 OPRINT("could not write to file %s\n", buffer2);
                 perror("write()");
                 close(fd);
@@ -316,7 +318,7 @@ void *worker_thread(void *arg)
             }
         } else { // recording to MJPG file
             /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
+            if(write(fd, frame->buf, frame->size) < 0) {
                 OPRINT("could not write to file %s\n", buffer2);
                 perror("write()");
                 close(fd);
@@ -550,54 +552,44 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
 					switch(control_id) {
                             case OUT_FILE_CMD_TAKE: {
                                 if (valueStr != NULL) {
-                                    int frame_size = 0;
-                                    unsigned char *tmp_framebuffer = NULL;
+                                    input_frame *snapshot = NULL;
 
                                     if(pthread_mutex_lock(&pglobal->in[input_number].db)) {
                                         DBG("Unable to lock mutex\n");
                                         return -1;
                                     }
-                                    /* read buffer */
-                                    frame_size = pglobal->in[input_number].size;
-
-                                    /* check if buffer for frame is large enough, increase it if necessary */
-                                    if(frame_size > max_frame_size) {
-                                        DBG("increasing buffer size to %d\n", frame_size);
-
-                                        max_frame_size = frame_size + (1 << 16);
-                                        if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                                            pthread_mutex_unlock(&pglobal->in[input_number].db);
-                                            LOG("not enough memory\n");
-                                            return -1;
-                                        }
-
-                                        frame = tmp_framebuffer;
-                                    }
-
-                                    /* copy frame to our local buffer now */
-                                    memcpy(frame, pglobal->in[input_number].buf, frame_size);
+                                    /* take a reference to the latest frame */
+                                    snapshot = input_frame_acquire(&pglobal->in[input_number]);
 
                                     /* allow others to access the global buffer again */
                                     pthread_mutex_unlock(&pglobal->in[input_number].db);
 
+                                    if(snapshot == NULL) {
+                                        DBG("No frame available yet\n");
+                                        return -1;
+                                    }
+
                                     DBG("writing file: %s\n", valueStr);
 
                                     int fd;
                                     /* open file for write */
                                     if((fd = open(valueStr, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
                                         OPRINT("could not open the file %s\n", valueStr);
+                                        input_frame_release(snapshot);
                                         return -1;
                                     }
 
                                     /* save picture to file */
-                                    if(write(fd, frame, frame_size) < 0) {
+                                    if(write(fd, snapshot->buf, snapshot->size) < 0) {
                                         OPRINT("could not write to file %s\n", valueStr);
                                         perror("write()");
                                         close(fd);
+                                        input_frame_release(snapshot);
                                         return -1;
                                     }
 
                                     close(fd);
+                                    input_frame_release(snapshot);
                                 } else {
                                     DBG("No filename specified\n");
                                     return -1;
@@ -29,18 +29,28 @@
 #include <ctype.h>
 #include <pthread.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <syslog.h>
 #include <netdb.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
 
 #include <linux/version.h>
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
 
 #include "../../mjpg_streamer.h"
 #include "../../utils.h"
@@ -58,17 +68,6 @@ static globals *pglobal;
 extern context servers[MAX_OUTPUT_PLUGINS];
 int piggy_fine = 2; // FIXME make it command line parameter
 
-/******************************************************************************
-Description.: initializes the iobuffer structure properly
-Input Value.: pointer to already allocated iobuffer
-Return Value: iobuf
-******************************************************************************/
-void init_iobuffer(iobuffer *iobuf)
-{
-    memset(iobuf->buffer, 0, sizeof(iobuf->buffer));
-    iobuf->level = 0;
-}
-
 /******************************************************************************
 Description.: initializes the request structure properly
 Input Value.: pointer to already allocated req
@@ -96,107 +95,6 @@ void free_request(request *req)
     if(req->query_string != NULL) free(req->query_string);
 }
 
-/******************************************************************************
-Description.: read with timeout, implemented without using signals
-              tries to read len bytes and returns if enough bytes were read
-              or the timeout was triggered. In case of timeout the return
-              value may differ from the requested bytes "len".
-Input Value.: * fd.....: fildescriptor to read from
-              * iobuf..: iobuffer that allows to use this functions from multiple
-                         threads because the complete context is the iobuffer.
-              * buffer.: The buffer to store values at, will be set to zero
-                         before storing values.
-              * len....: the length of buffer
-              * timeout: seconds to wait for an answer
-Return Value: * buffer.: will become filled with bytes read
-              * iobuf..: May get altered to save the context for future calls.
-              * func().: bytes copied to buffer or -1 in case of error
-******************************************************************************/
-int _read(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout)
-{
-    int copied = 0, rc, i;
-    fd_set fds;
-    struct timeval tv;
-
-    memset(buffer, 0, len);
-
-    while((copied < len)) {
-        i = MIN(iobuf->level, len - copied);
-        memcpy(buffer + copied, iobuf->buffer + IO_BUFFER - iobuf->level, i);
-
-        iobuf->level -= i;
-        copied += i;
-        if(copied >= len)
-            return copied;
-
-        /* select will return in case of timeout or new data arrived */
-        tv.tv_sec = timeout;
-        tv.tv_usec = 0;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        if((rc = select(fd + 1, &fds, NULL, NULL, &tv)) <= 0) {
-            if(rc < 0)
-                exit(EXIT_FAILURE);
-
-            /* this must be a timeout */
-            return copied;
-        }
-
-        init_iobuffer(iobuf);
-
-        /*
-         * there should be at least one byte, because select signalled it.
-         * But: It may happen (very seldomly), that the socket gets closed remotly between
-         * the select() and the following read. That is the reason for not relying
-         * on reading at least one byte.
-         */
-        if((iobuf->level = read(fd, &iobuf->buffer, IO_BUFFER)) <= 0) {
-            /* an error occured */
-            return -1;
-        }
-
-        /* align data to the end of the buffer if less than IO_BUFFER bytes were read */
-        memmove(iobuf->buffer + (IO_BUFFER - iobuf->level), iobuf->buffer, iobuf->level);
-    }
-
-    return 0;
-}
-
-/******************************************************************************
-Description.: Read a single line from the provided fildescriptor.
-              This funtion will return under two conditions:
-              * line end was reached
-              * timeout occured
-Input Value.: * fd.....: fildescriptor to read from
-              * iobuf..: iobuffer that allows to use this functions from multiple
-                         threads because the complete context is the iobuffer.
-              * buffer.: The buffer to store values at, will be set to zero
-                         before storing values.
-              * len....: the length of buffer
-              * timeout: seconds to wait for an answer
-Return Value: * buffer.: will become filled with bytes read
-              * iobuf..: May get altered to save the context for future calls.
-              * func().: bytes copied to buffer or -1 in case of error
-******************************************************************************/
-/* read just a single line or timeout */
-int _readline(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout)
-{
-    char c = '\0', *out = buffer;
-    int i;
-
-    memset(buffer, 0, len);
-
-    for(i = 0; i < len && c != '\n'; i++) {
-        if(_read(fd, iobuf, &c, 1, timeout) <= 0) {
-            /* timeout or error occured */
-            return -1;
-        }
-        *out++ = c;
-    }
-
-    return i;
-}
-
 /******************************************************************************
 Description.: Decodes the data and stores the result to the same buffer.
               The buffer will be large enough, because base64 requires more
@@ -396,238 +294,814 @@ void update_client_timestamp(client_info *client)
 #endif
 
 /******************************************************************************
-Description.: Send a complete HTTP response and a single JPG-frame.
-Input Value.: fildescriptor fd to send the answer to
-Return Value: -
+Description.: Opens an anonymous file that takes a complete answer. This
+              allows to render answers with the simple blocking functions
+              below and transmit them afterwards without blocking the
+              event loop.
+Input Value.: -
+Return Value: filedescriptor or -1 in case of error
 ******************************************************************************/
-void send_snapshot(cfd *context_fd, int input_number)
+static int spool_open(void)
 {
-    unsigned char *frame = NULL;
-    int frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    FILE *f;
+    int fd;
 
-    /* wait for a fresh frame */
-    pthread_mutex_lock(&pglobal->in[input_number].db);
-    pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+#ifdef MFD_CLOEXEC
+    if((fd = memfd_create("mjpg-streamer", MFD_CLOEXEC)) >= 0)
+        return fd;
+#endif
 
-    /* read buffer */
-    frame_size = pglobal->in[input_number].size;
+    /* fall back to a temporary file if memfd is not available */
+    if((f = tmpfile()) == NULL)
+        return -1;
+    fd = dup(fileno(f));
+    fclose(f);
 
-    /* allocate a buffer for this single frame */
-    if((frame = malloc(frame_size + 1)) == NULL) {
-        free(frame);
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
-        send_error(context_fd->fd, 500, "not enough memory");
-        return;
-    }
-    /* copy v4l2_buffer timeval to user space */
-    timestamp = pglobal->in[input_number].timestamp;
+    return fd;
+}
 
-    memcpy(frame, pglobal->in[input_number].buf, frame_size);
-    DBG("got frame (size: %d kB)\n", frame_size / 1024);
+/******************************************************************************
+Description.: returns the spool of a client, it is opened on first use
+Input Value.: the connected client
+Return Value: filedescriptor to write the answer to
+******************************************************************************/
+static int client_spool(connection *c)
+{
+    if(c->spool < 0)
+        c->spool = spool_open();
 
-    pthread_mutex_unlock(&pglobal->in[input_number].db);
+    return c->spool;
+}
 
-    #ifdef MANAGMENT
-    update_client_timestamp(context_fd->client);
-    #endif
+/******************************************************************************
+Description.: changes the events epoll reports for a client
+Input Value.: * c......: the connected client
+              * events.: EPOLLIN, EPOLLOUT or 0 to only get errors reported
+Return Value: -
+******************************************************************************/
+static void client_watch(connection *c, unsigned int events)
+{
+    struct epoll_event ev;
 
-    /* write the response */
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            STD_HEADER \
-            "Content-type: image/jpeg\r\n" \
-            "X-Timestamp: %d.%06d\r\n" \
-            "\r\n", (int) timestamp.tv_sec, (int) timestamp.tv_usec);
-
-    /* send header and image now */
-    if (write(context_fd->fd, buffer, strlen(buffer)) < 0 ||
-        write(context_fd->fd, frame, frame_size) < 0) {
-        free(frame);
+    if(c->events == events)
         return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = c;
+    if(epoll_ctl(c->lp->epfd, EPOLL_CTL_MOD, c->fd, &ev) == 0)
+        c->events = events;
+}
+
+/******************************************************************************
+Description.: Wraps a frame into a part and prepares the header of the
+              multipart answer, so it is built only once per frame.
+Input Value.: the frame, the reference of the caller gets moved into the part
+Return Value: the part with one reference or NULL in case of error
+******************************************************************************/
+static part *part_new(input_frame *frame)
+{
+    part *p;
+
+    if((p = malloc(sizeof(part))) == NULL) {
+        input_frame_release(frame);
+        return NULL;
     }
 
-    free(frame);
+    p->frame = frame;
+    p->refcount = 1;
+
+    /*
+     * print the individual mimetype and the length
+     * sending the content-length fixes random stream disruption observed
+     * with firefox
+     */
+    p->head_len = snprintf(p->head, sizeof(p->head), "Content-Type: image/jpeg\r\n" \
+                           "Content-Length: %d\r\n" \
+                           "X-Timestamp: %d.%06d\r\n" \
+                           "X-Sequence: %u\r\n" \
+                           "\r\n", frame->size, (int)frame->timestamp.tv_sec, (int)frame->timestamp.tv_usec, frame->seq);
+
+    return p;
 }
 
 /******************************************************************************
-Description.: Send a complete HTTP response and a stream of JPG-frames.
-Input Value.: fildescriptor fd to send the answer to
+Description.: Formats the entity tag of a frame. The timestamp keeps tags
+              unique across restarts of the server.
+Input Value.: * frame..: the frame
+              * buf....: buffer to store the tag, including the quotes
+              * len....: size of the buffer
 Return Value: -
 ******************************************************************************/
-void send_stream(cfd *context_fd, int input_number)
+static void frame_etag(input_frame *frame, char *buf, size_t len)
 {
-    unsigned char *frame = NULL, *tmp = NULL;
-    int frame_size = 0, max_frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    snprintf(buf, len, "\"%u-%ld%06ld\"", frame->seq,
+             (long)frame->timestamp.tv_sec, (long)frame->timestamp.tv_usec);
+}
 
-    DBG("preparing header\n");
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Access-Control-Allow-Origin: *\r\n" \
-            STD_HEADER \
-            "Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n" \
-            "\r\n" \
-            "--" BOUNDARY "\r\n");
+/******************************************************************************
+Description.: Checks if an If-None-Match header names the tag of a frame. The
+              header is "*" or a comma separated list of quoted tags, weak
+              ones are prefixed with "W/". Only whole tags match.
+Input Value.: * list...: value of the header
+              * etag...: quoted tag of the frame
+Return Value: 1 if the client has the frame already, 0 otherwise
+******************************************************************************/
+static int etag_match(const char *list, const char *etag)
+{
+    size_t len = strlen(etag), n;
+    const char *tag;
+
+    for(tag = list; *tag != '\0'; tag += n) {
+        tag += strspn(tag, " \t,");
+        n = strcspn(tag, ",");
+
+        /* without the whitespace in front of the next comma */
+        while(n > 0 && (tag[n - 1] == ' ' || tag[n - 1] == '\t'))
+            n--;
+
+        if(n == 1 && tag[0] == '*')
+            return 1;
+        if(n == len + 2 && strncmp(tag, "W/", 2) == 0 && strncmp(tag + 2, etag, len) == 0)
+            return 1;
+        if(n == len && strncmp(tag, etag, len) == 0)
+            return 1;
+    }
+
+    return 0;
+}
 
-    if(write(context_fd->fd, buffer, strlen(buffer)) < 0) {
-        free(frame);
+/******************************************************************************
+Description.: drops a reference to a part, the last one releases the frame
+Input Value.: the part, NULL is ignored
+Return Value: -
+******************************************************************************/
+static void part_release(part *p)
+{
+    if(p == NULL || --p->refcount > 0)
         return;
+
+    input_frame_release(p->frame);
+    free(p);
+}
+
+/******************************************************************************
+Description.: releases a work, its client does not refer to it any more
+Input Value.: the work
+Return Value: -
+******************************************************************************/
+static void work_free(work *w)
+{
+    w->c->work = NULL;
+    free(w->parameter);
+    free(w->query_string);
+    free(w);
+}
+
+/******************************************************************************
+Description.: Closes the connection and releases all resources of a client.
+              The structure itself stays valid until the end of the current
+              epoll round, because further events may still refer to it.
+Input Value.: the connected client
+Return Value: -
+******************************************************************************/
+static void client_close(connection *c)
+{
+    loop *lp = c->lp;
+
+    DBG("closing connection, fd: %d\n", c->fd);
+
+    if(c->type == A_STREAM || c->type == A_STREAM_WXP) {
+        syslog(LOG_INFO, "client %s: %u frames sent, %u skipped\n", c->address, c->frames_sent, c->frames_skipped);
+        DBG("client %s: %u frames sent, %u skipped\n", c->address, c->frames_sent, c->frames_skipped);
     }
 
-    DBG("Headers send, sending stream now\n");
+    epoll_ctl(lp->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
 
-    while(!pglobal->stop) {
+    if(c->consumer) {
+        input_consumer_detach(&pglobal->in[c->input_number], c->fps);
+        if(c->type == A_STREAM || c->type == A_STREAM_WXP)
+            metric_add(c->pc->metrics.stream_clients, -1);
+    }
+    c->consumer = 0;
 
-        /* wait for fresh frames */
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+    /* a worker owns its work until it hands it back, see loop_cleanup() */
+    if(c->work != NULL && c->state != C_WORK) {
+        close(c->work->fd);
+        work_free(c->work);
+    }
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+    if(c->spool >= 0)
+        close(c->spool);
+    part_release(c->part);
+    c->part = NULL;
+    while(c->zc_count > 0)
+        part_release(c->zc[--c->zc_count].part);
+    free(c->request);
+    c->request = NULL;
+
+    /* move it from the list of clients to the list of closed ones */
+    if(c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        lp->clients = c->next;
+    if(c->next != NULL)
+        c->next->prev = c->prev;
+
+    c->state = C_CLOSED;
+    c->prev = NULL;
+    c->next = lp->closed;
+    lp->closed = c;
+}
 
-        /* check if framebuffer is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
+/******************************************************************************
+Description.: appends a memory buffer to the segments to send
+Input Value.: * c......: the connected client
+              * buf....: data, must stay valid until it was sent
+              * len....: number of bytes
+Return Value: -
+******************************************************************************/
+static void client_segment(connection *c, const void *buf, size_t len)
+{
+    segment *seg = &c->seg[c->seg_count++];
 
-            max_frame_size = frame_size + TEN_K;
-            if((tmp = realloc(frame, max_frame_size)) == NULL) {
-                free(frame);
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                send_error(context_fd->fd, 500, "not enough memory");
-                return;
+    seg->buf = buf;
+    seg->len = len;
+    seg->fd = -1;
+    seg->offset = 0;
+}
+
+/******************************************************************************
+Description.: Sends as much of the prepared segments as the socket accepts
+              without blocking. Consecutive memory segments are passed to
+              the kernel with a single sendmsg() call.
+Input Value.: the connected client
+Return Value: 1 if everything was sent, 0 if the socket is full and
+              -1 in case of error
+******************************************************************************/
+static int client_flush(connection *c)
+{
+    struct iovec iov[MAX_SEGMENTS];
+    struct msghdr msg;
+    segment *seg;
+    ssize_t n;
+    int i, flags;
+
+    while(c->seg_pos < c->seg_count) {
+        seg = &c->seg[c->seg_pos];
+
+        if(seg->len == 0) {
+            c->seg_pos++;
+            continue;
+        }
+
+        if(seg->fd >= 0) {
+            n = sendfile(c->fd, seg->fd, &seg->offset, seg->len);
+        } else {
+            /* gather all memory segments up to the next file */
+            memset(&msg, 0, sizeof(msg));
+            for(i = c->seg_pos; i < c->seg_count && c->seg[i].fd < 0; i++) {
+                iov[msg.msg_iovlen].iov_base = (void *)c->seg[i].buf;
+                iov[msg.msg_iovlen].iov_len = c->seg[i].len;
+                msg.msg_iovlen++;
+            }
+            msg.msg_iov = iov;
+
+            /* a file follows, do not push out a partial frame */
+            flags = MSG_NOSIGNAL;
+            if(i < c->seg_count)
+                flags |= MSG_MORE;
+            #ifdef MSG_ZEROCOPY
+            if(c->zc_frame)
+                flags |= MSG_ZEROCOPY;
+            #endif
+
+            n = sendmsg(c->fd, &msg, flags);
+
+            /* the kernel numbers each successful zerocopy send */
+            if(n > 0 && c->zc_frame) {
+                c->zc_next++;
+                c->zc_used = 1;
             }
+        }
 
-            frame = tmp;
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            metric_add(c->pc->metrics.send_errors, 1);
+            return -1;
         }
 
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
+        /* the file got shorter than expected */
+        if(n == 0) {
+            metric_add(c->pc->metrics.send_errors, 1);
+            return -1;
+        }
+        metric_add(c->pc->metrics.bytes_sent, n);
 
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-        DBG("got frame (size: %d kB)\n", frame_size / 1024);
+        if(seg->fd >= 0) {
+            seg->len -= n;
+            continue;
+        }
 
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+        /* advance over everything that was sent */
+        for(i = c->seg_pos; n > 0; i++) {
+            if((size_t)n < c->seg[i].len) {
+                c->seg[i].buf = (const char *)c->seg[i].buf + n;
+                c->seg[i].len -= n;
+                break;
+            }
+            n -= c->seg[i].len;
+            c->seg[i].len = 0;
+        }
+    }
 
-        #ifdef MANAGMENT
-        update_client_timestamp(context_fd->client);
-        #endif
+    return 1;
+}
 
-        /*
-         * print the individual mimetype and the length
-         * sending the content-length fixes random stream disruption observed
-         * with firefox
-         */
-        sprintf(buffer, "Content-Type: image/jpeg\r\n" \
-                "Content-Length: %d\r\n" \
-                "X-Timestamp: %d.%06d\r\n" \
-                "\r\n", frame_size, (int)timestamp.tv_sec, (int)timestamp.tv_usec);
-        DBG("sending intemdiate header\n");
-        if(write(context_fd->fd, buffer, strlen(buffer)) < 0) break;
+/******************************************************************************
+Description.: Checks if a stream client keeps up with the frames. A client
+              that is still busy with the last frame or has more than a
+              frame queued in its socket buffer skips the new frame, so it
+              continues with the newest one instead of falling behind.
+Input Value.: * c......: the connected client
+              * frame..: the new frame
+Return Value: 1 if the client should skip the frame, 0 otherwise
+******************************************************************************/
+static int client_backlogged(connection *c, input_frame *frame)
+{
+    int queued = 0;
+
+    if(c->type != A_STREAM && c->type != A_STREAM_WXP)
+        return 0;
+
+    if(c->state == C_SEND)
+        return 1;
+
+    if(ioctl(c->fd, SIOCOUTQ, &queued) < 0)
+        return 0;
+
+    return queued > frame->size;
+}
+
+/* streams continue with newer frames from client_send() */
+static void client_frame(connection *c);
 
-        DBG("sending frame\n");
-        if(write(context_fd->fd, frame, frame_size) < 0) break;
+/******************************************************************************
+Description.: Continues a stream with a frame that was published while the
+              client was still sending the one before, instead of waiting
+              for the next publish.
+Input Value.: the connected client, done with its last frame
+Return Value: 1 if a newer frame is sent, 0 otherwise
+******************************************************************************/
+static int client_newer(connection *c)
+{
+    input *in = &pglobal->in[c->input_number];
+    input_frame *frame;
+
+    input_lock(in);
+    frame = input_frame_acquire(in);
+    pthread_mutex_unlock(&in->db);
 
-        DBG("sending boundary\n");
-        sprintf(buffer, "\r\n--" BOUNDARY "\r\n");
-        if(write(context_fd->fd, buffer, strlen(buffer)) < 0) break;
+    if(frame == NULL)
+        return 0;
+
+    if((int)(frame->seq - c->last_seq) <= 0 || client_backlogged(c, frame) ||
+       !frame_pace_due(&c->pace, c->fps, &frame->timestamp)) {
+        input_frame_release(frame);
+        return 0;
     }
 
-    free(frame);
+    if((c->part = part_new(frame)) == NULL)
+        return 0;
+
+    client_frame(c);
+    return 1;
 }
 
-#ifdef WXP_COMPAT
 /******************************************************************************
-Description.: Sends a mjpg stream in the same format as the WebcamXP does
-Input Value.: fildescriptor fd to send the answer to
+Description.: Continues sending to a client. If the answer is complete,
+              streams wait for the next frame and all other clients get
+              disconnected.
+Input Value.: the connected client
 Return Value: -
 ******************************************************************************/
-void send_stream_wxp(cfd *context_fd, int input_number)
+static void client_send(connection *c)
 {
-    unsigned char *frame = NULL, *tmp = NULL;
-    int frame_size = 0, max_frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
-
-    DBG("preparing header\n");
-
-    time_t curDate, expiresDate;
-    curDate = time(NULL);
-    expiresDate = curDate - 1380; // teh expires date is before the current date with 23 minute (1380) sec
-
-    char curDateBuffer[80];
-    char expDateBuffer[80];
-
-    strftime(curDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&curDate));
-    strftime(expDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&expiresDate));
-    sprintf(buffer, "HTTP/1.1 200 OK\r\n" \
-                    "Connection: keep-alive\r\n" \
-                    "Content-Type: multipart/x-mixed-replace; boundary=--myboundary\r\n" \
-                    "Content-Length: 9999999\r\n" \
-                    "Cache-control: no-cache, must revalidate\r\n" \
-                    "Date: %s\r\n" \
-                    "Expires: %s\r\n" \
-                    "Pragma: no-cache\r\n" \
-                    "Server: webcamXP\r\n"
-                    "\r\n",
-                    curDateBuffer,
-                    expDateBuffer);
-
-    if(write(context_fd->fd, buffer, strlen(buffer)) < 0) {
-        free(frame);
+    int rc = client_flush(c);
+
+    if(rc < 0) {
+        client_close(c);
         return;
     }
 
-    DBG("Headers send, sending stream now\n");
+    if(rc == 0) {
+        client_watch(c, EPOLLOUT);
+        return;
+    }
 
-    while(!pglobal->stop) {
+    /* the kernel may still read from the frame, keep it until it is done */
+    if(c->zc_used) {
+        c->zc[c->zc_count].part = c->part;
+        c->zc[c->zc_count].id = c->zc_next - 1;
+        c->zc_count++;
+    } else {
+        part_release(c->part);
+    }
+    c->part = NULL;
+    c->zc_frame = 0;
+    c->zc_used = 0;
+
+    if(c->type == A_STREAM || c->type == A_STREAM_WXP) {
+        c->state = C_WAIT_FRAME;
+        if(client_newer(c))
+            return;
+        client_watch(c, 0);
+    } else {
+        client_close(c);
+    }
+}
+
+/******************************************************************************
+Description.: Formats the X-Stages header line with the wall clock times a
+              frame got captured, encoded and published and the time it is
+              sent now. Times the input plugin does not know are 0.000000.
+Input Value.: * frame..: the frame
+              * buf....: destination
+              * size...: size of the destination
+Return Value: length of the line
+******************************************************************************/
+static int frame_stages(input_frame *frame, char *buf, size_t size)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return snprintf(buf, size, "X-Stages: captured=%ld.%06ld encoded=%ld.%06ld published=%ld.%06ld sent=%ld.%06ld\r\n",
+                    (long)frame->captured.tv_sec, (long)frame->captured.tv_usec,
+                    (long)frame->encoded.tv_sec, (long)frame->encoded.tv_usec,
+                    (long)frame->published.tv_sec, (long)frame->published.tv_usec,
+                    (long)now.tv_sec, (long)now.tv_usec);
+}
+
+/******************************************************************************
+Description.: Takes the latest frame of the input the client asked for,
+              unless the client wants to wait for a fresh one.
+Input Value.: the connected client
+Return Value: part of the latest frame or NULL
+******************************************************************************/
+static part *client_latest(connection *c)
+{
+    input *in = &pglobal->in[c->input_number];
+    input_frame *frame;
+
+    if(c->wait)
+        return NULL;
+
+    input_lock(in);
+    frame = input_frame_acquire(in);
+    pthread_mutex_unlock(&in->db);
+
+    if(frame == NULL)
+        return NULL;
+
+    return part_new(frame);
+}
+
+/******************************************************************************
+Description.: appends header, JPEG and boundary of a stream part
+Input Value.: the connected client, c->part must be set
+Return Value: -
+******************************************************************************/
+static void client_part(connection *c)
+{
+    int len;
+
+    if(c->stages) {
+        /* a header of its own, the shared one without its empty line */
+        len = c->part->head_len - 2;
+        memcpy(c->part_head, c->part->head, len);
+        len += frame_stages(c->part->frame, c->part_head + len, sizeof(c->part_head) - len - 2);
+        memcpy(c->part_head + len, "\r\n", 2);
+        client_segment(c, c->part_head, len + 2);
+    } else {
+        client_segment(c, c->part->head, c->part->head_len);
+    }
+    client_segment(c, c->part->frame->buf, c->part->frame->size);
+    client_segment(c, "\r\n--" BOUNDARY "\r\n", strlen("\r\n--" BOUNDARY "\r\n"));
+}
+
+/******************************************************************************
+Description.: Sends the frame referenced by the client. Snapshots get the
+              complete HTTP response, streams the next part of the
+              multipart answer.
+Input Value.: the connected client, c->part must be set
+Return Value: -
+******************************************************************************/
+static void client_frame(connection *c)
+{
+    input_frame *frame = c->part->frame;
+
+    DBG("got frame (size: %d kB)\n", frame->size / 1024);
 
-        /* wait for fresh frames */
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+    #ifdef MANAGMENT
+    update_client_timestamp(c->client);
+    #endif
+
+    c->seg_count = 0;
+    c->seg_pos = 0;
+    c->frames_sent++;
+    c->frames_skipped += input_frame_gap(&c->last_seq, frame);
+    metric_add(c->pc->metrics.frames_sent, 1);
+
+    switch(c->type) {
+    case A_STREAM:
+        /*
+         * header and boundary are shared by all clients and stay valid
+         * as long as the part, so the frame qualifies for zerocopy
+         */
+        c->zc_frame = (c->zerocopy && !c->stages && frame->size >= ZEROCOPY_MIN &&
+                       c->zc_count < ZEROCOPY_PENDING);
+        c->zc_used = 0;
+
+        /* header and boundary are shared by all clients */
+        client_part(c);
+        break;
+
+    case A_STREAM_WXP:
+        memset(c->head, 0, 50*sizeof(char));
+        sprintf(c->head, "mjpeg %07d12345", frame->size);
+        client_segment(c, c->head, 50);
+        client_segment(c, frame->buf, frame->size);
+        break;
+
+    default: {
+        char etag[64];
+        int len;
+
+        frame_etag(frame, etag, sizeof(etag));
+
+        /* the client already has this frame */
+        if(etag_match(c->etag, etag)) {
+            sprintf(c->head, "HTTP/1.0 304 Not Modified\r\n" \
+                    SNAPSHOT_HEADER \
+                    "ETag: %s\r\n" \
+                    "X-Sequence: %u\r\n" \
+                    "\r\n", etag, frame->seq);
+            client_segment(c, c->head, strlen(c->head));
+            break;
+        }
+
+        len = sprintf(c->head, "HTTP/1.0 200 OK\r\n" \
+                      SNAPSHOT_HEADER \
+                      "Content-type: image/jpeg\r\n" \
+                      "Content-Length: %d\r\n" \
+                      "ETag: %s\r\n" \
+                      "X-Timestamp: %d.%06d\r\n" \
+                      "X-Sequence: %u\r\n", frame->size, etag, (int) frame->timestamp.tv_sec, (int) frame->timestamp.tv_usec, frame->seq);
+        if(c->stages)
+            len += frame_stages(frame, c->head + len, sizeof(c->head) - len - 2);
+        memcpy(c->head + len, "\r\n", 2);
+        client_segment(c, c->head, len + 2);
+        client_segment(c, frame->buf, frame->size);
+        } break;
+    }
+
+    c->state = C_SEND;
+    client_send(c);
+}
+
+/******************************************************************************
+Description.: Starts to answer a request for snapshots or streams. Both are
+              served from the latest frame right away, streams continue
+              with the frames published later on. With "wait=1" the
+              client waits for the next frame instead.
+Input Value.: the connected client
+Return Value: -
+******************************************************************************/
+static void client_start(connection *c)
+{
+    c->seg_count = 0;
+    c->seg_pos = 0;
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+    /* an idle input captures again as long as the client is connected */
+    input_consumer_attach(&pglobal->in[c->input_number], c->fps);
+    c->consumer = 1;
+    if(c->type == A_STREAM || c->type == A_STREAM_WXP)
+        metric_add(c->pc->metrics.stream_clients, 1);
 
-        /* check if framebuffer is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
+    switch(c->type) {
+    case A_STREAM:
+        DBG("preparing header\n");
+        sprintf(c->head, "HTTP/1.0 200 OK\r\n" \
+                "Access-Control-Allow-Origin: *\r\n" \
+                STD_HEADER \
+                "Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n" \
+                "\r\n" \
+                "--" BOUNDARY "\r\n");
+        break;
 
-            max_frame_size = frame_size + TEN_K;
-            if((tmp = realloc(frame, max_frame_size)) == NULL) {
-                free(frame);
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                send_error(context_fd->fd, 500, "not enough memory");
+    #ifdef WXP_COMPAT
+    case A_STREAM_WXP: {
+        time_t curDate, expiresDate;
+        char curDateBuffer[80];
+        char expDateBuffer[80];
+
+        DBG("preparing header\n");
+
+        curDate = time(NULL);
+        expiresDate = curDate - 1380; // teh expires date is before the current date with 23 minute (1380) sec
+
+        strftime(curDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&curDate));
+        strftime(expDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&expiresDate));
+        sprintf(c->head, "HTTP/1.1 200 OK\r\n" \
+                         "Connection: keep-alive\r\n" \
+                         "Content-Type: multipart/x-mixed-replace; boundary=--myboundary\r\n" \
+                         "Content-Length: 9999999\r\n" \
+                         "Cache-control: no-cache, must revalidate\r\n" \
+                         "Date: %s\r\n" \
+                         "Expires: %s\r\n" \
+                         "Pragma: no-cache\r\n" \
+                         "Server: webcamXP\r\n"
+                         "\r\n",
+                         curDateBuffer,
+                         expDateBuffer);
+        } break;
+    #endif
+
+    default:
+        if((c->part = client_latest(c)) != NULL) {
+            if(!c->after_set || (int)(c->part->frame->seq - c->after) > 0) {
+                client_frame(c);
                 return;
             }
 
-            frame = tmp;
+            /* the client knows this frame already, long-poll for the next */
+            part_release(c->part);
+            c->part = NULL;
         }
 
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
+        /* nothing (new) was published yet, wait for the next frame */
+        c->state = C_WAIT_FRAME;
+        client_watch(c, 0);
+        return;
+    }
 
-        #ifdef MANAGMENT
-        update_client_timestamp(context_fd->client);
-        #endif
+    client_segment(c, c->head, strlen(c->head));
 
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-        DBG("got frame (size: %d kB)\n", frame_size / 1024);
+    if(c->type == A_STREAM && (c->part = client_latest(c)) != NULL) {
+        frame_pace_due(&c->pace, c->fps, &c->part->frame->timestamp);
+        c->frames_sent++;
+        input_frame_gap(&c->last_seq, c->part->frame);
+        metric_add(c->pc->metrics.frames_sent, 1);
+        client_part(c);
+    }
 
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+    c->state = C_SEND;
+    client_send(c);
+}
 
-        memset(buffer, 0, 50*sizeof(char));
-        sprintf(buffer, "mjpeg %07d12345", frame_size);
-        DBG("sending intemdiate header\n");
-        if(write(context_fd->fd, buffer, 50) < 0) break;
+/******************************************************************************
+Description.: sends the answer that was rendered to the spool of a client
+Input Value.: the connected client
+Return Value: -
+******************************************************************************/
+static void client_reply(connection *c)
+{
+    off_t len = (c->spool < 0) ? 0 : lseek(c->spool, 0, SEEK_END);
 
-        DBG("sending frame\n");
-        if(write(context_fd->fd, frame, frame_size) < 0) break;
+    if(len <= 0) {
+        client_close(c);
+        return;
     }
 
-    free(frame);
+    c->seg[0].buf = NULL;
+    c->seg[0].len = len;
+    c->seg[0].fd = c->spool;
+    c->seg[0].offset = 0;
+    c->seg_count = 1;
+    c->seg_pos = 0;
+
+    c->state = C_SEND;
+    client_send(c);
+}
+
+/******************************************************************************
+Description.: Prepares a command or CGI script to be run by a worker thread
+              once the request is evaluated. If that is not possible it
+              runs right away.
+Input Value.: * c......: the connected client
+              * type...: A_COMMAND or A_CGI
+              * parameter, query_string: of the request, get copied
+Return Value: -
+******************************************************************************/
+static void client_defer(connection *c, answer_t type, char *parameter, char *query_string)
+{
+    work *w = calloc(1, sizeof(work));
+
+    if(w == NULL ||
+       (parameter != NULL && (w->parameter = strdup(parameter)) == NULL) ||
+       (query_string != NULL && (w->query_string = strdup(query_string)) == NULL) ||
+       (w->fd = dup(client_spool(c))) < 0) {
+        if(w != NULL) {
+            free(w->parameter);
+            free(w->query_string);
+            free(w);
+        }
+        if(type == A_COMMAND)
+            command(c->pc->id, client_spool(c), parameter);
+        else
+            execute_cgi(c->pc->id, client_spool(c), parameter, query_string);
+        return;
+    }
+
+    w->c = c;
+    w->lp = c->lp;
+    w->type = type;
+    w->id = c->pc->id;
+    c->work = w;
+}
+
+/******************************************************************************
+Description.: Runs a command or CGI script and hands the client back to its
+              event loop. The client stays valid meanwhile, it is not
+              watched by the loop and loop_cleanup() waits for the worker.
+Input Value.: the work
+Return Value: always NULL
+******************************************************************************/
+static void *work_thread(void *arg)
+{
+    work *w = arg;
+    loop *lp = w->lp;
+
+    if(w->type == A_COMMAND)
+        command(w->id, w->fd, w->parameter);
+    else
+        execute_cgi(w->id, w->fd, w->parameter, w->query_string);
+    close(w->fd);
+
+    if(write(lp->work_pipe[1], &w, sizeof(w)) != sizeof(w))
+        perror("Unable to hand the client back to the event loop");
+
+    /* the loop may be gone once the count drops, do not touch it afterwards */
+    pthread_mutex_lock(&lp->work_mutex);
+    if(--lp->workers == 0)
+        pthread_cond_broadcast(&lp->work_done);
+    pthread_mutex_unlock(&lp->work_mutex);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: Sends the answer a worker rendered and releases the work.
+Input Value.: the work, its client is in state C_WORK
+Return Value: -
+******************************************************************************/
+static void client_worked(work *w)
+{
+    connection *c = w->c;
+    struct epoll_event ev;
+
+    work_free(w);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.data.ptr = c;
+    if(epoll_ctl(c->lp->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+        client_close(c);
+        return;
+    }
+    c->events = 0;
+
+    client_reply(c);
+}
+
+/******************************************************************************
+Description.: Starts a worker thread for the command or CGI script of a
+              client. The client is taken out of epoll meanwhile, a hangup
+              would be reported over and over again otherwise.
+Input Value.: the connected client, c->work must be set
+Return Value: -
+******************************************************************************/
+static void client_work(connection *c)
+{
+    pthread_t thread;
+
+    epoll_ctl(c->lp->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    c->state = C_WORK;
+
+    pthread_mutex_lock(&c->lp->work_mutex);
+    c->lp->workers++;
+    pthread_mutex_unlock(&c->lp->work_mutex);
+
+    if(pthread_create(&thread, NULL, work_thread, c->work) != 0) {
+        DBG("could not start a worker, running it in the event loop\n");
+        work_thread(c->work);
+        return;
+    }
+    pthread_detach(thread);
 }
-#endif
 
 /******************************************************************************
 Description.: Send error messages and headers.
@@ -1015,43 +1489,29 @@ void command(int id, int fd, char *parameter)
 }
 
 /******************************************************************************
-Description.: Serve a connected TCP-client. This thread function is called
-              for each connect of a HTTP client like a webbrowser. It determines
-              if it is a valid HTTP request and dispatches between the different
-              response options.
-Input Value.: arg is the filedescriptor and server-context of the connected TCP
-              socket. It must have been allocated so it is freeable by this
-              thread function.
-Return Value: always NULL
+Description.: Serve a connected TCP-client. This function is called as soon
+              as the complete request header of a HTTP client like a
+              webbrowser was received. It determines if it is a valid HTTP
+              request and dispatches between the different response options.
+              Snapshots and streams are just prepared, all other answers get
+              rendered to the spool of the client.
+Input Value.: the connected client, c->request holds the request header
+Return Value: -, c->type tells how to continue
 ******************************************************************************/
-/* thread for clients that connected to this server */
-void *client_thread(void *arg)
+void handle_request(connection *c)
 {
-    int cnt;
     char query_suffixed = 0;
     int input_number = 0;
-    char buffer[BUFFER_SIZE] = {0}, *pb = buffer;
-    iobuffer iobuf;
+    char buffer[BUFFER_SIZE] = {0}, *pb = buffer, *line, *next;
     request req;
-    cfd lcfd; /* local-connected-file-descriptor */
-
-    /* we really need the fildescriptor and it must be freeable by us */
-    if(arg != NULL) {
-        memcpy(&lcfd, arg, sizeof(cfd));
-        free(arg);
-    } else
-        return NULL;
 
     /* initializes the structures */
-    init_iobuffer(&iobuf);
     init_request(&req);
 
     /* What does the client want to receive? Read the request. */
-    memset(buffer, 0, sizeof(buffer));
-    if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-        close(lcfd.fd);
-        return NULL;
-    }
+    line = c->request;
+    next = strchr(line, '\n');
+    strncpy(buffer, line, MIN(next - line + 1, sizeof(buffer) - 1));
 
     req.query_string = NULL;
 
@@ -1060,10 +1520,10 @@ void *client_thread(void *arg)
         req.type = A_SNAPSHOT;
         query_suffixed = 255;
         #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
+        if (check_client_status(c->client)) {
             req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
+            c->client->last_take_time.tv_sec += piggy_fine;
+            send_error(client_spool(c), 403, "frame already sent");
             query_suffixed = 0;
         }
         #endif
@@ -1072,10 +1532,10 @@ void *client_thread(void *arg)
         req.type = A_SNAPSHOT_WXP;
         query_suffixed = 255;
         #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
+        if (check_client_status(c->client)) {
             req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
+            c->client->last_take_time.tv_sec += piggy_fine;
+            send_error(client_spool(c), 403, "frame already sent");
             query_suffixed = 0;
         }
         #endif
@@ -1084,10 +1544,10 @@ void *client_thread(void *arg)
         req.type = A_STREAM;
         query_suffixed = 255;
         #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
+        if (check_client_status(c->client)) {
             req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
+            c->client->last_take_time.tv_sec += piggy_fine;
+            send_error(client_spool(c), 403, "frame already sent");
             query_suffixed = 0;
         }
         #endif
@@ -1095,10 +1555,10 @@ void *client_thread(void *arg)
         req.type = A_STREAM;
         query_suffixed = 255;
         #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
+        if (check_client_status(c->client)) {
             req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
+            c->client->last_take_time.tv_sec += piggy_fine;
+            send_error(client_spool(c), 403, "frame already sent");
             query_suffixed = 0;
         }
         #endif
@@ -1107,10 +1567,10 @@ void *client_thread(void *arg)
         req.type = A_STREAM_WXP;
         query_suffixed = 255;
         #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
+        if (check_client_status(c->client)) {
             req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
+            c->client->last_take_time.tv_sec += piggy_fine;
+            send_error(client_spool(c), 403, "frame already sent");
             query_suffixed = 0;
         }
         #endif
@@ -1123,10 +1583,10 @@ void *client_thread(void *arg)
         /* advance by the length of known string */
         if((pb = strstr(buffer, "GET /?action=take")) == NULL) {
             DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            query_suffixed = 0;
-            return NULL;
+            send_error(client_spool(c), 400, "Malformed HTTP request");
+            free_request(&req);
+            c->type = A_UNKNOWN;
+            return;
         }
         pb += strlen("GET /?action=take"); // a pb points to thestring after the first & after command
 
@@ -1140,11 +1600,11 @@ void *client_thread(void *arg)
         strncpy(req.parameter, pb, len);
 
         if(unescape(req.parameter) == -1) {
-            free(req.parameter);
-            send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
+            send_error(client_spool(c), 500, "could not properly unescape command parameter string");
             LOG("could not properly unescape command parameter string\n");
-            close(lcfd.fd);
-            return NULL;
+            free_request(&req);
+            c->type = A_UNKNOWN;
+            return;
         }
     } else if((strstr(buffer, "GET /input") != NULL) && (strstr(buffer, ".json") != NULL)) {
         req.type = A_INPUT_JSON;
@@ -1154,6 +1614,9 @@ void *client_thread(void *arg)
         query_suffixed = 255;
     } else if(strstr(buffer, "GET /program.json") != NULL) {
         req.type = A_PROGRAM_JSON;
+    } else if((pb = strstr(buffer, "GET /metrics")) != NULL &&
+              (pb[strlen("GET /metrics")] == ' ' || pb[strlen("GET /metrics")] == '?')) {
+        req.type = A_METRICS;
     #ifdef MANAGMENT
     } else if(strstr(buffer, "GET /clients.json") != NULL) {
         req.type = A_CLIENTS_JSON;
@@ -1165,9 +1628,10 @@ void *client_thread(void *arg)
         /* advance by the length of known string */
         if((pb = strstr(buffer, "GET /?action=command")) == NULL) {
             DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            return NULL;
+            send_error(client_spool(c), 400, "Malformed HTTP request");
+            free_request(&req);
+            c->type = A_UNKNOWN;
+            return;
         }
         pb += strlen("GET /?action=command"); // a pb points to thestring after the first & after command
 
@@ -1182,11 +1646,11 @@ void *client_thread(void *arg)
         strncpy(req.parameter, pb, len);
 
         if(unescape(req.parameter) == -1) {
-            free(req.parameter);
-            send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
+            send_error(client_spool(c), 500, "could not properly unescape command parameter string");
             LOG("could not properly unescape command parameter string\n");
-            close(lcfd.fd);
-            return NULL;
+            free_request(&req);
+            c->type = A_UNKNOWN;
+            return;
         }
 
         DBG("command parameter (len: %d): \"%s\"\n", len, req.parameter);
@@ -1198,9 +1662,10 @@ void *client_thread(void *arg)
 
         if((pb = strstr(buffer, "GET /")) == NULL) {
             DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            return NULL;
+            send_error(client_spool(c), 400, "Malformed HTTP request");
+            free_request(&req);
+            c->type = A_UNKNOWN;
+            return;
         }
 
         pb += strlen("GET /");
@@ -1223,6 +1688,7 @@ void *client_thread(void *arg)
                 if (req.query_string == NULL)
                     exit(EXIT_FAILURE);
                 strncpy(req.query_string, pb, len);
+                req.query_string[len] = '\0';
             } else {
                 req.query_string = malloc(2);
                 if (req.query_string == NULL)
@@ -1242,10 +1708,10 @@ void *client_thread(void *arg)
     if(query_suffixed) {
         char *sch = strchr(buffer, '_');
         if(sch != NULL) {  // there is an _ in the url so the input number should be present
-            DBG("Suffix character: %s\n", sch + 1); // FIXME if more than 10 input plugin is added
+            DBG("Suffix character: %s\n", sch + 1);
             char numStr[3];
             memset(numStr, 0, 3);
-            strncpy(numStr, sch + 1, 1);
+            strncpy(numStr, sch + 1, 2);
             input_number = atoi(numStr);
 
             if ((req.type == A_SNAPSHOT_WXP) || (req.type == A_STREAM_WXP)) { // webcamxp adds offset to the camera number
@@ -1253,20 +1719,43 @@ void *client_thread(void *arg)
             }
         }
         DBG("plugin_no: %d\n", input_number);
+
+        /* skip the latest frame and wait for the next one */
+        if(strstr(buffer, "wait=1") != NULL)
+            c->wait = 1;
+
+        /* latency measurements, every frame tells when it passed which stage */
+        if(strstr(buffer, "stages=1") != NULL)
+            c->stages = 1;
+
+        /* streams at a lower frame rate, the input only delivers what its clients need */
+        if((req.type == A_STREAM || req.type == A_STREAM_WXP) && (pb = strstr(buffer, "fps=")) != NULL)
+            c->fps = MIN(MAX(atoi(pb + strlen("fps=")), 0), INPUT_RATE_MAX);
+
+        /* long-poll for a frame newer than the given sequence number */
+        if(req.type == A_SNAPSHOT && (pb = strstr(buffer, "after=")) != NULL) {
+            int timeout = LONGPOLL_TIMEOUT;
+
+            c->after = strtoul(pb + strlen("after="), NULL, 10);
+            c->after_set = 1;
+            c->wait = 0;
+
+            if((pb = strstr(buffer, "timeout=")) != NULL)
+                timeout = MIN(MAX(atoi(pb + strlen("timeout=")), 1), LONGPOLL_TIMEOUT_MAX);
+            c->deadline = time(NULL) + timeout;
+        }
     }
 
     /*
      * parse the rest of the HTTP-request
      * the end of the request-header is marked by a single, empty line with "\r\n"
      */
-    do {
-        memset(buffer, 0, sizeof(buffer));
+    for(line = next + 1; *line != '\0' && *line != '\r' && *line != '\n'; line = next + 1) {
+        if((next = strchr(line, '\n')) == NULL)
+            break;
 
-        if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-            free_request(&req);
-            close(lcfd.fd);
-            return NULL;
-        }
+        memset(buffer, 0, sizeof(buffer));
+        strncpy(buffer, line, MIN(next - line + 1, sizeof(buffer) - 1));
 
         if(strcasestr(buffer, "User-Agent: ") != NULL) {
             req.client = strdup(buffer + strlen("User-Agent: "));
@@ -1274,18 +1763,21 @@ void *client_thread(void *arg)
             req.credentials = strdup(buffer + strlen("Authorization: Basic "));
             decodeBase64(req.credentials);
             DBG("username:password: %s\n", req.credentials);
+        } else if(strncasecmp(buffer, "If-None-Match: ", strlen("If-None-Match: ")) == 0) {
+            char *tags = buffer + strlen("If-None-Match: ");
+            snprintf(c->etag, sizeof(c->etag), "%.*s", (int)strcspn(tags, "\r\n"), tags);
         }
 
-    } while(cnt > 2 && !(buffer[0] == '\r' && buffer[1] == '\n'));
+    }
 
     /* check for username and password if parameter -c was given */
-    if(lcfd.pc->conf.credentials != NULL) {
-        if(req.credentials == NULL || strcmp(lcfd.pc->conf.credentials, req.credentials) != 0) {
+    if(c->pc->conf.credentials != NULL) {
+        if(req.credentials == NULL || strcmp(c->pc->conf.credentials, req.credentials) != 0) {
             DBG("access denied\n");
-            send_error(lcfd.fd, 401, "username and password do not match to configuration");
-            close(lcfd.fd);
+            send_error(client_spool(c), 401, "username and password do not match to configuration");
             free_request(&req);
-            return NULL;
+            c->type = A_UNKNOWN;
+            return;
         }
         DBG("access granted\n");
     }
@@ -1293,15 +1785,15 @@ void *client_thread(void *arg)
     /* now it's time to answer */
     if (query_suffixed) {
         if (req.type == A_OUTPUT_JSON) {
-            if(!(input_number < pglobal->outcnt)) {
-                DBG("Output number: %d out of range (valid: 0..%d)\n", input_number, pglobal->outcnt-1);
-                send_error(lcfd.fd, 404, "Invalid output plugin number");
+            if(!(input_number < c->pc->pglobal->outcnt)) {
+                DBG("Output number: %d out of range (valid: 0..%d)\n", input_number, c->pc->pglobal->outcnt-1);
+                send_error(client_spool(c), 404, "Invalid output plugin number");
                 req.type = A_UNKNOWN;
             }
         } else {
-            if(!(input_number < pglobal->incnt)) {
-                DBG("Input number: %d out of range (valid: 0..%d)\n", input_number, pglobal->incnt-1);
-                send_error(lcfd.fd, 404, "Invalid input plugin number");
+            if(!(input_number < c->pc->pglobal->incnt)) {
+                DBG("Input number: %d out of range (valid: 0..%d)\n", input_number, c->pc->pglobal->incnt-1);
+                send_error(client_spool(c), 404, "Invalid input plugin number");
                 req.type = A_UNKNOWN;
             }
         }
@@ -1311,48 +1803,49 @@ void *client_thread(void *arg)
     case A_SNAPSHOT_WXP:
     case A_SNAPSHOT:
         DBG("Request for snapshot from input: %d\n", input_number);
-        send_snapshot(&lcfd, input_number);
         break;
     case A_STREAM:
         DBG("Request for stream from input: %d\n", input_number);
-        send_stream(&lcfd, input_number);
         break;
     #ifdef WXP_COMPAT
     case A_STREAM_WXP:
         DBG("Request for WXP compat stream from input: %d\n", input_number);
-        send_stream_wxp(&lcfd, input_number);
         break;
     #endif
     case A_COMMAND:
-        if(lcfd.pc->conf.nocommands) {
-            send_error(lcfd.fd, 501, "this server is configured to not accept commands");
+        if(c->pc->conf.nocommands) {
+            send_error(client_spool(c), 501, "this server is configured to not accept commands");
             break;
         }
-        command(lcfd.pc->id, lcfd.fd, req.parameter);
+        client_defer(c, A_COMMAND, req.parameter, NULL);
         break;
     case A_INPUT_JSON:
         DBG("Request for the Input plugin descriptor JSON file\n");
-        send_input_JSON(lcfd.fd, input_number);
+        send_input_JSON(client_spool(c), input_number);
         break;
     case A_OUTPUT_JSON:
         DBG("Request for the Output plugin descriptor JSON file\n");
-        send_output_JSON(lcfd.fd, input_number);
+        send_output_JSON(client_spool(c), input_number);
         break;
     case A_PROGRAM_JSON:
         DBG("Request for the program descriptor JSON file\n");
-        send_program_JSON(lcfd.fd);
+        send_program_JSON(client_spool(c));
+        break;
+    case A_METRICS:
+        DBG("Request for the metrics\n");
+        send_metrics(client_spool(c));
         break;
     #ifdef MANAGMENT
     case A_CLIENTS_JSON:
         DBG("Request for the clients JSON file\n");
-        send_clients_JSON(lcfd.fd);
+        send_clients_JSON(client_spool(c));
         break;
     #endif
     case A_FILE:
-        if(lcfd.pc->conf.www_folder == NULL)
-            send_error(lcfd.fd, 501, "no www-folder configured");
+        if(c->pc->conf.www_folder == NULL)
+            send_error(client_spool(c), 501, "no www-folder configured");
         else
-            send_file(lcfd.pc->id, lcfd.fd, req.parameter);
+            send_file(c->pc->id, client_spool(c), req.parameter);
         break;
     /*
         With the take argument we try to save the current image to file before we transmit it to the user.
@@ -1384,137 +1877,451 @@ void *client_thread(void *arg)
                         ret = pglobal->out[i].cmd(i, OUT_FILE_CMD_TAKE, IN_CMD_GENERIC, 0, filenamearg);
                     } else {
                         DBG("filename is not specified int the URL\n");
-                        send_error(lcfd.fd, 404, "The &filename= must present for the take command in the URL");
+                        send_error(client_spool(c), 404, "The &filename= must present for the take command in the URL");
                     }
                     break;
                 }
             }
         }
 
-        if (found == 0) {
-            LOG("FILE CHANGE TEST output plugin not loaded\n");
-            send_error(lcfd.fd, 404, "FILE output plugin not loaded, taking snapshot not possible");
+        if (found == 0) {
+            LOG("FILE CHANGE TEST output plugin not loaded\n");
+            send_error(client_spool(c), 404, "FILE output plugin not loaded, taking snapshot not possible");
+        } else {
+            if (ret == 0) {
+                req.type = A_SNAPSHOT;
+            } else {
+                send_error(client_spool(c), 404, "Taking snapshot failed!");
+            }
+        }
+        } break;
+    case A_CGI:
+        DBG("cgi script: %s requested\n", req.parameter);
+        client_defer(c, A_CGI, req.parameter, req.query_string);
+        break;
+    default:
+        DBG("unknown request\n");
+    }
+
+    c->type = req.type;
+    c->input_number = input_number;
+    free_request(&req);
+}
+
+/******************************************************************************
+Description.: Reads the request of a client. As soon as the request header
+              is complete it gets evaluated and the answer starts.
+Input Value.: the connected client
+Return Value: -
+******************************************************************************/
+static void client_read(connection *c)
+{
+    ssize_t n;
+
+    n = recv(c->fd, c->request + c->request_len, MAX_REQUEST_SIZE - 1 - c->request_len, 0);
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if(n <= 0) {
+        client_close(c);
+        return;
+    }
+
+    c->request_len += n;
+    c->request[c->request_len] = '\0';
+
+    /* the end of the request-header is marked by a single, empty line */
+    if(strstr(c->request, "\r\n\r\n") == NULL && strstr(c->request, "\n\n") == NULL) {
+        if(c->request_len < MAX_REQUEST_SIZE - 1)
+            return;
+
+        DBG("request header too large\n");
+        send_error(client_spool(c), 400, "Request header too large");
+        c->type = A_UNKNOWN;
+    } else {
+        handle_request(c);
+    }
+
+    free(c->request);
+    c->request = NULL;
+
+    /* commands and CGI scripts run off the event loop */
+    if(c->work != NULL) {
+        client_work(c);
+        return;
+    }
+
+    /* errors that already got rendered win over snapshots and streams */
+    if(c->spool < 0 &&
+       (c->type == A_SNAPSHOT || c->type == A_SNAPSHOT_WXP ||
+        c->type == A_STREAM || c->type == A_STREAM_WXP)) {
+        client_start(c);
+    } else {
+        client_reply(c);
+    }
+}
+
+/******************************************************************************
+Description.: Reads the notifications of completed zerocopy sends from the
+              error queue of the socket and releases the frames the kernel
+              does not refer to anymore.
+Input Value.: the connected client
+Return Value: 0 if the socket is fine, -1 if a real error is pending
+******************************************************************************/
+static int client_completions(connection *c)
+{
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    int i, j, err = 0;
+    socklen_t len = sizeof(err);
+
+    while(1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if(recvmsg(c->fd, &msg, MSG_ERRQUEUE) < 0)
+            break;
+
+        for(cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                 (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if(serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+                return -1;
+
+            /* sends ee_info up to ee_data are done, drop their frames */
+            for(i = 0, j = 0; i < c->zc_count; i++) {
+                if((int)(c->zc[i].id - serr->ee_data) <= 0)
+                    part_release(c->zc[i].part);
+                else
+                    c->zc[j++] = c->zc[i];
+            }
+            c->zc_count = j;
+        }
+    }
+
+    if(getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: dispatches the events epoll reported for a client
+Input Value.: * c......: the connected client
+              * events.: events reported by epoll
+Return Value: -
+******************************************************************************/
+static void client_event(connection *c, unsigned int events)
+{
+    if(c->state == C_CLOSED)
+        return;
+
+    if(c->state == C_READ_REQUEST && (events & EPOLLIN)) {
+        client_read(c);
+        return;
+    }
+
+    /* completions of zerocopy sends get reported as errors */
+    if(c->zerocopy && (events & EPOLLERR) && !(events & EPOLLHUP)) {
+        if(client_completions(c) < 0) {
+            client_close(c);
+            return;
+        }
+        events &= ~EPOLLERR;
+    }
+
+    if(events & (EPOLLERR | EPOLLHUP)) {
+        client_close(c);
+        return;
+    }
+
+    if(c->state == C_SEND && (events & EPOLLOUT))
+        client_send(c);
+}
+
+/******************************************************************************
+Description.: Accepts all pending connections of a listening socket and
+              registers them with the event loop.
+Input Value.: * lp.....: the event loop
+              * sd.....: the listening socket
+Return Value: -
+******************************************************************************/
+static void loop_accept(loop *lp, int sd)
+{
+    struct sockaddr_storage client_addr;
+    socklen_t addr_len;
+    struct epoll_event ev;
+    char name[NI_MAXHOST];
+    connection *c;
+    int fd;
+
+    while(1) {
+        addr_len = sizeof(struct sockaddr_storage);
+        if((fd = accept4(sd, (struct sockaddr *)&client_addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                DBG("accept failed: %s\n", strerror(errno));
+            }
+            return;
+        }
+
+        if(getnameinfo((struct sockaddr *)&client_addr, addr_len, name, sizeof(name), NULL, 0, NI_NUMERICHOST) == 0) {
+            syslog(LOG_INFO, "serving client: %s\n", name);
+            DBG("serving client: %s\n", name);
         } else {
-            if (ret == 0) {
-                send_snapshot(&lcfd, input_number);
-            } else {
-                send_error(lcfd.fd, 404, "Taking snapshot failed!");
+            strcpy(name, "unknown");
+        }
+
+        if((c = calloc(1, sizeof(connection))) == NULL ||
+           (c->request = malloc(MAX_REQUEST_SIZE)) == NULL) {
+            fprintf(stderr, "failed to allocate (a very small amount of) memory\n");
+            free(c);
+            close(fd);
+            continue;
+        }
+
+        c->fd = fd;
+        c->pc = lp->pc;
+        c->lp = lp;
+        c->state = C_READ_REQUEST;
+        c->events = EPOLLIN;
+        c->deadline = time(NULL) + REQUEST_TIMEOUT;
+        c->spool = -1;
+        strcpy(c->address, name);
+
+        #ifdef SO_ZEROCOPY
+        if(lp->pc->conf.zerocopy) {
+            int on = 1;
+            if(setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0)
+                c->zerocopy = 1;
+            else
+                DBG("setsockopt(SO_ZEROCOPY) failed: %s\n", strerror(errno));
+        }
+        #endif
+
+        #if defined(MANAGMENT)
+        c->client = add_client(name);
+        #endif
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = c->events;
+        ev.data.ptr = c;
+        if(epoll_ctl(lp->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            free(c->request);
+            free(c);
+            close(fd);
+            continue;
+        }
+
+        c->next = lp->clients;
+        if(lp->clients != NULL)
+            lp->clients->prev = c;
+        lp->clients = c;
+    }
+}
+
+/******************************************************************************
+Description.: Hands the latest frame to all clients of this event loop that
+              wait for a frame of an input plugin that published a new one.
+              Stream clients that can not keep up skip frames.
+Input Value.: the event loop
+Return Value: -
+******************************************************************************/
+static void loop_frames(loop *lp)
+{
+    connection *c, *next;
+    input_frame *frame;
+    uint64_t count, pending;
+    part *p;
+    int i;
+
+    if(read(lp->efd, &count, sizeof(count)) < 0)
+        return;
+
+    pending = __sync_fetch_and_and(&lp->pending, 0);
+
+    for(i = 0; i < pglobal->incnt; i++) {
+        if(!(pending & ((uint64_t)1 << i)))
+            continue;
+
+        input_lock(&pglobal->in[i]);
+        frame = input_frame_acquire(&pglobal->in[i]);
+        pthread_mutex_unlock(&pglobal->in[i].db);
+
+        if(frame == NULL || (p = part_new(frame)) == NULL)
+            continue;
+
+        /* every waiting client sends the very same part */
+        for(c = lp->clients; c != NULL; c = next) {
+            next = c->next;
+            if(c->input_number != i || (c->state != C_WAIT_FRAME && c->state != C_SEND))
+                continue;
+
+            /* skipped frames show up as gaps of the sequence numbers */
+            if(client_backlogged(c, frame))
+                continue;
+
+            /* long-polling clients only take frames newer than they know */
+            if(c->after_set && (int)(frame->seq - c->after) <= 0)
+                continue;
+
+            /* streams got this frame already when they started */
+            if(c->last_seq != 0 && (int)(frame->seq - c->last_seq) <= 0)
+                continue;
+
+            if(c->state == C_WAIT_FRAME && c->part == NULL) {
+                /* slower streams than the input runs at */
+                if(!frame_pace_due(&c->pace, c->fps, &frame->timestamp))
+                    continue;
+
+                p->refcount++;
+                c->part = p;
+                client_frame(c);
             }
         }
-        } break;
-    case A_CGI:
-        DBG("cgi script: %s requested\n", req.parameter);
-        execute_cgi(lcfd.pc->id, lcfd.fd, req.parameter, req.query_string);
-        break;
-    default:
-        DBG("unknown request\n");
+
+        part_release(p);
     }
+}
 
-    close(lcfd.fd);
-    free_request(&req);
+/******************************************************************************
+Description.: continues the clients whose command or CGI script is done
+Input Value.: the event loop
+Return Value: -
+******************************************************************************/
+static void loop_work(loop *lp)
+{
+    work *w;
 
-    DBG("leaving HTTP client thread\n");
-    return NULL;
+    while(read(lp->work_pipe[0], &w, sizeof(w)) == sizeof(w))
+        client_worked(w);
 }
 
 /******************************************************************************
-Description.: This function cleans up resources allocated by the server_thread
-Input Value.: arg is not used
+Description.: Disconnects clients that did not send their request in time.
+              Long-polling snapshot requests without a new frame get
+              "304 Not Modified" when their timeout expires.
+Input Value.: the event loop
 Return Value: -
 ******************************************************************************/
-void server_cleanup(void *arg)
+static void loop_timeouts(loop *lp)
 {
-    context *pcontext = arg;
-    int i;
+    connection *c, *next;
+    time_t now = time(NULL);
 
-    OPRINT("cleaning up resources allocated by server thread #%02d\n", pcontext->id);
+    for(c = lp->clients; c != NULL; c = next) {
+        next = c->next;
+        if(now < c->deadline)
+            continue;
 
-    for(i = 0; i < MAX_SD_LEN; i++)
-        close(pcontext->sd[i]);
+        if(c->state == C_READ_REQUEST) {
+            DBG("timeout while reading the request\n");
+            client_close(c);
+        } else if(c->state == C_WAIT_FRAME && c->after_set) {
+            DBG("no frame newer than %u\n", c->after);
+            sprintf(c->head, "HTTP/1.0 304 Not Modified\r\n" \
+                    SNAPSHOT_HEADER \
+                    "X-Sequence: %u\r\n" \
+                    "\r\n", c->after);
+            c->seg_count = 0;
+            c->seg_pos = 0;
+            client_segment(c, c->head, strlen(c->head));
+            c->state = C_SEND;
+            client_send(c);
+        }
+    }
 }
 
 /******************************************************************************
-Description.: Open a TCP socket and wait for clients to connect. If clients
-              connect, start a new thread for each accepted connection.
-Input Value.: arg is a pointer to the globals struct
-Return Value: always NULL, will only return on exit
+Description.: frees clients that were closed during the last epoll round
+Input Value.: the event loop
+Return Value: -
 ******************************************************************************/
-void *server_thread(void *arg)
+static void loop_reap(loop *lp)
+{
+    connection *c;
+
+    while((c = lp->closed) != NULL) {
+        lp->closed = c->next;
+        free(c);
+    }
+}
+
+/******************************************************************************
+Description.: Opens the listening sockets for the configured port
+              (1 socket / address family).
+Input Value.: * pc.....: the server context
+              * sd.....: array of MAX_SD_LEN sockets to fill
+              * reuseport: allow further sockets to bind the same port
+Return Value: number of sockets opened
+******************************************************************************/
+static int open_sockets(context *pc, int *sd, int reuseport)
 {
-    int on;
-    pthread_t client;
     struct addrinfo *aip, *aip2;
     struct addrinfo hints;
-    struct sockaddr_storage client_addr;
-    socklen_t addr_len = sizeof(struct sockaddr_storage);
-    fd_set selectfds;
-    int max_fds = 0;
     char name[NI_MAXHOST];
-    int err;
-    int i;
-
-    context *pcontext = arg;
-    pglobal = pcontext->pglobal;
-
-    /* set cleanup handler to cleanup resources */
-    pthread_cleanup_push(server_cleanup, pcontext);
+    int err, on, i;
 
     bzero(&hints, sizeof(hints));
     hints.ai_family = PF_UNSPEC;
     hints.ai_flags = AI_PASSIVE;
     hints.ai_socktype = SOCK_STREAM;
 
-    snprintf(name, sizeof(name), "%d", ntohs(pcontext->conf.port));
+    snprintf(name, sizeof(name), "%d", ntohs(pc->conf.port));
     if((err = getaddrinfo(NULL, name, &hints, &aip)) != 0) {
         perror(gai_strerror(err));
         exit(EXIT_FAILURE);
     }
 
     for(i = 0; i < MAX_SD_LEN; i++)
-        pcontext->sd[i] = -1;
-
-    #ifdef MANAGMENT
-    if (pthread_mutex_init(&client_infos.mutex, NULL)) {
-        perror("Mutex initialization failed");
-        exit(EXIT_FAILURE);
-    }
-
-    client_infos.client_count = 0;
-    client_infos.infos = NULL;
-    #endif
+        sd[i] = -1;
 
-    /* open sockets for server (1 socket / address family) */
     i = 0;
     for(aip2 = aip; aip2 != NULL; aip2 = aip2->ai_next) {
-        if((pcontext->sd[i] = socket(aip2->ai_family, aip2->ai_socktype, 0)) < 0) {
+        if((sd[i] = socket(aip2->ai_family, aip2->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+            sd[i] = -1;
             continue;
         }
 
         /* ignore "socket already in use" errors */
         on = 1;
-        if(setsockopt(pcontext->sd[i], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+        if(setsockopt(sd[i], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
             perror("setsockopt(SO_REUSEADDR) failed\n");
         }
 
+        #ifdef SO_REUSEPORT
+        /* every event loop listens on its own socket, the kernel balances between them */
+        on = 1;
+        if(reuseport && setsockopt(sd[i], SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            DBG("setsockopt(SO_REUSEPORT) failed\n");
+        }
+        #endif
+
         /* IPv6 socket should listen to IPv6 only, otherwise we will get "socket already in use" */
         on = 1;
-        if(aip2->ai_family == AF_INET6 && setsockopt(pcontext->sd[i], IPPROTO_IPV6, IPV6_V6ONLY,
+        if(aip2->ai_family == AF_INET6 && setsockopt(sd[i], IPPROTO_IPV6, IPV6_V6ONLY,
                 (const void *)&on , sizeof(on)) < 0) {
             perror("setsockopt(IPV6_V6ONLY) failed\n");
         }
 
-        /* perhaps we will use this keep-alive feature oneday */
-        /* setsockopt(sd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)); */
-
-        if(bind(pcontext->sd[i], aip2->ai_addr, aip2->ai_addrlen) < 0) {
-            perror("bind");
-            pcontext->sd[i] = -1;
+        if(bind(sd[i], aip2->ai_addr, aip2->ai_addrlen) < 0) {
+            DBG("bind failed: %s\n", strerror(errno));
+            close(sd[i]);
+            sd[i] = -1;
             continue;
         }
 
-        if(listen(pcontext->sd[i], 10) < 0) {
+        if(listen(sd[i], SOMAXCONN) < 0) {
             perror("listen");
-            pcontext->sd[i] = -1;
+            close(sd[i]);
+            sd[i] = -1;
         } else {
             i++;
             if(i >= MAX_SD_LEN) {
@@ -1525,74 +2332,354 @@ void *server_thread(void *arg)
         }
     }
 
-    pcontext->sd_len = i;
+    freeaddrinfo(aip);
 
-    if(pcontext->sd_len < 1) {
-        OPRINT("%s(): bind(%d) failed\n", __FUNCTION__, htons(pcontext->conf.port));
-        closelog();
-        exit(EXIT_FAILURE);
+    return i;
+}
+
+/******************************************************************************
+Description.: Prepares an event loop. Each loop gets its own listening
+              sockets if the kernel supports SO_REUSEPORT, otherwise it
+              shares the sockets of the first loop.
+Input Value.: * pc.....: the server context
+              * id.....: number of the event loop
+Return Value: 0 if everything is OK, -1 otherwise
+******************************************************************************/
+static int loop_init(context *pc, int id)
+{
+    loop *lp = &pc->loops[id];
+    struct epoll_event ev;
+    int i;
+
+    lp->id = id;
+    lp->pc = pc;
+    lp->pending = 0;
+    lp->clients = NULL;
+    lp->closed = NULL;
+
+    if((lp->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1");
+        return -1;
     }
 
-    /* create a child for every client that connects */
-    while(!pglobal->stop) {
-        //int *pfd = (int *)malloc(sizeof(int));
-        cfd *pcfd = malloc(sizeof(cfd));
+    if((lp->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        close(lp->epfd);
+        return -1;
+    }
 
-        if(pcfd == NULL) {
-            fprintf(stderr, "failed to allocate (a very small amount of) memory\n");
-            exit(EXIT_FAILURE);
+    /* only the loop side must not block, workers always hand back their client */
+    if(pipe2(lp->work_pipe, O_CLOEXEC) < 0 ||
+       fcntl(lp->work_pipe[0], F_SETFL, O_NONBLOCK) < 0) {
+        perror("pipe2");
+        close(lp->efd);
+        close(lp->epfd);
+        return -1;
+    }
+    lp->workers = 0;
+    pthread_mutex_init(&lp->work_mutex, NULL);
+    pthread_cond_init(&lp->work_done, NULL);
+
+    lp->sd_shared = 0;
+    lp->sd_len = open_sockets(pc, lp->sd, pc->conf.threads > 1);
+    if(lp->sd_len < 1) {
+        if(id == 0) {
+            OPRINT("%s(): bind(%d) failed\n", __FUNCTION__, htons(pc->conf.port));
+            pthread_cond_destroy(&lp->work_done);
+            pthread_mutex_destroy(&lp->work_mutex);
+            close(lp->work_pipe[0]);
+            close(lp->work_pipe[1]);
+            close(lp->efd);
+            close(lp->epfd);
+            return -1;
         }
 
-        DBG("waiting for clients to connect\n");
+        DBG("event loop #%02d shares the sockets of the first one\n", id);
+        memcpy(lp->sd, pc->loops[0].sd, sizeof(lp->sd));
+        lp->sd_len = pc->loops[0].sd_len;
+        lp->sd_shared = 1;
+    }
 
-        do {
-            FD_ZERO(&selectfds);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &lp->efd;
+    epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->efd, &ev);
 
-            for(i = 0; i < MAX_SD_LEN; i++) {
-                if(pcontext->sd[i] != -1) {
-                    FD_SET(pcontext->sd[i], &selectfds);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &lp->work_pipe[0];
+    epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->work_pipe[0], &ev);
 
-                    if(pcontext->sd[i] > max_fds)
-                        max_fds = pcontext->sd[i];
-                }
-            }
+    for(i = 0; i < MAX_SD_LEN; i++) {
+        if(lp->sd[i] == -1)
+            continue;
 
-            err = select(max_fds + 1, &selectfds, NULL, NULL, NULL);
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        #ifdef EPOLLEXCLUSIVE
+        if(lp->sd_shared)
+            ev.events |= EPOLLEXCLUSIVE;
+        #endif
+        ev.data.ptr = &lp->sd[i];
+        epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->sd[i], &ev);
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: closes all clients and releases the resources of an event loop
+Input Value.: the event loop
+Return Value: -
+******************************************************************************/
+static void loop_cleanup(void *arg)
+{
+    loop *lp = arg;
+    work *w;
+    int i, state;
+
+    DBG("cleaning up event loop #%02d\n", lp->id);
+
+    /* running workers still use the pipe and their clients */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    pthread_mutex_lock(&lp->work_mutex);
+    while(lp->workers > 0)
+        pthread_cond_wait(&lp->work_done, &lp->work_mutex);
+    pthread_mutex_unlock(&lp->work_mutex);
+    pthread_setcancelstate(state, NULL);
+
+    while(read(lp->work_pipe[0], &w, sizeof(w)) == sizeof(w))
+        work_free(w);
+
+    while(lp->clients != NULL)
+        client_close(lp->clients);
+    loop_reap(lp);
+
+    if(!lp->sd_shared) {
+        for(i = 0; i < MAX_SD_LEN; i++) {
+            if(lp->sd[i] != -1)
+                close(lp->sd[i]);
+        }
+    }
+
+    pthread_cond_destroy(&lp->work_done);
+    pthread_mutex_destroy(&lp->work_mutex);
+    close(lp->work_pipe[0]);
+    close(lp->work_pipe[1]);
+    close(lp->efd);
+    close(lp->epfd);
+}
+
+/******************************************************************************
+Description.: The event loop, accepts clients and drives all of them by
+              non-blocking reads and writes.
+Input Value.: arg is the loop to run
+Return Value: always NULL
+******************************************************************************/
+void *loop_thread(void *arg)
+{
+    loop *lp = arg;
+    config *conf = &lp->pc->conf;
+    struct epoll_event events[64];
+    time_t last_check = time(NULL);
+    void *ptr;
+    int i, n;
+
+    /* pin the loop to a core if requested */
+    if(conf->cpu_count > 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(conf->cpu[lp->id % conf->cpu_count], &cpus);
+        if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            OPRINT("could not pin event loop #%02d to core %d\n", lp->id, conf->cpu[lp->id % conf->cpu_count]);
+        }
+    }
+
+    pthread_cleanup_push(loop_cleanup, lp);
+
+    while(!pglobal->stop) {
+        n = epoll_wait(lp->epfd, events, LENGTH_OF(events), 1000);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
 
-            if(err < 0 && errno != EINTR) {
-                perror("select");
-                exit(EXIT_FAILURE);
+        for(i = 0; i < n; i++) {
+            ptr = events[i].data.ptr;
+
+            if(ptr == &lp->efd) {
+                loop_frames(lp);
+            } else if(ptr == &lp->work_pipe[0]) {
+                loop_work(lp);
+            } else if(ptr >= (void *)&lp->sd[0] && ptr < (void *)&lp->sd[MAX_SD_LEN]) {
+                loop_accept(lp, *(int *)ptr);
+            } else {
+                client_event(ptr, events[i].events);
             }
-        } while(err <= 0);
+        }
 
-        for(i = 0; i < max_fds + 1; i++) {
-            if(pcontext->sd[i] != -1 && FD_ISSET(pcontext->sd[i], &selectfds)) {
-                pcfd->fd = accept(pcontext->sd[i], (struct sockaddr *)&client_addr, &addr_len);
-                pcfd->pc = pcontext;
+        if(time(NULL) != last_check) {
+            last_check = time(NULL);
+            loop_timeouts(lp);
+        }
 
-                /* start new thread that will handle this TCP connected client */
-                DBG("create thread to handle client that just established a connection\n");
+        loop_reap(lp);
+    }
 
-                if(getnameinfo((struct sockaddr *)&client_addr, addr_len, name, sizeof(name), NULL, 0, NI_NUMERICHOST) == 0) {
-                    syslog(LOG_INFO, "serving client: %s\n", name);
-                    DBG("serving client: %s\n", name);
-                }
+    DBG("leaving event loop #%02d\n", lp->id);
+    pthread_cleanup_pop(1);
 
-                #if defined(MANAGMENT)
-                pcfd->client = add_client(name);
-                #endif
+    return NULL;
+}
 
-                if(pthread_create(&client, NULL, &client_thread, pcfd) != 0) {
-                    DBG("could not launch another client thread\n");
-                    close(pcfd->fd);
-                    free(pcfd);
-                    continue;
-                }
-                pthread_detach(client);
+/******************************************************************************
+Description.: unlocks the mutex a cancelled watcher thread was waiting on
+Input Value.: the mutex
+Return Value: -
+******************************************************************************/
+static void watcher_cleanup(void *arg)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+/******************************************************************************
+Description.: Waits for fresh frames of an input plugin and wakes up all
+              event loops of the server.
+Input Value.: arg is the watcher
+Return Value: always NULL
+******************************************************************************/
+void *watcher_thread(void *arg)
+{
+    watcher *w = arg;
+    input *in = &pglobal->in[w->input_number];
+    uint64_t one = 1;
+    unsigned int seen;
+    int i;
+
+    pthread_mutex_lock(&in->db);
+    seen = in->seq;
+    pthread_mutex_unlock(&in->db);
+
+    while(!pglobal->stop) {
+        /* compare the sequence number instead of relying on the broadcast,
+         * a frame published while the loops get woken up is not missed */
+        pthread_mutex_lock(&in->db);
+        pthread_cleanup_push(watcher_cleanup, &in->db);
+        while(in->seq == seen && !pglobal->stop)
+            pthread_cond_wait(&in->db_update, &in->db);
+        seen = in->seq;
+        pthread_cleanup_pop(1);
+
+        for(i = 0; i < w->pc->loop_count; i++) {
+            __sync_fetch_and_or(&w->pc->loops[i].pending, (uint64_t)1 << w->input_number);
+            if(write(w->pc->loops[i].efd, &one, sizeof(one)) < 0) {
+                DBG("could not wake up event loop #%02d\n", i);
             }
         }
     }
 
+    return NULL;
+}
+
+/******************************************************************************
+Description.: This function cleans up resources allocated by the server_thread
+Input Value.: arg is the server context
+Return Value: -
+******************************************************************************/
+void server_cleanup(void *arg)
+{
+    context *pcontext = arg;
+    int i;
+
+    OPRINT("cleaning up resources allocated by server thread #%02d\n", pcontext->id);
+
+    for(i = 0; i < pcontext->watcher_count; i++) {
+        pthread_cancel(pcontext->watchers[i].threadID);
+        pthread_join(pcontext->watchers[i].threadID, NULL);
+    }
+    pcontext->watcher_count = 0;
+
+    /* the first event loop runs in the server thread itself */
+    for(i = 1; i < pcontext->loop_count; i++) {
+        pthread_cancel(pcontext->loops[i].threadID);
+        pthread_join(pcontext->loops[i].threadID, NULL);
+    }
+    pcontext->loop_count = 0;
+}
+
+/******************************************************************************
+Description.: Open the TCP sockets and serve the clients. The configured
+              number of event loops accept and serve clients, the first one
+              runs in this thread. For each input plugin a watcher thread
+              wakes up the loops if a new frame was published.
+Input Value.: arg is the server context
+Return Value: always NULL, will only return on exit
+******************************************************************************/
+void *server_thread(void *arg)
+{
+    context *pcontext = arg;
+    char labels[64];
+    int i;
+
+    pglobal = pcontext->pglobal;
+
+    /* set cleanup handler to cleanup resources */
+    pthread_cleanup_push(server_cleanup, pcontext);
+
+    snprintf(labels, sizeof(labels), "port=\"%d\"", ntohs(pcontext->conf.port));
+    pcontext->metrics.stream_clients = metric_gauge("mjpg_http_stream_clients",
+                                                    "Streams being served", labels);
+    pcontext->metrics.frames_sent = metric_counter("mjpg_http_frames_sent_total",
+                                                   "Frames sent to snapshot and stream clients", labels);
+    pcontext->metrics.bytes_sent = metric_counter("mjpg_http_bytes_sent_total",
+                                                  "Bytes sent to clients", labels);
+    pcontext->metrics.send_errors = metric_counter("mjpg_http_send_errors_total",
+                                                   "Connections that failed while sending", labels);
+
+    #ifdef MANAGMENT
+    if (pthread_mutex_init(&client_infos.mutex, NULL)) {
+        perror("Mutex initialization failed");
+        exit(EXIT_FAILURE);
+    }
+
+    client_infos.client_count = 0;
+    client_infos.infos = NULL;
+    #endif
+
+    /* prepare the event loops and start all but the first one */
+    pcontext->loop_count = 0;
+    for(i = 0; i < pcontext->conf.threads; i++) {
+        if(loop_init(pcontext, i) != 0) {
+            closelog();
+            exit(EXIT_FAILURE);
+        }
+
+        if(i > 0 && pthread_create(&pcontext->loops[i].threadID, NULL, loop_thread, &pcontext->loops[i]) != 0) {
+            OPRINT("could not start event loop #%02d\n", i);
+            closelog();
+            exit(EXIT_FAILURE);
+        }
+        pcontext->loop_count++;
+    }
+
+    /* watch all inputs for fresh frames */
+    pcontext->watcher_count = 0;
+    for(i = 0; i < pglobal->incnt; i++) {
+        pcontext->watchers[i].pc = pcontext;
+        pcontext->watchers[i].input_number = i;
+        if(pthread_create(&pcontext->watchers[i].threadID, NULL, watcher_thread, &pcontext->watchers[i]) != 0) {
+            OPRINT("could not start watcher thread for input #%02d\n", i);
+            closelog();
+            exit(EXIT_FAILURE);
+        }
+        pcontext->watcher_count++;
+    }
+
+    loop_thread(&pcontext->loops[0]);
+
     DBG("leaving server thread, calling cleanup function now\n");
     pthread_cleanup_pop(1);
 
@@ -1811,8 +2898,27 @@ void send_input_JSON(int fd, int input_number)
         }
     }
     sprintf(buffer + strlen(buffer),
-            "\n]\n"
-            "}\n");
+            "\n],\n"
+            "\"frames\": {\n"
+            "\"published\": %u,\n"
+            "\"rejected\": %u,\n"
+            "\"drained\": %u,\n"
+            "\"queued\": %d,\n"
+            "\"age_us\": %d,\n"
+            "\"consumers\": %d,\n"
+            "\"rate_fps\": %d,\n"
+            "\"demand\": \"%s\"\n"
+            "}\n"
+            "}\n",
+            pglobal->in[input_number].seq,
+            pglobal->in[input_number].stats.rejected,
+            pglobal->in[input_number].stats.drained,
+            pglobal->in[input_number].stats.queued,
+            pglobal->in[input_number].stats.age,
+            pglobal->in[input_number].consumers,
+            pglobal->in[input_number].rate,
+            (pglobal->in[input_number].demand == INPUT_STANDBY) ? "standby" :
+            (pglobal->in[input_number].demand == INPUT_IDLE) ? "idle" : "active");
     i = strlen(buffer);
 
     /* first transmit HTTP-header, afterwards transmit content of file */
@@ -1893,6 +2999,38 @@ void send_program_JSON(int fd)
     }
 }
 
+/******************************************************************************
+Description.: Sends the metrics of all plugins in the Prometheus text format
+Input Value.: fildescriptor fd to send the answer to
+Return Value: -
+******************************************************************************/
+void send_metrics(int fd)
+{
+    char buffer[BUFFER_SIZE] = {0}, *text = NULL;
+    size_t len = 0;
+    FILE *f;
+
+    DBG("Serving the metrics\n");
+
+    if((f = open_memstream(&text, &len)) == NULL) {
+        send_error(fd, 500, "could not print the metrics");
+        return;
+    }
+    metrics_print(f);
+    fclose(f);
+
+    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
+            "Content-type: %s\r\n" \
+            STD_HEADER \
+            "\r\n", "text/plain; version=0.0.4");
+
+    /* first transmit HTTP-header, afterwards transmit the metrics */
+    if(write(fd, buffer, strlen(buffer)) < 0 || write(fd, text, len) < 0) {
+        DBG("unable to serve the metrics\n");
+    }
+    free(text);
+}
+
 /******************************************************************************
 Description.:   checks the source string for non printable characters and replaces them with space
                 the two arguments should be the same size allocated memory areas
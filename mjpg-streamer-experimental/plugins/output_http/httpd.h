@@ -49,6 +49,15 @@
     "Pragma: no-cache\r\n" \
     "Expires: Mon, 3 Jan 2000 12:34:56 GMT\r\n"
 
+/*
+ * Snapshots carry an ETag, they may be stored but must be revalidated,
+ * so polling clients get a "304 Not Modified" if the frame did not change.
+ */
+#define SNAPSHOT_HEADER "Connection: close\r\n" \
+    "Server: MJPG-Streamer/0.2\r\n" \
+    "Cache-Control: no-cache, must-revalidate, max-age=0\r\n" \
+    "Expires: Mon, 3 Jan 2000 12:34:56 GMT\r\n"
+
 /*
  * Maximum number of server sockets (i.e. protocol families) to listen.
  */
@@ -94,6 +103,7 @@ typedef enum {
     A_INPUT_JSON,
     A_OUTPUT_JSON,
     A_PROGRAM_JSON,
+    A_METRICS,
     #ifdef MANAGMENT
     A_CLIENTS_JSON
     #endif
@@ -111,11 +121,21 @@ typedef struct {
     char *query_string;
 } request;
 
-/* the iobuffer structure is used to read from the HTTP-client */
-typedef struct {
-    int level;              /* how full is the buffer */
-    char buffer[IO_BUFFER]; /* the data */
-} iobuffer;
+/*
+ * the request header of a client must fit into this buffer, it is only
+ * allocated while the request is being received
+ */
+#define MAX_REQUEST_SIZE (8*1024)
+
+/* seconds a client may take to send the complete request header */
+#define REQUEST_TIMEOUT 5
+
+/* default and maximum seconds a "snapshot&after=<seq>" request waits */
+#define LONGPOLL_TIMEOUT 10
+#define LONGPOLL_TIMEOUT_MAX 60
+
+/* maximum number of event loop threads per server */
+#define MAX_LOOPS 64
 
 /* store configuration for each server instance */
 typedef struct {
@@ -123,19 +143,14 @@ typedef struct {
     char *credentials;
     char *www_folder;
     char nocommands;
+    int threads;            /* number of event loop threads */
+    int cpu[MAX_LOOPS];     /* cores the event loops get pinned to */
+    int cpu_count;
+    int zerocopy;           /* send frames of streams with MSG_ZEROCOPY */
 } config;
 
-/* context of each server thread */
-typedef struct {
-    int sd[MAX_SD_LEN];
-    int sd_len;
-    int id;
-    globals *pglobal;
-    pthread_t threadID;
-
-    config conf;
-} context;
-
+typedef struct _context context;
+typedef struct _loop loop;
 
 #if defined(MANAGMENT)
 /*
@@ -155,26 +170,183 @@ struct {
 
 #endif
 
+/* states of a connected client */
+typedef enum {
+    C_READ_REQUEST,     /* receiving the request header */
+    C_WAIT_FRAME,       /* waiting for the next frame of the input plugin */
+    C_SEND,             /* sending the prepared segments */
+    C_WORK,             /* a worker thread renders the answer, see client_work() */
+    C_CLOSED            /* closed, freed after the current epoll round */
+} client_state;
+
 /*
- * this struct is just defined to allow passing all necessary details to a worker thread
- * "cfd" is for connected/accepted filedescriptor
+ * part of an answer, either a memory buffer or a filedescriptor
+ * that is transmitted with sendfile()
  */
 typedef struct {
-    context *pc;
+    const void *buf;
+    size_t len;             /* bytes left to send */
+    int fd;
+    off_t offset;
+} segment;
+
+/*
+ * a published frame together with its multipart header, built once and
+ * shared by all clients of an event loop that send this frame
+ */
+typedef struct _part part;
+struct _part {
+    input_frame *frame;
+    int refcount;           /* only touched by the owning event loop */
+    char head[128];
+    int head_len;
+};
+
+#define MAX_SEGMENTS 4
+
+/*
+ * MSG_ZEROCOPY only pays off for large frames, smaller ones get copied.
+ * A client may have up to ZEROCOPY_PENDING frames in flight, each of them
+ * stays referenced until the kernel reports it does not need it anymore.
+ */
+#define ZEROCOPY_MIN (16*1024)
+#define ZEROCOPY_PENDING 8
+
+typedef struct {
+    part *part;
+    unsigned int id;        /* last zerocopy send that refers to the part */
+} zc_pending;
+
+/* a connected TCP-client, it is owned by exactly one event loop */
+typedef struct _connection connection;
+
+/*
+ * commands and CGI scripts may take long, a thread of their own renders
+ * the answer into the spool of the client so the event loop keeps going
+ */
+typedef struct {
+    connection *c;
+    loop *lp;               /* gets the finished work back */
+    answer_t type;          /* A_COMMAND or A_CGI */
+    int id;                 /* of the server */
+    int fd;                 /* duplicate of the spool of the client */
+    char *parameter;
+    char *query_string;
+} work;
+
+struct _connection {
     int fd;
+    context *pc;
+    loop *lp;
+    client_state state;
+    unsigned int events;    /* events currently registered with epoll */
+    time_t deadline;        /* for receiving the request */
+
+    answer_t type;
+    int input_number;
+    int consumer;           /* attached to the input as a consumer of its frames */
+    int fps;                /* fps=<n>: frame rate a stream wants, 0 for every frame */
+    frame_pace pace;
+    char address[NI_MAXHOST];
+    int wait;               /* wait=1: skip the latest frame, wait for a new one */
+    int stages;             /* stages=1: tell when each frame passed the pipeline */
+    char etag[256];         /* If-None-Match of the request, a list of tags */
+    int after_set;          /* after=<seq>: only frames newer than "after" */
+    unsigned int after;
+
+    /* frames of a stream, skipped ones are gaps in the sequence numbers */
+    unsigned int frames_sent;
+    unsigned int frames_skipped;
+    unsigned int last_seq;
+
+    char *request;
+    int request_len;
+
+    char head[BUFFER_SIZE]; /* header sent in front of a frame */
+    char part_head[256];    /* header of a stream part with X-Stages */
+    part *part;             /* frame that is currently sent */
+    int spool;              /* holds a complete answer, -1 if unused */
+    work *work;             /* command or CGI script to run off the loop */
+
+    segment seg[MAX_SEGMENTS];
+    int seg_count;
+    int seg_pos;
+
+    int zerocopy;           /* SO_ZEROCOPY is enabled for the socket */
+    int zc_frame;           /* the current frame is sent without copying */
+    int zc_used;            /* at least one send of the frame was zerocopy */
+    unsigned int zc_next;   /* id the kernel assigns to the next send */
+    zc_pending zc[ZEROCOPY_PENDING];
+    int zc_count;
+
     #ifdef MANAGMENT
     client_info *client;
     #endif
-} cfd;
 
+    connection *prev, *next;
+};
 
+/* event loop, each one accepts and serves clients on its own */
+struct _loop {
+    int id;
+    context *pc;
+    pthread_t threadID;
+    int epfd;
+    int efd;                /* eventfd, signaled for new frames */
+    int work_pipe[2];       /* workers hand their finished clients back */
+    int workers;            /* worker threads that did not hand back their client yet */
+    pthread_mutex_t work_mutex;
+    pthread_cond_t work_done; /* signaled when the last worker is done */
+    uint64_t pending;       /* bitmask of inputs with a new frame */
+    int sd[MAX_SD_LEN];
+    int sd_len;
+    int sd_shared;          /* listening sockets belong to loop 0 */
+    connection *clients;
+    connection *closed;
+};
+
+/* waits for frames of one input plugin and wakes up the event loops */
+typedef struct {
+    context *pc;
+    int input_number;
+    pthread_t threadID;
+} watcher;
+
+/* metrics of a server, labelled with its port */
+typedef struct {
+    metric *stream_clients;     /* streams being served */
+    metric *frames_sent;        /* frames of snapshots and streams */
+    metric *bytes_sent;
+    metric *send_errors;        /* connections that failed while sending */
+} server_metrics;
+
+/* context of each server thread */
+struct _context {
+    int id;
+    globals *pglobal;
+    pthread_t threadID;
+
+    loop loops[MAX_LOOPS];
+    int loop_count;
+    watcher watchers[MAX_INPUT_PLUGINS];
+    int watcher_count;
+
+    config conf;
+    server_metrics metrics;
+};
 
 /* prototypes */
 void *server_thread(void *arg);
+void *loop_thread(void *arg);
+void *watcher_thread(void *arg);
+void handle_request(connection *c);
 void send_error(int fd, int which, char *message);
+void command(int id, int fd, char *parameter);
+void execute_cgi(int id, int fd, char *parameter, char *query_string);
 void send_output_JSON(int fd, int plugin_number);
 void send_input_JSON(int fd, int plugin_number);
 void send_program_JSON(int fd);
+void send_metrics(int fd);
 void check_JSON_string(char *source, char *destination);
 
 #ifdef MANAGMENT
@@ -28,10 +28,12 @@
 #include <signal.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <getopt.h>
 #include <pthread.h>
+#include <sched.h>
 #include <syslog.h>
 
 #include <linux/types.h>          /* for videodev2.h */
@@ -63,6 +65,10 @@ void help(void)
             " [-p | --port ]..........: TCP port for this HTTP server\n" \
             " [-c | --credentials ]...: ask for \"username:password\" on connect\n" \
             " [-n | --nocommands ]....: disable execution of commands\n"
+            " [-t | --threads ].......: number of event loop threads\n" \
+            " [-a | --affinity ]......: comma separated list of cores to pin\n" \
+            "                           the event loop threads to\n" \
+            " [-z | --zerocopy ]......: send stream frames with MSG_ZEROCOPY\n"
             " ---------------------------------------------------------------\n");
 }
 
@@ -82,6 +88,8 @@ int output_init(output_parameter *param, int id)
     int  port;
     char *credentials, *www_folder;
     char nocommands;
+    int threads, cpu[MAX_LOOPS], cpu_count, zerocopy;
+    char *token, *saveptr, *end;
 
     DBG("output #%02d\n", param->id);
 
@@ -89,6 +97,9 @@ int output_init(output_parameter *param, int id)
     credentials = NULL;
     www_folder = NULL;
     nocommands = 0;
+    threads = 1;
+    cpu_count = 0;
+    zerocopy = 0;
 
     param->argv[0] = OUTPUT_PLUGIN_NAME;
 
@@ -112,6 +123,12 @@ int output_init(output_parameter *param, int id)
             {"www", required_argument, 0, 0},
             {"n", no_argument, 0, 0},
             {"nocommands", no_argument, 0, 0},
+            {"t", required_argument, 0, 0},
+            {"threads", required_argument, 0, 0},
+            {"a", required_argument, 0, 0},
+            {"affinity", required_argument, 0, 0},
+            {"z", no_argument, 0, 0},
+            {"zerocopy", no_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -165,6 +182,42 @@ int output_init(output_parameter *param, int id)
             DBG("case 8,9\n");
             nocommands = 1;
             break;
+
+            /* t, threads */
+        case 10:
+        case 11:
+            DBG("case 10,11\n");
+            threads = MIN(MAX(atoi(optarg), 1), MAX_LOOPS);
+            break;
+
+            /* a, affinity */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            cpu_count = 0;
+            for(token = strtok_r(optarg, ",", &saveptr); token != NULL && cpu_count < MAX_LOOPS;
+                token = strtok_r(NULL, ",", &saveptr)) {
+                long core = strtol(token, &end, 10);
+
+                /* CPU_SET() must not get a core outside of the set */
+                if(end == token || *end != '\0' || core < 0 || core >= CPU_SETSIZE) {
+                    OPRINT("invalid core \"%s\" for -a, allowed are 0 to %d\n", token, CPU_SETSIZE - 1);
+                    return 1;
+                }
+                cpu[cpu_count++] = core;
+            }
+            break;
+
+            /* z, zerocopy */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            #ifdef SO_ZEROCOPY
+            zerocopy = 1;
+            #else
+            OPRINT("MSG_ZEROCOPY is not supported by this system\n");
+            #endif
+            break;
         }
     }
 
@@ -174,11 +227,23 @@ int output_init(output_parameter *param, int id)
     servers[param->id].conf.credentials = credentials;
     servers[param->id].conf.www_folder = www_folder;
     servers[param->id].conf.nocommands = nocommands;
+    servers[param->id].conf.threads = threads;
+    servers[param->id].conf.cpu_count = cpu_count;
+    memcpy(servers[param->id].conf.cpu, cpu, sizeof(int) * cpu_count);
+    servers[param->id].conf.zerocopy = zerocopy;
 
     OPRINT("www-folder-path...: %s\n", (www_folder == NULL) ? "disabled" : www_folder);
     OPRINT("HTTP TCP port.....: %d\n", ntohs(port));
     OPRINT("username:password.: %s\n", (credentials == NULL) ? "disabled" : credentials);
     OPRINT("commands..........: %s\n", (nocommands) ? "disabled" : "enabled");
+    OPRINT("event loops.......: %d\n", threads);
+    if(cpu_count > 0) {
+        char cores[MAX_LOOPS * 4] = "";
+        for(i = 0; i < cpu_count; i++)
+            snprintf(cores + strlen(cores), sizeof(cores) - strlen(cores), "%s%d", (i > 0) ? "," : "", cpu[i]);
+        OPRINT("affinity..........: %s\n", cores);
+    }
+    OPRINT("zerocopy..........: %s\n", (zerocopy) ? "enabled" : "disabled");
 
     param->global->out[id].name = malloc((strlen(OUTPUT_PLUGIN_NAME) + 1) * sizeof(char));
     sprintf(param->global->out[id].name, OUTPUT_PLUGIN_NAME);
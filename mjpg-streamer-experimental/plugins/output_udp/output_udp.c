@@ -57,9 +57,9 @@
 
 static pthread_t worker;
 static globals *pglobal;
-static int fd, delay, max_frame_size;
+static int fd, delay;
 static char *folder = "/tmp";
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
 static char *command = NULL;
 static int input_number = 0;
 
@@ -102,9 +102,8 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
-    if(frame != NULL) {
-        free(frame);
-    }
+    input_frame_release(frame);
+    frame = NULL;
     close(fd);
 }
 
@@ -116,9 +115,8 @@ Return Value:
 ******************************************************************************/
 void *worker_thread(void *arg)
 {
-    int ok = 1, frame_size = 0, rc = 0;
+    int ok = 1, rc = 0;
     char buffer1[1024] = {0};
-    unsigned char *tmp_framebuffer = NULL;
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
@@ -152,35 +150,23 @@ void *worker_thread(void *arg)
 
 
 
+        /* an idle input starts capturing again for this frame */
+        input_consumer_attach(&pglobal->in[input_number], 0);
+
         DBG("waiting for fresh frame\n");
         pthread_mutex_lock(&pglobal->in[input_number].db);
         pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
-
-            max_frame_size = frame_size + (1 << 16);
-            if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                LOG("not enough memory\n");
-                return NULL;
-            }
-
-            frame = tmp_framebuffer;
-        }
-
-        /* copy frame to our local buffer now */
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+        /* take a reference, the input plugin will not touch this frame anymore */
+        frame = input_frame_acquire(&pglobal->in[input_number]);
 
         /* allow others to access the global buffer again */
         pthread_mutex_unlock(&pglobal->in[input_number].db);
 
+        input_consumer_detach(&pglobal->in[input_number], 0);
+
         /* only save a file if a name came in with the UDP message */
-        if(strlen(udpbuffer) > 0) {
+        if(frame != NULL && strlen(udpbuffer) > 0) {
             DBG("writing file: %s\n", udpbuffer);
 
             /* open file for write. Path must pre-exist */
@@ -190,7 +176,7 @@ void *worker_thread(void *arg)
             }
 
             /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
+            if(write(fd, frame->buf, frame->size) < 0) {
                 OPRINT("could not write to file %s\n", udpbuffer);
                 perror("write()");
                 close(fd);
@@ -200,6 +186,9 @@ void *worker_thread(void *arg)
             close(fd);
         }
 
+        input_frame_release(frame);
+        frame = NULL;
+
         // send back client's message that came in udpbuffer
         sendto(sd, udpbuffer, bytes, 0, (struct sockaddr*)&addr, sizeof(addr));
 
@@ -38,7 +38,9 @@
 
 static pthread_t worker;
 static globals *pglobal;
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
+static unsigned int last_seq = 0;
+static unsigned long frames_missed = 0;
 static int input_number = 0;
 
 /******************************************************************************
@@ -70,7 +72,12 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
-    free(frame);
+    if(frames_missed > 0)
+        OPRINT("missed %lu frames of input #%02d\n", frames_missed, input_number);
+
+    input_frame_release(frame);
+    frame = NULL;
+    input_consumer_detach(&pglobal->in[input_number], 0);
     SDL_Quit();
 }
 
@@ -252,7 +259,7 @@ Return Value:
 ******************************************************************************/
 void *worker_thread(void *arg)
 {
-    int frame_size = 0, firstrun = 1;
+    int firstrun = 1;
 
     SDL_Surface *screen = NULL, *image = NULL;
     decompressed_image rgbimage;
@@ -267,28 +274,34 @@ void *worker_thread(void *arg)
         exit(EXIT_FAILURE);
     }
 
-    /* just allocate a large buffer for the JPEGs */
-    if((frame = malloc(4096 * 1024)) == NULL) {
-        OPRINT("not enough memory for worker thread\n");
-        exit(EXIT_FAILURE);
-    }
-
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
+    /* every frame is wanted, keep the input capturing */
+    input_consumer_attach(&pglobal->in[input_number], 0);
+
     while(!pglobal->stop) {
         DBG("waiting for fresh frame\n");
+
+        /* drop the frame of the previous round */
+        input_frame_release(frame);
+        frame = NULL;
+
         pthread_mutex_lock(&pglobal->in[input_number].db);
         pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+        /* take a reference, the input plugin will not touch this frame anymore */
+        frame = input_frame_acquire(&pglobal->in[input_number]);
 
         pthread_mutex_unlock(&pglobal->in[input_number].db);
 
+        if(frame == NULL)
+            continue;
+
+        frames_missed += input_frame_gap(&last_seq, frame);
+
         /* decompress the JPEG and store results in memory */
-        if(decompress_jpeg(frame, frame_size, &rgbimage)) {
+        if(decompress_jpeg(frame->buf, frame->size, &rgbimage)) {
             DBG("could not properly decompress JPEG data\n");
             continue;
         }
@@ -31,7 +31,10 @@
 #include <limits.h>
 #include <linux/stat.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <pthread.h>
 
+#include "mjpg_streamer.h"
 #include "utils.h"
 
 /******************************************************************************
@@ -143,3 +146,679 @@ void resolutions_help(const char * padding) {
     fprintf(stderr, "\n%sor a custom value like the following" \
     "\n%sexample: 640x480\n", padding, padding);
 }
+
+/******************************************************************************
+Description.: registers the metrics of an input, labelled with its id and
+              the file name of its plugin
+Input Value.: * in.....: the input, its plugin must be set
+              * id.....: its id
+Return Value: -
+******************************************************************************/
+void input_metrics_init(input *in, int id)
+{
+    char labels[128];
+    const char *plugin = strrchr(in->plugin, '/');
+
+    plugin = (plugin != NULL) ? plugin + 1 : in->plugin;
+    snprintf(labels, sizeof(labels), "input=\"%d\",plugin=\"%s\"", id, plugin);
+
+    in->metrics.captured = metric_counter("mjpg_input_frames_captured_total",
+                                          "Frames the input got from its source", labels);
+    in->metrics.dropped = metric_counter("mjpg_input_frames_dropped_total",
+                                         "Captured frames that were broken, stale or not needed and not published", labels);
+    in->metrics.encoded = metric_counter("mjpg_input_frames_encoded_total",
+                                         "Frames the input compressed to JPEG", labels);
+    in->metrics.encode_time = metric_histogram("mjpg_input_encode_seconds",
+                                               "Time it took to compress a frame", labels, NULL, 0);
+    in->metrics.published = metric_counter("mjpg_input_frames_published_total",
+                                           "Frames handed to the output plugins", labels);
+    in->metrics.lock_wait = metric_histogram("mjpg_input_lock_wait_seconds",
+                                             "Time spent waiting for the frame lock of the input", labels, NULL, 0);
+}
+
+/******************************************************************************
+Description.: Locks the db mutex of an input. Only a lock held by another
+              thread gets timed, taking a free one costs no clock reads.
+Input Value.: the input plugin
+Return Value: -
+******************************************************************************/
+void input_lock(input *in)
+{
+    struct timespec start;
+
+    if(pthread_mutex_trylock(&in->db) == 0) {
+        metric_observe(in->metrics.lock_wait, 0);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&in->db);
+    metric_observe_since(in->metrics.lock_wait, &start);
+}
+
+/******************************************************************************
+Description.: drops one reference of a frame, the last reference frees it or
+              hands it back to its owner through the release hook
+Input Value.: frame to release, NULL is ignored
+Return Value: -
+******************************************************************************/
+void input_frame_release(input_frame *frame)
+{
+    if(frame == NULL)
+        return;
+
+    if(__sync_sub_and_fetch(&frame->refcount, 1) == 0) {
+        if(frame->release != NULL) {
+            frame->release(frame);
+            return;
+        }
+        free(frame->buf);
+        free(frame);
+    }
+}
+
+/******************************************************************************
+Description.: hands out a writable frame of the ring to the input plugin.
+              Slots which are only referenced by the ring get reused, if all
+              of them are still held by readers one slot is dropped from the
+              ring and replaced by a fresh frame, so this never waits for
+              the output plugins.
+Input Value.: * in.....: the input plugin the frame will be published to
+              * size...: number of bytes the frame must be able to hold
+Return Value: frame with one reference held by the caller, NULL on error
+              the caller must either publish or release it
+******************************************************************************/
+input_frame *input_frame_get(input *in, int size)
+{
+    input_frame *frame = NULL;
+    unsigned char *tmp = NULL;
+    int i, slot = -1;
+
+    input_lock(in);
+
+    /* prefer a slot nobody but the ring refers to */
+    for(i = 0; i < in->ring_size; i++) {
+        if(in->ring[i] == NULL || in->ring[i]->refcount == 1) {
+            slot = i;
+            break;
+        }
+        if(slot < 0 && in->ring[i] != in->latest)
+            slot = i;
+    }
+
+    /* every slot is busy, leave the old frame to its readers */
+    if(in->ring[slot] != NULL && in->ring[slot]->refcount > 1) {
+        DBG("all frames of the ring are in use, replacing slot %d\n", slot);
+        input_frame_release(in->ring[slot]);
+        in->ring[slot] = NULL;
+    }
+
+    if(in->ring[slot] == NULL) {
+        if((in->ring[slot] = calloc(1, sizeof(input_frame))) == NULL) {
+            pthread_mutex_unlock(&in->db);
+            return NULL;
+        }
+        in->ring[slot]->refcount = 1;
+    }
+
+    frame = in->ring[slot];
+    __sync_add_and_fetch(&frame->refcount, 1);
+
+    pthread_mutex_unlock(&in->db);
+
+    /* nobody else can see this frame now, so it is safe to resize it */
+    if(size > frame->capacity) {
+        if((tmp = realloc(frame->buf, size)) == NULL) {
+            input_frame_release(frame);
+            return NULL;
+        }
+        frame->buf = tmp;
+        frame->capacity = size;
+    }
+    frame->size = 0;
+    timerclear(&frame->captured);
+    timerclear(&frame->encoded);
+
+    return frame;
+}
+
+/******************************************************************************
+Description.: makes a frame the latest one of this input and wakes up all
+              output plugins waiting for it. The reference of the caller is
+              passed on to the input, so the frame must not be touched
+              afterwards.
+Input Value.: * in.....: the input plugin
+              * frame..: frame obtained by input_frame_get()
+Return Value: -
+******************************************************************************/
+void input_frame_publish(input *in, input_frame *frame)
+{
+    input_frame *old = NULL;
+
+    gettimeofday(&frame->published, NULL);
+    metric_add(in->metrics.published, 1);
+
+    input_lock(in);
+
+    old = in->latest;
+    frame->seq = ++in->seq;
+    in->latest = frame;
+    in->timestamp = frame->timestamp;
+
+    /* signal fresh_frame */
+    pthread_cond_broadcast(&in->db_update);
+    pthread_mutex_unlock(&in->db);
+
+    input_frame_release(old);
+}
+
+/******************************************************************************
+Description.: takes a reference to the latest frame of an input
+              the db mutex of the input must be locked by the caller
+Input Value.: the input plugin
+Return Value: latest frame or NULL if nothing was published yet
+******************************************************************************/
+input_frame *input_frame_acquire(input *in)
+{
+    input_frame *frame = in->latest;
+
+    if(frame != NULL)
+        __sync_add_and_fetch(&frame->refcount, 1);
+
+    return frame;
+}
+
+/******************************************************************************
+Description.: Enlarges the ring of an input, for plugins that hold several
+              frames at once, like the encoder threads that keep their frames
+              until they get published in order. Otherwise every slot would
+              be busy and each frame would be allocated again.
+Input Value.: * in.....: the input plugin
+              * size...: number of frames the ring should keep at least,
+                         it is limited to INPUT_FRAME_RING_MAX
+Return Value: -
+******************************************************************************/
+void input_frame_ring_size(input *in, int size)
+{
+    pthread_mutex_lock(&in->db);
+    in->ring_size = MAX(in->ring_size, MIN(size, INPUT_FRAME_RING_MAX));
+    pthread_mutex_unlock(&in->db);
+}
+
+/******************************************************************************
+Description.: Counts the frames a consumer missed, i.e. the gap between the
+              frame it got last and the current one.
+Input Value.: * last...: sequence number of the last frame, gets updated,
+                         0 if the consumer did not get a frame yet
+              * frame..: the current frame
+Return Value: number of frames published in between
+******************************************************************************/
+unsigned int input_frame_gap(unsigned int *last, input_frame *frame)
+{
+    unsigned int gap = 0;
+
+    if(*last != 0 && (int)(frame->seq - *last) > 1)
+        gap = frame->seq - *last - 1;
+
+    *last = frame->seq;
+
+    return gap;
+}
+
+/******************************************************************************
+Description.: drops all references the input holds, frames still used by
+              output plugins are freed when they get released
+Input Value.: the input plugin
+Return Value: -
+******************************************************************************/
+void input_frame_ring_free(input *in)
+{
+    int i;
+
+    pthread_mutex_lock(&in->db);
+    for(i = 0; i < INPUT_FRAME_RING_MAX; i++) {
+        input_frame_release(in->ring[i]);
+        in->ring[i] = NULL;
+    }
+    input_frame_release(in->latest);
+    in->latest = NULL;
+    pthread_mutex_unlock(&in->db);
+}
+
+/******************************************************************************
+Description.: Claims one more input slot for an input plugin that serves
+              several sources, it must be called from input_init(). Output
+              plugins see the slot as an input of its own, the owner does the
+              run, stop and cleanup for it.
+Input Value.: * global.: the global structure
+              * owner..: id of the input claiming the slot
+Return Value: id of the new input, -1 if all slots are taken
+******************************************************************************/
+int input_slot_add(globals *global, int owner)
+{
+    input *in;
+    int id = global->incnt;
+
+    if(id >= MAX_INPUT_PLUGINS)
+        return -1;
+
+    in = &global->in[id];
+    memset(in, 0, sizeof(input));
+    if(pthread_mutex_init(&in->db, NULL) != 0)
+        return -1;
+    if(pthread_cond_init(&in->db_update, NULL) != 0) {
+        pthread_mutex_destroy(&in->db);
+        return -1;
+    }
+    if(pthread_cond_init(&in->demand_update, NULL) != 0) {
+        pthread_cond_destroy(&in->db_update);
+        pthread_mutex_destroy(&in->db);
+        return -1;
+    }
+
+    in->plugin = strdup(global->in[owner].plugin);
+    in->cmd = global->in[owner].cmd;
+    in->param = global->in[owner].param;
+    in->param.id = id;
+    in->ring_size = INPUT_FRAME_RING;
+    input_metrics_init(in, id);
+
+    global->incnt++;
+    return id;
+}
+
+/******************************************************************************
+Description.: Recalculates the highest frame rate the consumers of an input
+              asked for, the db mutex of the input must be locked.
+Input Value.: the input plugin
+Return Value: -
+******************************************************************************/
+static void input_rate_update(input *in)
+{
+    int fps;
+
+    for(fps = INPUT_RATE_MAX; fps > 0 && in->rates[fps] == 0; fps--);
+
+    /* somebody wants every frame, or nobody is there to ask */
+    if(in->rates[0] > 0 || in->consumers == 0)
+        fps = 0;
+
+    if(fps != in->rate)
+        DBG("consumers of the input ask for %d fps\n", fps);
+    in->rate = fps;
+}
+
+/******************************************************************************
+Description.: Registers a consumer of the frames of an input. The first one
+              wakes up an input that stopped capturing.
+Input Value.: * in.....: the input plugin
+              * fps....: frame rate the consumer needs, 0 for every frame
+Return Value: -
+******************************************************************************/
+void input_consumer_attach(input *in, int fps)
+{
+    void (*resume)(input *in) = NULL;
+
+    if(fps < 0 || fps > INPUT_RATE_MAX)
+        fps = 0;
+
+    pthread_mutex_lock(&in->db);
+    if(in->consumers++ == 0) {
+        pthread_cond_broadcast(&in->demand_update);
+        resume = in->resume;
+    }
+    in->rates[fps]++;
+    input_rate_update(in);
+    pthread_mutex_unlock(&in->db);
+
+    if(resume != NULL)
+        resume(in);
+}
+
+/******************************************************************************
+Description.: unregisters a consumer attached by input_consumer_attach()
+Input Value.: * in.....: the input plugin
+              * fps....: the frame rate it was attached with
+Return Value: -
+******************************************************************************/
+void input_consumer_detach(input *in, int fps)
+{
+    if(fps < 0 || fps > INPUT_RATE_MAX)
+        fps = 0;
+
+    pthread_mutex_lock(&in->db);
+    if(--in->consumers == 0)
+        clock_gettime(CLOCK_MONOTONIC, &in->idle_since);
+    in->rates[fps]--;
+    input_rate_update(in);
+    pthread_mutex_unlock(&in->db);
+}
+
+/******************************************************************************
+Description.: Decides if a frame is due at the given rate. A frame may come
+              up to a quarter period early, so a camera running at a
+              multiple of the rate is decimated evenly despite jitter.
+              A changed rate takes effect with the next frame.
+Input Value.: * pace...: state of the decimation, zeroed initially
+              * fps....: the rate, 0 lets every frame through
+              * timestamp: capture time of the frame
+Return Value: 1 if the frame is due, 0 if it should be dropped
+******************************************************************************/
+int frame_pace_due(frame_pace *pace, int fps, struct timeval *timestamp)
+{
+    unsigned long long now, period;
+
+    if(fps <= 0) {
+        pace->fps = 0;
+        return 1;
+    }
+
+    now = timestamp->tv_sec * 1000000ULL + timestamp->tv_usec;
+    period = 1000000ULL / fps;
+
+    /* a new rate, or the clock went back */
+    if(fps != pace->fps || pace->next > now + 2 * period) {
+        pace->fps = fps;
+        pace->next = now;
+    }
+
+    if(now + period / 4 < pace->next)
+        return 0;
+
+    /* fell behind by more than a period, start over from this frame */
+    pace->next += period;
+    if(pace->next < now)
+        pace->next = now + period;
+
+    return 1;
+}
+
+/******************************************************************************
+Description.: tells an input plugin if a frame is needed at the highest
+              rate its consumers asked for, only call it from the one
+              thread that publishes the frames
+Input Value.: * in.....: the input plugin
+              * timestamp: capture time of the frame
+Return Value: 1 if the frame is due, 0 if it should be dropped before it
+              gets compressed
+******************************************************************************/
+int input_frame_due(input *in, struct timeval *timestamp)
+{
+    if(frame_pace_due(&in->pace, in->rate, timestamp))
+        return 1;
+
+    metric_add(in->metrics.dropped, 1);
+    return 0;
+}
+
+/******************************************************************************
+Description.: Tells an input plugin whether its frames are wanted. Once the
+              input goes idle its latest frame is dropped, so the next
+              consumer waits for a fresh one instead of getting a stale one.
+Input Value.: the input plugin
+Return Value: INPUT_ACTIVE, INPUT_IDLE or INPUT_STANDBY
+******************************************************************************/
+demand_state input_demand(input *in)
+{
+    globals *global = in->param.global;
+    demand_state demand = INPUT_ACTIVE;
+    input_frame *stale = NULL;
+    struct timespec now;
+    time_t idle;
+
+    if(global->idle <= 0 && global->standby <= 0)
+        return INPUT_ACTIVE;
+
+    input_lock(in);
+
+    if(in->consumers == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(in->idle_since.tv_sec == 0 && in->idle_since.tv_nsec == 0)
+            in->idle_since = now;
+
+        idle = now.tv_sec - in->idle_since.tv_sec;
+        if(global->standby > 0 && idle >= global->standby)
+            demand = INPUT_STANDBY;
+        else if(global->idle > 0 && idle >= global->idle)
+            demand = INPUT_IDLE;
+    }
+
+    if(demand != INPUT_ACTIVE && in->demand == INPUT_ACTIVE) {
+        stale = in->latest;
+        in->latest = NULL;
+    }
+    in->demand = demand;
+
+    pthread_mutex_unlock(&in->db);
+
+    input_frame_release(stale);
+
+    return demand;
+}
+
+/******************************************************************************
+Description.: unlocks the db mutex if a waiting input thread gets cancelled
+Input Value.: the mutex
+Return Value: -
+******************************************************************************/
+static void input_demand_unlock(void *arg)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+/******************************************************************************
+Description.: blocks the calling input thread until a consumer attaches
+Input Value.: the input plugin
+Return Value: -
+******************************************************************************/
+void input_demand_wait(input *in)
+{
+    pthread_mutex_lock(&in->db);
+    pthread_cleanup_push(input_demand_unlock, &in->db);
+
+    while(in->consumers == 0 && !in->param.global->stop)
+        pthread_cond_wait(&in->demand_update, &in->db);
+
+    pthread_cleanup_pop(1);
+}
+
+/*** metrics ***/
+
+/*
+ * The registry only grows. A metric is filled in completely before the
+ * count makes it visible, so printing needs no lock.
+ */
+static metric metrics[METRICS_MAX];
+static int metric_count;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* buckets of histograms registered without bounds, in seconds */
+static const double metric_seconds[] = {
+    0.00001, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+    0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1
+};
+
+static const char *metric_types[] = { "counter", "gauge", "histogram" };
+
+/******************************************************************************
+Description.: adds a metric to the registry or finds the one registered with
+              the same name and labels before
+Input Value.: * type...: of the metric
+              * name...: Prometheus name of the metric
+              * help...: one line describing it
+              * labels.: like input="0", NULL for none
+              * bounds.: upper bounds of the buckets of a histogram, in
+                         ascending order, NULL for durations
+              * count..: number of bounds
+Return Value: the metric, NULL if the registry is full or the name is
+              taken by a metric of another type
+******************************************************************************/
+static metric *metric_register(metric_type type, const char *name, const char *help, const char *labels,
+                               const double *bounds, int count)
+{
+    metric *m = NULL;
+    int i;
+
+    if(labels == NULL)
+        labels = "";
+
+    pthread_mutex_lock(&metrics_mutex);
+
+    for(i = 0; i < metric_count; i++) {
+        if(strcmp(metrics[i].name, name) == 0 && strcmp(metrics[i].labels, labels) == 0) {
+            if(metrics[i].type == type)
+                m = &metrics[i];
+            goto out;
+        }
+    }
+
+    if(metric_count == METRICS_MAX) {
+        fprintf(stderr, "no room for the metric %s\n", name);
+        goto out;
+    }
+
+    m = &metrics[metric_count];
+    memset(m, 0, sizeof(metric));
+    m->type = type;
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    snprintf(m->help, sizeof(m->help), "%s", help);
+    snprintf(m->labels, sizeof(m->labels), "%s", labels);
+
+    if(type == METRIC_HISTOGRAM) {
+        if(bounds == NULL) {
+            bounds = metric_seconds;
+            count = LENGTH_OF(metric_seconds);
+        }
+        m->bucket_count = MIN(MAX(count, 0), METRIC_BUCKETS_MAX);
+        memcpy(m->bounds, bounds, m->bucket_count * sizeof(double));
+    }
+
+    __atomic_store_n(&metric_count, metric_count + 1, __ATOMIC_RELEASE);
+
+out:
+    pthread_mutex_unlock(&metrics_mutex);
+    return m;
+}
+
+metric *metric_counter(const char *name, const char *help, const char *labels)
+{
+    return metric_register(METRIC_COUNTER, name, help, labels, NULL, 0);
+}
+
+metric *metric_gauge(const char *name, const char *help, const char *labels)
+{
+    return metric_register(METRIC_GAUGE, name, help, labels, NULL, 0);
+}
+
+metric *metric_histogram(const char *name, const char *help, const char *labels, const double *bounds, int count)
+{
+    return metric_register(METRIC_HISTOGRAM, name, help, labels, bounds, count);
+}
+
+/******************************************************************************
+Description.: counts a value in the bucket of a histogram it falls into
+Input Value.: * m......: the histogram
+              * value..: the observed value
+Return Value: -
+******************************************************************************/
+void metric_observe(metric *m, double value)
+{
+    uint64_t old, new;
+    double sum;
+    int i;
+
+    if(m == NULL)
+        return;
+
+    for(i = 0; i < m->bucket_count && value > m->bounds[i]; i++);
+    __atomic_fetch_add(&m->buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&m->count, 1, __ATOMIC_RELAXED);
+
+    if(value == 0)
+        return;
+
+    /* there is no atomic add for doubles */
+    old = __atomic_load_n(&m->sum, __ATOMIC_RELAXED);
+    do {
+        memcpy(&sum, &old, sizeof(double));
+        sum += value;
+        memcpy(&new, &sum, sizeof(double));
+    } while(!__atomic_compare_exchange_n(&m->sum, &old, new, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/******************************************************************************
+Description.: observes the seconds passed since a CLOCK_MONOTONIC time
+Input Value.: * m......: the histogram
+              * start..: the time
+Return Value: -
+******************************************************************************/
+void metric_observe_since(metric *m, struct timespec *start)
+{
+    struct timespec now;
+
+    if(m == NULL)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    metric_observe(m, (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+/******************************************************************************
+Description.: prints the samples of a metric
+Input Value.: * f......: where to print to
+              * m......: the metric
+Return Value: -
+******************************************************************************/
+static void metric_print(FILE *f, metric *m)
+{
+    const char *open = m->labels[0] ? "{" : "", *close = m->labels[0] ? "}" : "";
+    const char *sep = m->labels[0] ? "," : "";
+    uint64_t total = 0, bits;
+    double sum;
+    int i;
+
+    if(m->type != METRIC_HISTOGRAM) {
+        fprintf(f, "%s%s%s%s %lld\n", m->name, open, m->labels, close,
+                (long long)__atomic_load_n(&m->value, __ATOMIC_RELAXED));
+        return;
+    }
+
+    for(i = 0; i <= m->bucket_count; i++) {
+        total += __atomic_load_n(&m->buckets[i], __ATOMIC_RELAXED);
+        if(i < m->bucket_count)
+            fprintf(f, "%s_bucket{%s%sle=\"%g\"} %llu\n", m->name, m->labels, sep, m->bounds[i], (unsigned long long)total);
+        else
+            fprintf(f, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", m->name, m->labels, sep, (unsigned long long)total);
+    }
+
+    bits = __atomic_load_n(&m->sum, __ATOMIC_RELAXED);
+    memcpy(&sum, &bits, sizeof(double));
+    fprintf(f, "%s_sum%s%s%s %.9g\n", m->name, open, m->labels, close, sum);
+
+    /* the buckets were not read at once, the count must match them anyway */
+    fprintf(f, "%s_count%s%s%s %llu\n", m->name, open, m->labels, close, (unsigned long long)total);
+}
+
+/******************************************************************************
+Description.: prints all registered metrics in the Prometheus text format,
+              metrics of the same name are grouped below one HELP and TYPE
+Input Value.: where to print to
+Return Value: -
+******************************************************************************/
+void metrics_print(FILE *f)
+{
+    int count = __atomic_load_n(&metric_count, __ATOMIC_ACQUIRE), i, j;
+
+    for(i = 0; i < count; i++) {
+        for(j = 0; j < i && strcmp(metrics[j].name, metrics[i].name) != 0; j++);
+        if(j < i)
+            continue;
+
+        fprintf(f, "# HELP %s %s\n", metrics[i].name, metrics[i].help);
+        fprintf(f, "# TYPE %s %s\n", metrics[i].name, metric_types[metrics[i].type]);
+        for(j = i; j < count; j++) {
+            if(strcmp(metrics[j].name, metrics[i].name) == 0)
+                metric_print(f, &metrics[j]);
+        }
+    }
+}